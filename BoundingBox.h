@@ -36,8 +36,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <algorithm>
+#ifndef RENDERBOY_HEADLESS
 #include <GL/gl.h>
 #include <GL/glut.h>
+#endif
 
 #include "Vec3D.h"
 
@@ -47,7 +49,7 @@ const float BOUNDINGBOX_EPSILON = 0.0001f;
 
 class BoundingBox {
 public:
-		static const float BBOX_FUZZINESS = 0.00f;
+		static constexpr float BBOX_FUZZINESS = 0.00f;
 
     BoundingBox () : minBb (Vec3Df (0.0f, 0.0f, 0.0f)), maxBb (Vec3Df (0.0f, 0.0f, 0.0f)) {}
     BoundingBox (const Vec3Df & p) : minBb (p), maxBb (p) {}
@@ -147,6 +149,7 @@ public:
     }
     bool intersectRay (const Vec3Df & origin, const Vec3Df & direction, Vec3Df & intersection) const;
 
+#ifndef RENDERBOY_HEADLESS
 		inline void render () {
 			float a = maxBb[0] - minBb[0];
 			float b = maxBb[1] - minBb[1];
@@ -204,6 +207,7 @@ public:
 				glEnd();
 			glPopMatrix();
 		}
+#endif
 
     inline void setAliasing(const bool b) { 
 	anti_aliasing=b;
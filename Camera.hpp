@@ -11,8 +11,11 @@
  */
 
 #pragma once
+#ifndef RENDERBOY_HEADLESS
 #include <QGLViewer/camera.h>
+#endif
 #include <iostream>
+#include <cmath>
 
 #include "Vec3D.h"
 
@@ -20,22 +23,61 @@ using namespace std;
 
 /**
  * Camera Class
- * This class does something you ought to say here!
+ * Snapshot of a viewpoint, as used by the ray tracer: position, frame,
+ * field of view and screen size. It is taken from the qglviewer camera of
+ * the viewer in the GUI, or built with lookAt by headless renders, which
+ * are compiled with RENDERBOY_HEADLESS and do not depend on libQGLViewer.
  *
  * @author François-Xavier Thomas <fx.thomas@gmail.com>
  */
 class Camera {
 	public:
+#ifndef RENDERBOY_HEADLESS
 		/**
 		 * Camera Class Constructor
 		 * 
 		 * @author François-Xavier Thomas
 		 */
-		Camera(const qglviewer::Camera & cam) : camera(cam) {
-			computeProjectionViewMatrix();
+		Camera(const qglviewer::Camera & cam) {
+			pos = Vec3Df (cam.position()[0], cam.position()[1], cam.position()[2]);
+			up = Vec3Df (cam.upVector()[0], cam.upVector()[1], cam.upVector()[2]);
+			right = Vec3Df (cam.rightVector()[0], cam.rightVector()[1], cam.rightVector()[2]);
+			dir = Vec3Df (cam.viewDirection()[0], cam.viewDirection()[1], cam.viewDirection()[2]);
+			hfov = cam.horizontalFieldOfView();
+			width = cam.screenWidth();
+			height = cam.screenHeight();
+			cam.getModelViewProjectionMatrix(matrix);
+			cam.getViewport(viewport);
 		};
+#endif
 
-		Camera() : camera (qglviewer::Camera()) { }
+		/**
+		 * Default camera, at the origin and looking down -z like a qglviewer camera
+		 */
+		Camera() : pos (0.f, 0.f, 0.f), up (0.f, 1.f, 0.f), right (1.f, 0.f, 0.f), dir (0.f, 0.f, -1.f), width (600), height (400) {
+			setFieldOfView (M_PI/4.f);
+		}
+
+		/**
+		 * Camera at position looking at target, with the given vertical field of
+		 * view (in radians) and screen size
+		 */
+		static Camera lookAt (const Vec3Df & position, const Vec3Df & target, float fieldOfView, int width, int height) {
+			Camera c;
+			c.pos = position;
+			c.dir = target - position;
+			c.dir.normalize();
+			// Keep +y up, unless looking along it
+			Vec3Df worldUp (0.f, 1.f, 0.f);
+			if (fabs (Vec3Df::dotProduct (c.dir, worldUp)) > 0.999f) worldUp = Vec3Df (0.f, 0.f, -1.f);
+			c.right = Vec3Df::crossProduct (c.dir, worldUp);
+			c.right.normalize();
+			c.up = Vec3Df::crossProduct (c.right, c.dir);
+			c.width = width;
+			c.height = height;
+			c.setFieldOfView (fieldOfView);
+			return c;
+		}
 
 		/**
 		 * Camera Class Destructor
@@ -45,19 +87,20 @@ class Camera {
 		~Camera() { };
 
 		/**
-		 * Transform vector into world coordinates
+		 * True if c sees exactly the same as this camera, to the pixel
 		 */
-		inline Vec3Df toWorld (const Vec3Df & v) const {
-			float nv[3];
-			camera.getWorldCoordinatesOf (v.getData(), nv);
-			return Vec3Df (nv);
+		inline bool sameView (const Camera & c) const {
+			return pos == c.pos && up == c.up && right == c.right && dir == c.dir && hfov == c.hfov && width == c.width && height == c.height;
 		}
 
-		inline void computeProjectionViewMatrix () {
-			camera.getModelViewProjectionMatrix(matrix);
-			camera.getViewport(viewport);
+		/**
+		 * Transform vector from camera coordinates (x right, y up, looking down -z) into world coordinates
+		 */
+		inline Vec3Df toWorld (const Vec3Df & v) const {
+			return pos + v[0]*right + v[1]*up - v[2]*dir;
 		}
 
+#ifndef RENDERBOY_HEADLESS
 		/**
 		 * Transform vector into screen coordinates
 		 * 
@@ -84,49 +127,63 @@ class Camera {
 
 			return Vec3Df (vs[0], viewport[3]-vs[1], vs[2]);
 		}
+#endif
 
 		/**
 		 * Camera position
 		 */
-		inline Vec3Df position () const { return Vec3Df (camera.position()[0], camera.position()[1], camera.position()[2]); }
+		inline Vec3Df position () const { return pos; }
 
 		/**
 		 * Camera up vector
 		 */
-		inline Vec3Df upVector () const { return Vec3Df (camera.upVector()[0], camera.upVector()[1], camera.upVector()[2]); }
+		inline Vec3Df upVector () const { return up; }
 
 		/**
 		 * Camera right vector
 		 */
-		inline Vec3Df rightVector () const { return Vec3Df (camera.rightVector()[0], camera.rightVector()[1], camera.rightVector()[2]); }
+		inline Vec3Df rightVector () const { return right; }
 
 		/**
 		 * Camera direction vector
 		 */
-		inline Vec3Df viewDirection () const { return Vec3Df (camera.viewDirection()[0], camera.viewDirection()[1], camera.viewDirection()[2]); }
+		inline Vec3Df viewDirection () const { return dir; }
 
 		/**
 		 * Returns screen height
 		 */
-		inline int screenHeight () const { return camera.screenHeight(); }
+		inline int screenHeight () const { return height; }
 
 		/**
 		 * Returns screen width
 		 */
-		inline int screenWidth () const { return camera.screenWidth(); }
+		inline int screenWidth () const { return width; }
 
 		/**
 		 * Returns horizontal FOV
 		 */
-		inline float horizontalFieldOfView () const { return camera.horizontalFieldOfView(); }
+		inline float horizontalFieldOfView () const { return hfov; }
 
 		/**
 		 * Returns aspect ratio
 		 */
-		inline float aspectRatio() const { return camera.aspectRatio(); }
+		inline float aspectRatio() const { return float (width) / float (height); }
 		
 	protected:
-		qglviewer::Camera camera;
+		/**
+		 * Set the vertical field of view, in radians, as qglviewer does
+		 */
+		inline void setFieldOfView (float fov) { hfov = 2.f * atan (tan (fov/2.f) * aspectRatio()); }
+
+		Vec3Df pos;
+		Vec3Df up;
+		Vec3Df right;
+		Vec3Df dir;
+		float hfov;
+		int width;
+		int height;
+#ifndef RENDERBOY_HEADLESS
 		double matrix[16];
 		int viewport[4];
+#endif
 };
@@ -0,0 +1,89 @@
+/**
+ * ChunkedMesh C++ Source code (ChunkedMesh.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "ChunkedMesh.hpp"
+#include <algorithm>
+#include <sstream>
+
+void ChunkedMesh::build (const Mesh & mesh, const string & prefix, unsigned int trianglesPerChunk, GeometryCache & geometryCache) {
+	cache = &geometryCache;
+	numTriangles = mesh.getNumTriangles();
+	ids.clear();
+	firstTriangles.clear();
+	bounds.clear();
+	nodes.clear();
+
+	unsigned int numVertices = mesh.getNumVertices();
+	vector<unsigned int> local (numVertices, numVertices);
+	for (unsigned int first = 0; first < numTriangles; first += trianglesPerChunk) {
+		unsigned int last = min (first + trianglesPerChunk, numTriangles);
+
+		// Copy the triangles of the chunk, with the vertices they use
+		vector<unsigned int> used;
+		vector<Vertex> vertices;
+		vector<Triangle> triangles;
+		for (unsigned int t = first; t < last; t++) {
+			Triangle tri = mesh.getTriangle (t);
+			for (unsigned int j = 0; j < 3; j++) {
+				unsigned int v = tri.getVertex (j);
+				if (local[v] == numVertices) {
+					local[v] = vertices.size();
+					used.push_back (v);
+					vertices.push_back (Vertex (mesh.getVertexPos (v), mesh.getVertexNormal (v)));
+				}
+				tri.setVertex (j, local[v]);
+			}
+			triangles.push_back (tri);
+		}
+		for (vector<unsigned int>::const_iterator v = used.begin(); v != used.end(); v++) local[*v] = numVertices;
+
+		BoundingBox b (vertices[0].getPos());
+		for (unsigned int v = 1; v < vertices.size(); v++) b.extendTo (vertices[v].getPos());
+		if (ids.empty()) bbox = b;
+		else bbox.extendTo (b);
+
+		ostringstream path;
+		path << prefix << ids.size() << ".chunk";
+		ids.push_back (cache->addChunk (path.str(), Mesh (std::move (vertices), std::move (triangles))));
+		firstTriangles.push_back (first);
+		bounds.push_back (b);
+	}
+	if (!ids.empty()) {
+		nodes.reserve (2*ids.size() - 1);
+		buildNodes (0, ids.size());
+	}
+	cout << " (I) Wrote " << ids.size() << " chunks of " << trianglesPerChunk << " triangles to " << prefix << "*" << endl;
+}
+
+unsigned int ChunkedMesh::buildNodes (unsigned int first, unsigned int last) {
+	unsigned int n = nodes.size();
+	nodes.push_back (Node());
+	nodes[n].first = first;
+	nodes[n].last = last;
+	nodes[n].right = 0;
+	if (last - first == 1)
+		nodes[n].bounds = bounds[first];
+	else {
+		unsigned int middle = (first + last) / 2;
+		buildNodes (first, middle);
+		nodes[n].right = buildNodes (middle, last);
+		nodes[n].bounds = nodes[n + 1].bounds;
+		nodes[n].bounds.extendTo (nodes[nodes[n].right].bounds);
+	}
+	return n;
+}
+
+unsigned int ChunkedMesh::findChunk (unsigned int triangle) const {
+	return upper_bound (firstTriangles.begin(), firstTriangles.end(), triangle) - firstTriangles.begin() - 1;
+}
+
+Vec3Df ChunkedMesh::interpolateNormal (unsigned int t, float iu, float iv) const {
+	unsigned int c = findChunk (t);
+	GeometryCache::Lock chunk (*cache, ids[c]);
+	// The chunk was hit, so its file changed since: shade it black
+	if (!chunk.isValid()) return Vec3Df (0.f, 0.f, 0.f);
+	return chunk->mesh.interpolateNormal (t - firstTriangles[c], iu, iv);
+}
@@ -0,0 +1,95 @@
+/**
+ * ChunkedMesh C++ Header (ChunkedMesh.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "BoundingBox.h"
+#include "GeometryCache.hpp"
+
+using namespace std;
+
+/**
+ * ChunkedMesh Class
+ * Out-of-core mesh: runs of consecutive triangles stored on disk as
+ * chunks of a GeometryCache. Only the bounds of each chunk stay in
+ * memory; ray traversal pages the chunks in as rays enter them.
+ *
+ * Triangles keep the numbering of the source mesh, so chunk c holds
+ * triangles [getFirstTriangle (c), getFirstTriangle (c+1)).
+ */
+class ChunkedMesh {
+	public:
+		/**
+		 * ChunkedMesh Class Constructor
+		 */
+		ChunkedMesh() : cache (NULL), numTriangles (0) { }
+
+		/**
+		 * Split mesh into chunks of trianglesPerChunk triangles, written to
+		 * prefix<n>.chunk. The mesh should be sorted along a space-filling
+		 * curve first, so that chunks are spatially coherent.
+		 *
+		 * @see Mesh::reorderMorton
+		 */
+		void build (const Mesh & mesh, const string & prefix, unsigned int trianglesPerChunk, GeometryCache & cache);
+
+		inline bool empty () const { return ids.empty(); }
+		inline unsigned int getNumChunks () const { return ids.size(); }
+		inline unsigned int getNumTriangles () const { return numTriangles; }
+		inline unsigned int getChunkId (unsigned int c) const { return ids[c]; }
+		inline unsigned int getFirstTriangle (unsigned int c) const { return firstTriangles[c]; }
+		inline const BoundingBox & getChunkBoundingBox (unsigned int c) const { return bounds[c]; }
+		inline const BoundingBox & getBoundingBox () const { return bbox; }
+
+		/**
+		 * Bounding volume hierarchy over the chunks, built once with them.
+		 * Node 0 is the root; the left child of an inner node n is n+1 and
+		 * its right child is getRight. A node covers the chunks [first,
+		 * last), halved between its children; leaves hold a single chunk.
+		 * Chunks follow a space-filling curve, so halving their range gives
+		 * compact children without sorting anything.
+		 */
+		struct Node {
+			BoundingBox bounds;
+			unsigned int first, last, right;
+			inline bool isLeaf () const { return last - first == 1; }
+		};
+		inline unsigned int getNumNodes () const { return nodes.size(); }
+		inline const Node & getNode (unsigned int n) const { return nodes[n]; }
+
+		/**
+		 * Entries a traversal keeps pending at most: one per level plus the
+		 * root, and halving the chunks gives at most 33 levels
+		 */
+		static const unsigned int MAX_PENDING_NODES = 64;
+		inline GeometryCache & getCache () const { return *cache; }
+
+		/**
+		 * Chunk holding the given triangle
+		 */
+		unsigned int findChunk (unsigned int triangle) const;
+
+		/**
+		 * Shading normal at barycentric coordinates (iu, iv) of triangle t
+		 *
+		 * @see Mesh::interpolateNormal
+		 */
+		Vec3Df interpolateNormal (unsigned int t, float iu, float iv) const;
+
+	protected:
+		unsigned int buildNodes (unsigned int first, unsigned int last);
+
+		GeometryCache * cache;
+		unsigned int numTriangles;
+		vector<unsigned int> ids;
+		vector<unsigned int> firstTriangles;
+		vector<BoundingBox> bounds;
+		vector<Node> nodes;
+		BoundingBox bbox;
+};
@@ -8,10 +8,8 @@
 #ifndef EDGE_H
 #define EDGE_H
 
-#include <map>
-
 // -------------------------------------------------
-// Intermediate Edge structure for hashed adjacency
+// Intermediate Edge structure for sorted adjacency
 // -------------------------------------------------
 
 struct Edge {
@@ -28,20 +26,6 @@ public:
   unsigned int v[2];
 };
 
-struct compareEdge {
-  inline bool operator()(const Edge e1, const Edge e2) const { 
-    if (e1.v[0] < e2.v[0])
-      return true;
-    if (e1.v[0] > e2.v[0])
-      return false;
-    if (e1.v[1] > e2.v[1])
-      return true;
-    return false;
-  }
-};
-
-typedef std::map<Edge, unsigned int, compareEdge> EdgeMapIndex;
-
 #endif // EDGE_H
 
 // Some Emacs-Hints -- please don't remove:
@@ -0,0 +1,254 @@
+/**
+ * FrameBuffer C++ Source code (FrameBuffer.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "FrameBuffer.hpp"
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "TaskPool.hpp"
+
+static const unsigned int TILE_FLOATS = 4 * FrameBuffer::TILE_SIZE * FrameBuffer::TILE_SIZE;
+
+FrameBuffer::FrameBuffer (unsigned int width, unsigned int height) : block (NULL), data (NULL) {
+	resize (width, height);
+}
+
+FrameBuffer::FrameBuffer (const FrameBuffer & f) : width (f.width), height (f.height), tilesX (f.tilesX), tilesY (f.tilesY), block (NULL), data (NULL) {
+	allocate ();
+	memcpy (data, f.data, (size_t) tilesX * tilesY * TILE_FLOATS * sizeof (float));
+}
+
+FrameBuffer & FrameBuffer::operator= (const FrameBuffer & f) {
+	if (this != &f) {
+		bool sameSize = (f.tilesX * f.tilesY == tilesX * tilesY);
+		width = f.width;
+		height = f.height;
+		tilesX = f.tilesX;
+		tilesY = f.tilesY;
+		if (!sameSize) allocate ();
+		memcpy (data, f.data, (size_t) tilesX * tilesY * TILE_FLOATS * sizeof (float));
+	}
+	return *this;
+}
+
+FrameBuffer::~FrameBuffer () {
+	delete [] block;
+}
+
+void FrameBuffer::allocate () {
+	delete [] block;
+	size_t bytes = (size_t) tilesX * tilesY * TILE_FLOATS * sizeof (float);
+	block = new char[bytes + ALIGNMENT];
+	data = (float *) (((uintptr_t) block + ALIGNMENT - 1) & ~(uintptr_t) (ALIGNMENT - 1));
+}
+
+void FrameBuffer::resize (unsigned int w, unsigned int h) {
+	// Renders of the same size reuse the same memory
+	bool sameSize = (block != NULL && (w + TILE_SIZE - 1) / TILE_SIZE * ((h + TILE_SIZE - 1) / TILE_SIZE) == tilesX * tilesY);
+	width = w;
+	height = h;
+	tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+	if (!sameSize) allocate ();
+	clear ();
+}
+
+void FrameBuffer::clear () {
+	memset (data, 0, (size_t) tilesX * tilesY * TILE_FLOATS * sizeof (float));
+}
+
+void FrameBuffer::clear (unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	for (unsigned int j = y; j < y + h; j++)
+		for (unsigned int i = x; i < x + w; i++) memset (pixel (i, j), 0, 4 * sizeof (float));
+}
+
+FrameBuffer FrameBuffer::copy (unsigned int x, unsigned int y, unsigned int w, unsigned int h) const {
+	FrameBuffer f (w, h);
+	for (unsigned int j = 0; j < h; j++)
+		for (unsigned int i = 0; i < w; i++) memcpy (f.pixel (i, j), pixel (x + i, y + j), 4 * sizeof (float));
+	return f;
+}
+
+Vec3Df FrameBuffer::getColor (unsigned int x, unsigned int y) const {
+	const float * p = pixel (x, y);
+	if (p[3] <= 0.f) return Vec3Df (0.f, 0.f, 0.f);
+	return Vec3Df (p[0] / p[3], p[1] / p[3], p[2] / p[3]);
+}
+
+/**
+ * Four RGBA pixels to four QRgb, scaled to [0, 255], truncated and clamped
+ */
+static inline void resolvePixels (const float * p, QRgb * out) {
+#ifdef __SSE2__
+	const __m128 zero = _mm_setzero_ps(), scale = _mm_set1_ps (255.f), tiny = _mm_set1_ps (1e-30f);
+	__m128i packed[4];
+	for (unsigned int k = 0; k < 4; k++) {
+		__m128 v = _mm_load_ps (p + 4*k);
+		__m128 w = _mm_max_ps (_mm_shuffle_ps (v, v, _MM_SHUFFLE (3, 3, 3, 3)), tiny);
+		v = _mm_mul_ps (_mm_div_ps (v, w), scale);
+		// B, G, R, then 255 for alpha, which is the order of a QRgb in memory
+		v = _mm_shuffle_ps (v, v, _MM_SHUFFLE (3, 0, 1, 2));
+		v = _mm_min_ps (_mm_max_ps (v, zero), scale);
+		packed[k] = _mm_cvttps_epi32 (v);
+	}
+	__m128i rgba = _mm_packus_epi16 (_mm_packs_epi32 (packed[0], packed[1]), _mm_packs_epi32 (packed[2], packed[3]));
+	rgba = _mm_or_si128 (rgba, _mm_set1_epi32 (0xff000000));
+	_mm_storeu_si128 ((__m128i *) out, rgba);
+#else
+	for (unsigned int k = 0; k < 4; k++, p += 4) {
+		float w = max (p[3], 1e-30f);
+		int c[3];
+		for (unsigned int j = 0; j < 3; j++) c[j] = (int) min (max (p[j] / w * 255.f, 0.f), 255.f);
+		out[k] = qRgb (c[0], c[1], c[2]);
+	}
+#endif
+}
+
+QImage FrameBuffer::toImage () const {
+	QImage image (width, height, QImage::Format_RGB32);
+	TaskPool::getInstance()->parallelFor (0, tilesX * tilesY, 1, [&] (unsigned int t) {
+		unsigned int tx = t % tilesX, ty = t / tilesX;
+		const float * tile = data + (size_t) t * TILE_FLOATS;
+		unsigned int w = min (TILE_SIZE, width - tx * TILE_SIZE), h = min (TILE_SIZE, height - ty * TILE_SIZE);
+		QRgb row[TILE_SIZE];
+		for (unsigned int y = 0; y < h; y++) {
+			for (unsigned int x = 0; x < TILE_SIZE; x += 4)
+				resolvePixels (tile + 4 * (y * TILE_SIZE + x), row + x);
+			QRgb * line = (QRgb *) image.scanLine (ty * TILE_SIZE + y);
+			memcpy (line + tx * TILE_SIZE, row, w * sizeof (QRgb));
+		}
+	});
+	return image;
+}
+
+QImage FrameBuffer::toWeightImage () const {
+	float heaviest = 0.f;
+	for (unsigned int y = 0; y < height; y++)
+		for (unsigned int x = 0; x < width; x++) heaviest = max (heaviest, getWeight (x, y));
+
+	QImage image (width, height, QImage::Format_RGB32);
+	for (unsigned int y = 0; y < height; y++) {
+		QRgb * line = (QRgb *) image.scanLine (y);
+		for (unsigned int x = 0; x < width; x++) {
+			int g = (heaviest > 0.f) ? (int) (255.f * getWeight (x, y) / heaviest + 0.5f) : 0;
+			line[x] = qRgb (g, g, g);
+		}
+	}
+	return image;
+}
+
+/**
+ * Little-endian binary output, whatever the host
+ */
+static inline void writeInt (ostream & out, uint32_t v) {
+	char b[4] = { (char) v, (char) (v >> 8), (char) (v >> 16), (char) (v >> 24) };
+	out.write (b, 4);
+}
+
+static inline void writeFloat (ostream & out, float f) {
+	uint32_t v;
+	memcpy (&v, &f, 4);
+	writeInt (out, v);
+}
+
+static inline void writeAttribute (ostream & out, const char * name, const char * type, uint32_t size) {
+	out.write (name, strlen (name) + 1);
+	out.write (type, strlen (type) + 1);
+	writeInt (out, size);
+}
+
+void FrameBuffer::savePFM (const string & filename) const {
+	ofstream out (filename.c_str(), ios::binary);
+	// A negative scale means little-endian; rows go up
+	out << "PF\n" << width << " " << height << "\n-1.0\n";
+	for (unsigned int y = height; y-- > 0;)
+		for (unsigned int x = 0; x < width; x++) {
+			Vec3Df c = getColor (x, y);
+			for (unsigned int j = 0; j < 3; j++) writeFloat (out, c[j]);
+		}
+	out.close ();
+	if (!out) throw Exception ("Failed writing " + filename);
+}
+
+void FrameBuffer::saveEXR (const string & filename) const {
+	ofstream out (filename.c_str(), ios::binary);
+
+	// Magic number and version 2, single part scanline file
+	writeInt (out, 20000630);
+	writeInt (out, 2);
+
+	// Float channels, in alphabetical order
+	const char * channels[3] = { "B", "G", "R" };
+	writeAttribute (out, "channels", "chlist", 3 * 18 + 1);
+	for (unsigned int c = 0; c < 3; c++) {
+		out.write (channels[c], 2);
+		writeInt (out, 2);
+		writeInt (out, 0);
+		writeInt (out, 1);
+		writeInt (out, 1);
+	}
+	out.put (0);
+	writeAttribute (out, "compression", "compression", 1);
+	out.put (0);
+	const char * windows[2] = { "dataWindow", "displayWindow" };
+	for (unsigned int w = 0; w < 2; w++) {
+		writeAttribute (out, windows[w], "box2i", 16);
+		writeInt (out, 0);
+		writeInt (out, 0);
+		writeInt (out, width - 1);
+		writeInt (out, height - 1);
+	}
+	writeAttribute (out, "lineOrder", "lineOrder", 1);
+	out.put (0);
+	writeAttribute (out, "pixelAspectRatio", "float", 4);
+	writeFloat (out, 1.f);
+	writeAttribute (out, "screenWindowCenter", "v2f", 8);
+	writeFloat (out, 0.f);
+	writeFloat (out, 0.f);
+	writeAttribute (out, "screenWindowWidth", "float", 4);
+	writeFloat (out, 1.f);
+	out.put (0);
+
+	// Offsets of the scanlines, each one y, its size, then B, G and R rows
+	uint64_t lineBytes = 8 + 12 * (uint64_t) width;
+	uint64_t first = (uint64_t) out.tellp() + 8 * (uint64_t) height;
+	for (unsigned int y = 0; y < height; y++) {
+		uint64_t offset = first + y * lineBytes;
+		writeInt (out, (uint32_t) offset);
+		writeInt (out, (uint32_t) (offset >> 32));
+	}
+	for (unsigned int y = 0; y < height; y++) {
+		writeInt (out, y);
+		writeInt (out, 12 * width);
+		for (int c = 2; c >= 0; c--)
+			for (unsigned int x = 0; x < width; x++) writeFloat (out, getColor (x, y)[c]);
+	}
+	out.close ();
+	if (!out) throw Exception ("Failed writing " + filename);
+}
+
+static string extension (const string & filename) {
+	string::size_type dot = filename.rfind ('.');
+	if (dot == string::npos) return string();
+	string e = filename.substr (dot + 1);
+	transform (e.begin(), e.end(), e.begin(), ::tolower);
+	return e;
+}
+
+bool FrameBuffer::isFloatFormat (const string & filename) {
+	string e = extension (filename);
+	return e == "pfm" || e == "exr";
+}
+
+void FrameBuffer::save (const string & filename) const {
+	if (extension (filename) == "exr") saveEXR (filename);
+	else savePFM (filename);
+}
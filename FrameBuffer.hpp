@@ -0,0 +1,148 @@
+/**
+ * FrameBuffer C++ Header (FrameBuffer.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <QImage>
+
+#include "TileScheduler.hpp"
+#include "Vec3D.h"
+
+using namespace std;
+
+/**
+ * FrameBuffer Class
+ * High dynamic range image, accumulating weighted samples: each pixel
+ * holds the weighted sum of its samples in RGB, and the sum of their
+ * weights in A. Its colour is their ratio, so that more samples can be
+ * added at any time.
+ *
+ * Pixels are stored by tiles of the same size as the tiles of
+ * TileScheduler, each tile aligned on a cache line, so that threads
+ * rendering different tiles never write to the same line. Rows go down,
+ * as in images.
+ *
+ * The resolve pass (toImage) converts the whole buffer to 8 bits at the
+ * end of a render, four pixels at a time with SSE2.
+ */
+class FrameBuffer {
+	public:
+		class Exception {
+			public:
+				Exception (const string & msg) : msg ("[FrameBuffer]" + msg) {}
+				virtual ~Exception () {}
+				inline const string & getMessage () const { return msg; }
+			private:
+				string msg;
+		};
+
+		static const unsigned int TILE_SIZE = TileScheduler::TILE_SIZE;
+
+		/**
+		 * Alignment of the tiles, in bytes: a cache line
+		 */
+		static const unsigned int ALIGNMENT = 64;
+
+		/**
+		 * FrameBuffer Class Constructor
+		 */
+		FrameBuffer (unsigned int width = 0, unsigned int height = 0);
+		FrameBuffer (const FrameBuffer & f);
+		FrameBuffer & operator= (const FrameBuffer & f);
+		~FrameBuffer ();
+
+		/**
+		 * Change the size, clearing all pixels. The memory is kept if the
+		 * number of tiles does not change.
+		 */
+		void resize (unsigned int width, unsigned int height);
+
+		/**
+		 * Remove all samples
+		 */
+		void clear ();
+
+		/**
+		 * Remove the samples of the pixels of a rectangle
+		 */
+		void clear (unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+
+		/**
+		 * Pixels of a rectangle, which must be inside the buffer
+		 */
+		FrameBuffer copy (unsigned int x, unsigned int y, unsigned int w, unsigned int h) const;
+
+		inline unsigned int getWidth () const { return width; }
+		inline unsigned int getHeight () const { return height; }
+
+		/**
+		 * RGBA sums of pixel (x, y)
+		 */
+		inline float * pixel (unsigned int x, unsigned int y) {
+			return data + 4 * (((y / TILE_SIZE) * tilesX + x / TILE_SIZE) * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE);
+		}
+		inline const float * pixel (unsigned int x, unsigned int y) const {
+			return const_cast<FrameBuffer *> (this)->pixel (x, y);
+		}
+
+		/**
+		 * Add a sample of colour c and weight w to pixel (x, y)
+		 */
+		inline void add (unsigned int x, unsigned int y, const Vec3Df & c, float w = 1.f) {
+			float * p = pixel (x, y);
+			p[0] += w * c[0];
+			p[1] += w * c[1];
+			p[2] += w * c[2];
+			p[3] += w;
+		}
+
+		/**
+		 * Colour of pixel (x, y), black if it has no samples
+		 */
+		Vec3Df getColor (unsigned int x, unsigned int y) const;
+
+		/**
+		 * Sum of the weights of pixel (x, y), its number of samples when they
+		 * all weigh 1
+		 */
+		inline float getWeight (unsigned int x, unsigned int y) const { return pixel (x, y)[3]; }
+
+		/**
+		 * Resolve pass: colours scaled to [0, 255] and clamped
+		 */
+		QImage toImage () const;
+
+		/**
+		 * Weights in grey levels, the heaviest pixel in white: where the
+		 * samples went
+		 */
+		QImage toWeightImage () const;
+
+		/**
+		 * Write the colours as floats, in Portable Float Map or OpenEXR
+		 * (uncompressed) format. Throw a FrameBuffer::Exception on error.
+		 */
+		void savePFM (const string & filename) const;
+		void saveEXR (const string & filename) const;
+
+		/**
+		 * True if filename is saved in a float format by save
+		 */
+		static bool isFloatFormat (const string & filename);
+
+		/**
+		 * Write the colours in PFM or EXR format, after the extension of filename
+		 */
+		void save (const string & filename) const;
+
+	protected:
+		void allocate ();
+
+		unsigned int width, height;
+		unsigned int tilesX, tilesY;
+		char * block;
+		float * data;
+};
@@ -0,0 +1,85 @@
+/**
+ * GBuffer C++ Source code (GBuffer.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "GBuffer.hpp"
+#include <algorithm>
+
+static_assert (TileScheduler::TILE_SIZE * TileScheduler::TILE_SIZE <= 256, "pixels of a tile are numbered on 8 bits");
+
+void GBuffer::resize (unsigned int w, unsigned int h) {
+	width = w;
+	height = h;
+	tilesX = (w + TileScheduler::TILE_SIZE - 1) / TileScheduler::TILE_SIZE;
+	unsigned int tilesY = (h + TileScheduler::TILE_SIZE - 1) / TileScheduler::TILE_SIZE;
+	tiles.clear();
+	tiles.resize ((size_t) tilesX * tilesY);
+	offsets.assign ((size_t) w * h, 0);
+	counts.assign ((size_t) w * h, 0);
+	bytesUsed = 0;
+	overflowed = false;
+}
+
+void GBuffer::clear (unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	assert (x % TileScheduler::TILE_SIZE == 0 && y % TileScheduler::TILE_SIZE == 0);
+	for (unsigned int ty = y; ty < y + h; ty += TileScheduler::TILE_SIZE)
+		for (unsigned int tx = x; tx < x + w; tx += TileScheduler::TILE_SIZE)
+			free (tiles[tileOf (tx, ty)]);
+	for (unsigned int j = y; j < y + h; j++)
+		fill (counts.begin() + (size_t) j * width + x, counts.begin() + (size_t) j * width + x + w, 0);
+}
+
+bool GBuffer::grow (Tile & tile) {
+	// Room for one more hit per pixel at first, then twice as much each time
+	if (overflowed.load (memory_order_relaxed))
+		return false;
+	size_t more = max (tile.hits.capacity(), (size_t) TileScheduler::TILE_SIZE * TileScheduler::TILE_SIZE);
+	unsigned long bytes = more * (sizeof (Hit) + sizeof (unsigned char));
+	if (bytesUsed.fetch_add (bytes, memory_order_relaxed) + bytes > budget) {
+		bytesUsed.fetch_sub (bytes, memory_order_relaxed);
+		overflowed = true;
+		return false;
+	}
+	tile.hits.reserve (tile.hits.capacity() + more);
+	tile.pixels.reserve (tile.hits.capacity());
+	tile.bytes += bytes;
+	return true;
+}
+
+void GBuffer::free (Tile & tile) {
+	bytesUsed.fetch_sub (tile.bytes, memory_order_relaxed);
+	tile.bytes = 0;
+	vector<Hit> ().swap (tile.hits);
+	vector<unsigned char> ().swap (tile.pixels);
+}
+
+void GBuffer::finish (unsigned int x, unsigned int y) {
+	Tile & tile = tiles[tileOf (x, y)];
+	if (tile.pixels.empty())
+		return;
+	unsigned int x0 = x - x % TileScheduler::TILE_SIZE, y0 = y - y % TileScheduler::TILE_SIZE;
+	unsigned int x1 = min (x0 + TileScheduler::TILE_SIZE, width), y1 = min (y0 + TileScheduler::TILE_SIZE, height);
+
+	// Each pixel starts after the hits of the pixels before it, then each
+	// hit goes after those of its pixel added before it, keeping them in
+	// the order of their samples
+	unsigned int next[TileScheduler::TILE_SIZE * TileScheduler::TILE_SIZE];
+	unsigned int offset = 0;
+	for (unsigned int j = y0; j < y1; j++)
+		for (unsigned int i = x0; i < x1; i++) {
+			size_t p = (size_t) j * width + i;
+			offsets[p] = offset;
+			next[(j - y0) * TileScheduler::TILE_SIZE + i - x0] = offset;
+			offset += counts[p];
+		}
+	vector<Hit> sorted (tile.hits.size());
+	for (size_t h = 0; h < tile.hits.size(); h++)
+		sorted[next[tile.pixels[h]]++] = tile.hits[h];
+	tile.hits.swap (sorted);
+	vector<unsigned char> ().swap (tile.pixels);
+	size_t bytes = tile.hits.capacity() * sizeof (Hit);
+	bytesUsed.fetch_sub (tile.bytes - bytes, memory_order_relaxed);
+	tile.bytes = bytes;
+}
@@ -0,0 +1,132 @@
+/**
+ * GBuffer C++ Header (GBuffer.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cassert>
+
+#include "Vec3D.h"
+#include "TileScheduler.hpp"
+
+using namespace std;
+
+/**
+ * GBuffer Class
+ * Primary hits of the last render: for each pixel, where each of its rays
+ * hit the scene, in the order of their samples. A render with the same
+ * view and samples can shade these hits again instead of tracing the
+ * primary rays, when only colours or lights changed.
+ *
+ * The hits are kept per tile of TileScheduler, which a single thread adds
+ * to at a time, and only take the memory of the rays actually traced:
+ * they are added in any order, e.g. one sample of each pixel per
+ * progressive pass, then sorted by pixel once the tile is finished, each
+ * pixel starting at the prefix sum of the counts of the pixels before it.
+ * The hits of a render never take more than the budget: past it, they are
+ * no longer added, and the G-buffer is incomplete until resized.
+ */
+class GBuffer {
+	public:
+		/**
+		 * Most samples kept per pixel. Renders with more do not fill the
+		 * G-buffer.
+		 */
+		static const unsigned int MAX_SAMPLES = 16;
+
+		/**
+		 * Default budget, in bytes
+		 */
+		static const unsigned long DEFAULT_BUDGET = 256ul << 20;
+
+		/**
+		 * Where a primary ray hit: object is -1 if it hit nothing
+		 */
+		struct Hit {
+			int object;
+			Vec3Df position, normal;
+		};
+
+		/**
+		 * GBuffer Class Constructor
+		 */
+		GBuffer () : width (0), height (0), tilesX (0), budget (DEFAULT_BUDGET), bytesUsed (0), overflowed (false) { }
+
+		/**
+		 * Change the size, removing all hits and freeing their memory
+		 */
+		void resize (unsigned int width, unsigned int height);
+
+		/**
+		 * Remove the hits of the pixels of a rectangle, on the grid of the tiles
+		 */
+		void clear (unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+
+		/**
+		 * Sort the hits of the tile of pixel (x, y) by pixel, once all of them
+		 * were added: the hits of its pixels may only be read afterwards
+		 */
+		void finish (unsigned int x, unsigned int y);
+
+		inline unsigned int getWidth () const { return width; }
+		inline unsigned int getHeight () const { return height; }
+
+		inline void setBudget (unsigned long bytes) { budget = bytes; }
+		inline unsigned long getBudget () const { return budget; }
+		inline unsigned long getBytesUsed () const { return bytesUsed; }
+
+		/**
+		 * False if hits were left out for lack of memory since the last resize
+		 */
+		inline bool isComplete () const { return !overflowed; }
+
+		/**
+		 * Hits of pixel (x, y), by sample, and their number
+		 */
+		inline const Hit * getHits (unsigned int x, unsigned int y) const {
+			return &tiles[tileOf (x, y)].hits[offsets[(size_t) y * width + x]];
+		}
+		inline unsigned int getNumHits (unsigned int x, unsigned int y) const { return counts[(size_t) y * width + x]; }
+
+		/**
+		 * Add the hit of the next sample of pixel (x, y)
+		 */
+		inline void add (unsigned int x, unsigned int y, const Hit & hit) {
+			size_t p = (size_t) y * width + x;
+			assert (counts[p] < 255);
+			Tile & tile = tiles[tileOf (x, y)];
+			if (tile.hits.size() == tile.hits.capacity() && !grow (tile))
+				return;
+			tile.hits.push_back (hit);
+			tile.pixels.push_back ((unsigned char) ((y % TileScheduler::TILE_SIZE) * TileScheduler::TILE_SIZE + x % TileScheduler::TILE_SIZE));
+			counts[p]++;
+		}
+
+	protected:
+		// Hits of a tile, the pixel of each one until they are sorted, and
+		// the bytes they take
+		struct Tile {
+			vector<Hit> hits;
+			vector<unsigned char> pixels;
+			size_t bytes;
+			Tile () : bytes (0) { }
+		};
+
+		inline unsigned int tileOf (unsigned int x, unsigned int y) const {
+			return (y / TileScheduler::TILE_SIZE) * tilesX + x / TileScheduler::TILE_SIZE;
+		}
+		bool grow (Tile & tile);
+		void free (Tile & tile);
+
+		unsigned int width, height, tilesX;
+		vector<Tile> tiles;
+		vector<unsigned int> offsets;
+		vector<unsigned char> counts;
+		unsigned long budget;
+		atomic<unsigned long> bytesUsed;
+		atomic<bool> overflowed;
+};
@@ -13,11 +13,15 @@
 #include <cstdio>
 #include <cassert>
 #include <string>
+#include <algorithm>
 
 using namespace std;
 
 static const GLuint OpenGLLightID[] = {GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3, GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7};
 
+// Largest screen-space error of the level of detail drawn for an object, in pixels
+static const float LOD_PIXEL_ERROR = 1.f;
+
 GLViewer::GLViewer () : QGLViewer () {
     wireframe = false;
     renderingMode = Smooth;
@@ -81,6 +85,8 @@ void GLViewer::init() {
     glDepthFunc (GL_LEQUAL);
     glHint (GL_POLYGON_SMOOTH_HINT, GL_NICEST);
     glEnable (GL_POINT_SMOOTH);
+    // Placed objects are scaled, and their normals along with them
+    glEnable (GL_NORMALIZE);
 
     Scene * scene = Scene::getInstance ();
 
@@ -106,6 +112,14 @@ void GLViewer::init() {
     setSceneCenter (qglviewer::Vec (c[0], c[1], c[2]));
     setSceneRadius (r);
     showEntireScene ();
+
+    const SceneFile::CameraDecl & hint = scene->getCameraHint ();
+    if (hint.defined) {
+        camera ()->setPosition (qglviewer::Vec (hint.position[0], hint.position[1], hint.position[2]));
+        camera ()->lookAt (qglviewer::Vec (hint.target[0], hint.target[1], hint.target[2]));
+        if (hint.fieldOfView > 0.f)
+            camera ()->setFieldOfView (hint.fieldOfView * M_PI / 180.f);
+    }
 }
 
 void GLViewer::draw () {
@@ -131,7 +145,24 @@ void GLViewer::draw () {
         glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, glMatAmb);
         glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 128);
         glDisable (GL_COLOR_MATERIAL);
-        o.getMesh ().renderGL (renderingMode == Flat);
+
+        // Pick the level of detail from the size of a pixel at the point of the
+        // object closest to the camera
+        const BoundingBox & bb = o.getBoundingBox ();
+        qglviewer::Vec eye = camera ()->position ();
+        qglviewer::Vec closest;
+        for (unsigned int j = 0; j < 3; j++)
+            closest[j] = max (bb.getMin ()[j], min (bb.getMax ()[j], (float)eye[j]));
+        float maxError = LOD_PIXEL_ERROR * camera ()->pixelGLRatio (closest);
+
+        // Objects share the geometry of their shape, each where it is placed
+        const Object::Placement & p = o.getPlacement ();
+        glPushMatrix ();
+        glTranslatef (p.translation[0], p.translation[1], p.translation[2]);
+        glScalef (p.scale, p.scale, p.scale);
+        glTranslatef (-p.center[0], -p.center[1], -p.center[2]);
+        o.selectLOD (maxError).renderGL (renderingMode == Flat);
+        glPopMatrix ();
     }
 
 		glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
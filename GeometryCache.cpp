@@ -0,0 +1,254 @@
+/**
+ * GeometryCache C++ Source code (GeometryCache.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "GeometryCache.hpp"
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <QMutexLocker>
+
+/**
+ * Chunk file header: magic, then number of vertices and triangles. Follow
+ * the positions and normals of each vertex (6 floats), and the three
+ * indices of each triangle.
+ */
+static const char CHUNK_MAGIC[8] = { 'R', 'B', 'C', 'H', 'U', 'N', 'K', '1' };
+
+GeometryCache::GeometryCache (unsigned long budget) : numChunks (0), hand (0), budget (budget), fuzziness (0.005f), bytesUsed (0), peakBytesUsed (0), misses (0), evictions (0), failures (0) {
+	for (unsigned int s = 0; s < MAX_SEGMENTS; s++)
+		segments[s] = NULL;
+}
+
+GeometryCache::~GeometryCache () {
+	clear();
+}
+
+unsigned int GeometryCache::addChunk (const string & path, const Mesh & mesh) {
+	ofstream output (path.c_str(), ios::binary);
+	if (!output)
+		throw Exception ("Failed opening " + path + " for writing");
+	unsigned int counts[2] = { mesh.getNumVertices(), mesh.getNumTriangles() };
+	output.write (CHUNK_MAGIC, sizeof (CHUNK_MAGIC));
+	output.write ((const char *) counts, sizeof (counts));
+	for (unsigned int v = 0; v < counts[0]; v++) {
+		Vec3Df p = mesh.getVertexPos (v), n = mesh.getVertexNormal (v);
+		output.write ((const char *) p.getData(), 3*sizeof (float));
+		output.write ((const char *) n.getData(), 3*sizeof (float));
+	}
+	for (unsigned int t = 0; t < counts[1]; t++) {
+		Triangle tri = mesh.getTriangle (t);
+		unsigned int indices[3] = { tri.getVertex (0), tri.getVertex (1), tri.getVertex (2) };
+		output.write ((const char *) indices, sizeof (indices));
+	}
+	if (!output)
+		throw Exception ("Failed writing " + path);
+
+	QMutexLocker locker (&mutex);
+	unsigned int id = numChunks;
+	if ((id >> SEGMENT_BITS) >= MAX_SEGMENTS)
+		throw Exception ("Too many chunks for " + path);
+	if ((id & ((1u << SEGMENT_BITS) - 1)) == 0)
+		segments[id >> SEGMENT_BITS].store (new Entry[1u << SEGMENT_BITS], memory_order_release);
+	entry (id).path = path;
+	numChunks = id + 1;
+	return id;
+}
+
+GeometryCache::Chunk * GeometryCache::readChunk (const string & path, float fuzziness, string & error) {
+	ifstream input (path.c_str(), ios::binary | ios::ate);
+	streamoff size = input.tellg();
+	input.seekg (0);
+	char magic[sizeof (CHUNK_MAGIC)];
+	unsigned int counts[2];
+	if (!input.read (magic, sizeof (magic)) || memcmp (magic, CHUNK_MAGIC, sizeof (magic)) != 0 || !input.read ((char *) counts, sizeof (counts))) {
+		error = "Not a chunk file: " + path;
+		return NULL;
+	}
+	// Check the counts before allocating anything for them
+	if (size != streamoff (sizeof (CHUNK_MAGIC) + sizeof (counts) + 6*sizeof (float)*(unsigned long long) counts[0] + 3*sizeof (unsigned int)*(unsigned long long) counts[1])) {
+		error = "Truncated chunk file: " + path;
+		return NULL;
+	}
+
+	vector<Vertex> vertices (counts[0]);
+	for (unsigned int v = 0; v < counts[0]; v++) {
+		float data[6];
+		input.read ((char *) data, sizeof (data));
+		vertices[v] = Vertex (Vec3Df (data[0], data[1], data[2]), Vec3Df (data[3], data[4], data[5]));
+	}
+	vector<Triangle> triangles (counts[1]);
+	for (unsigned int t = 0; t < counts[1]; t++) {
+		unsigned int indices[3];
+		input.read ((char *) indices, sizeof (indices));
+		if (indices[0] >= counts[0] || indices[1] >= counts[0] || indices[2] >= counts[0]) {
+			error = "Invalid triangle in chunk file: " + path;
+			return NULL;
+		}
+		triangles[t] = Triangle (indices);
+	}
+	if (!input) {
+		error = "Truncated chunk file: " + path;
+		return NULL;
+	}
+
+	Chunk * chunk = new Chunk;
+	chunk->mesh = Mesh (std::move (vertices), std::move (triangles));
+	chunk->mesh.packIndices();
+	chunk->kdt.reset (new KDTreeNode (chunk->mesh, fuzziness));
+	chunk->bytes = chunk->mesh.getMemoryFootprint();
+	return chunk;
+}
+
+const GeometryCache::Chunk * GeometryCache::acquire (unsigned int id) {
+	// Pin, then check that the chunk is in memory: eviction unpublishes a
+	// chunk before checking its pins, so either it sees this pin, or this
+	// sees no chunk
+	Entry & e = entry (id);
+	e.pins.fetch_add (1);
+	Chunk * chunk = e.chunk.load ();
+	if (chunk != NULL) {
+		e.hits.fetch_add (1, memory_order_relaxed);
+		if (!e.referenced.load (memory_order_relaxed))
+			e.referenced.store (1, memory_order_relaxed);
+		return chunk;
+	}
+	e.pins.fetch_sub (1);
+	if (e.failed.load (memory_order_relaxed))
+		return NULL;
+	return miss (id);
+}
+
+const GeometryCache::Chunk * GeometryCache::miss (unsigned int id) {
+	Entry & e = entry (id);
+	float f;
+	{
+		QMutexLocker locker (&mutex);
+		f = fuzziness;
+		if (e.failed) return NULL;
+		// Pinned under the mutex, which eviction holds too
+		Chunk * chunk = e.chunk.load ();
+		if (chunk != NULL) {
+			e.hits.fetch_add (1, memory_order_relaxed);
+			e.pins.fetch_add (1);
+			e.referenced.store (1, memory_order_relaxed);
+			return chunk;
+		}
+	}
+
+	// Read outside of the lock, so that other threads keep using the cache.
+	// If another thread read the same chunk meanwhile, keep its copy.
+	string error;
+	Chunk * chunk = readChunk (e.path, f, error);
+	QMutexLocker locker (&mutex);
+	if (chunk == NULL) {
+		if (!e.failed) {
+			e.failed = true;
+			failures++;
+			cerr << " (W) " << error << ", its triangles will be missed" << endl;
+		}
+		return NULL;
+	}
+	Chunk * other = e.chunk.load ();
+	if (other != NULL) {
+		delete chunk;
+		e.hits.fetch_add (1, memory_order_relaxed);
+		e.pins.fetch_add (1);
+		e.referenced.store (1, memory_order_relaxed);
+		return other;
+	}
+	misses++;
+	e.pins.fetch_add (1);
+	e.referenced.store (1, memory_order_relaxed);
+	e.chunk.store (chunk);
+	resident.push_back (id);
+	bytesUsed += chunk->bytes;
+	peakBytesUsed = max (peakBytesUsed, bytesUsed);
+	evict();
+	return chunk;
+}
+
+void GeometryCache::evict () {
+	// Called with the mutex held. Sweep the resident chunks, giving a second
+	// chance to the ones locked since the last sweep, and stop after two
+	// turns without freeing any, when all are locked.
+	unsigned int skipped = 0;
+	while (bytesUsed > budget && !resident.empty() && skipped < 2 * resident.size()) {
+		if (hand >= resident.size()) hand = 0;
+		Entry & e = entry (resident[hand]);
+		if (e.referenced.exchange (0, memory_order_relaxed) || e.pins.load () > 0) {
+			hand++;
+			skipped++;
+			continue;
+		}
+		Chunk * chunk = e.chunk.exchange (NULL);
+		if (e.pins.load () > 0) {
+			// Locked meanwhile, by a lock that may hold the chunk
+			e.chunk.store (chunk);
+			hand++;
+			skipped++;
+			continue;
+		}
+		bytesUsed -= chunk->bytes;
+		delete chunk;
+		resident[hand] = resident.back();
+		resident.pop_back();
+		evictions++;
+		skipped = 0;
+	}
+}
+
+void GeometryCache::setBudget (unsigned long bytes) {
+	QMutexLocker locker (&mutex);
+	budget = bytes;
+	evict();
+}
+
+void GeometryCache::setFuzziness (float f) {
+	QMutexLocker locker (&mutex);
+	fuzziness = f;
+}
+
+void GeometryCache::clear () {
+	QMutexLocker locker (&mutex);
+	for (unsigned int id = 0; id < numChunks; id++)
+		delete entry (id).chunk.load ();
+	for (unsigned int s = 0; s < MAX_SEGMENTS && segments[s] != NULL; s++) {
+		delete [] segments[s].load ();
+		segments[s] = NULL;
+	}
+	numChunks = 0;
+	resident.clear();
+	hand = 0;
+	bytesUsed = 0;
+	failures = 0;
+}
+
+unsigned long GeometryCache::getHits () const {
+	unsigned long hits = 0;
+	for (unsigned int id = 0; id < numChunks; id++)
+		hits += entry (id).hits.load (memory_order_relaxed);
+	return hits;
+}
+
+void GeometryCache::resetStatistics () {
+	QMutexLocker locker (&mutex);
+	for (unsigned int id = 0; id < numChunks; id++)
+		entry (id).hits.store (0, memory_order_relaxed);
+	misses = evictions = 0;
+	peakBytesUsed = bytesUsed;
+}
+
+void GeometryCache::printStatistics () const {
+	QMutexLocker locker (&mutex);
+	unsigned long hits = getHits (), accesses = hits + misses;
+	cout << " (I) Geometry cache: " << hits << " hits, " << misses << " misses";
+	if (accesses > 0)
+		cout << " (" << 100.f * float (hits) / float (accesses) << "% hit rate)";
+	cout << ", " << evictions << " evictions, " << bytesUsed / 1024 << " KB used (peak "
+		<< peakBytesUsed / 1024 << " KB, budget " << budget / 1024 << " KB)" << endl;
+	if (failures > 0)
+		cerr << " (W) Geometry cache: " << failures << " chunks could not be read, renders miss their triangles" << endl;
+}
@@ -0,0 +1,175 @@
+/**
+ * GeometryCache C++ Header (GeometryCache.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <QMutex>
+
+#include "Mesh.h"
+#include "KDTreeNode.hpp"
+
+using namespace std;
+
+/**
+ * GeometryCache Class
+ * Bounded cache of geometry chunks stored on disk. Chunks are registered
+ * once with their file, then paged in on demand (with their own kD-tree)
+ * by GeometryCache::Lock, and evicted when the cache holds more bytes
+ * than its budget, the least recently used first (CLOCK algorithm).
+ * Locked chunks are never evicted, so the cache may exceed its budget when
+ * many threads hold chunks at the same time, until the next miss.
+ *
+ * Locking a chunk in memory takes no mutex: chunks are published through
+ * atomic pointers, and a lock pins its chunk with an atomic count, and
+ * sets a reference bit for eviction. Eviction unpublishes a chunk before
+ * checking that it is not pinned, and publishes it again if it is, so a
+ * chunk is only freed once no lock may hold it. Misses are serialized by
+ * a mutex, and chunks are read from disk outside of it.
+ *
+ * Chunks may be registered while renders lock others, e.g. when a scene
+ * reloads a mesh: they are kept in segments that never move. Reading a
+ * chunk never throws, as
+ * it happens on the threads of a render: a chunk that cannot be read is
+ * reported once, counted as a failure, and its locks are invalid from
+ * then on.
+ */
+class GeometryCache {
+	public:
+		class Exception {
+			public:
+				Exception (const string & msg) : msg ("[GeometryCache]" + msg) {}
+				virtual ~Exception () {}
+				inline const string & getMessage () const { return msg; }
+			private:
+				string msg;
+		};
+
+		/**
+		 * Chunk in memory: geometry, and the kD-tree built on it
+		 */
+		struct Chunk {
+			Mesh mesh;
+			unique_ptr<KDTreeNode> kdt;
+			size_t bytes;
+			Chunk () : bytes (0) { }
+		};
+
+		/**
+		 * Keeps a chunk in memory for as long as it lives. A chunk whose file
+		 * cannot be read gives an invalid lock, which holds nothing.
+		 */
+		class Lock {
+			public:
+				Lock (GeometryCache & cache, unsigned int id) : cache (cache), id (id), chunk (cache.acquire (id)) { }
+				~Lock () { if (chunk != NULL) cache.release (id); }
+				inline bool isValid () const { return chunk != NULL; }
+				inline const Chunk & operator* () const { return *chunk; }
+				inline const Chunk * operator-> () const { return chunk; }
+			private:
+				Lock (const Lock &);
+				Lock & operator= (const Lock &);
+				GeometryCache & cache;
+				unsigned int id;
+				const Chunk * chunk;
+		};
+
+		/**
+		 * Default budget, in bytes
+		 */
+		static const unsigned long DEFAULT_BUDGET = 256ul << 20;
+
+		/**
+		 * GeometryCache Class Constructor
+		 */
+		GeometryCache(unsigned long budget = DEFAULT_BUDGET);
+
+		/**
+		 * GeometryCache Class Destructor
+		 */
+		~GeometryCache();
+
+		/**
+		 * Write a chunk file, and register it. Returns the chunk id.
+		 */
+		unsigned int addChunk (const string & path, const Mesh & mesh);
+
+		/**
+		 * Evict every chunk and forget all registered chunks. Only call it
+		 * when no chunk is locked.
+		 */
+		void clear ();
+
+		void setBudget (unsigned long bytes);
+
+		/**
+		 * Fuzziness of the kD-trees of the chunks read from now on
+		 */
+		void setFuzziness (float f);
+		inline unsigned long getBudget () const { return budget; }
+		inline unsigned int getNumChunks () const { return numChunks; }
+
+		/**
+		 * Statistics, to size the budget: a hit is a lock on a chunk already in
+		 * memory, a miss a lock that had to read the chunk from disk.
+		 */
+		unsigned long getHits () const;
+		inline unsigned long getMisses () const { return misses; }
+		inline unsigned long getEvictions () const { return evictions; }
+		inline unsigned long getBytesUsed () const { return bytesUsed; }
+		inline unsigned long getPeakBytesUsed () const { return peakBytesUsed; }
+
+		/**
+		 * Number of chunks that could not be read, whose triangles renders miss
+		 */
+		inline unsigned int getNumFailures () const { return failures; }
+		void resetStatistics ();
+		void printStatistics () const;
+
+	protected:
+		// Segments of 4096 chunks, up to 4M chunks
+		static const unsigned int SEGMENT_BITS = 12;
+		static const unsigned int MAX_SEGMENTS = 1024;
+
+		// Hits are counted per chunk, next to its pins, rather than on a
+		// counter that every lock of every thread would write
+		struct Entry {
+			string path;
+			atomic<Chunk *> chunk;
+			atomic<unsigned int> pins;
+			atomic<int> referenced;
+			atomic<unsigned long> hits;
+			atomic<bool> failed;
+			Entry () : chunk (NULL), pins (0), referenced (0), hits (0), failed (false) { }
+		};
+
+		inline Entry & entry (unsigned int id) const {
+			return segments[id >> SEGMENT_BITS].load (memory_order_acquire)[id & ((1u << SEGMENT_BITS) - 1)];
+		}
+		const Chunk * acquire (unsigned int id);
+		inline void release (unsigned int id) { entry (id).pins.fetch_sub (1, memory_order_release); }
+		const Chunk * miss (unsigned int id);
+		void evict ();
+		static Chunk * readChunk (const string & path, float fuzziness, string & error);
+
+		GeometryCache (const GeometryCache &);
+		GeometryCache & operator= (const GeometryCache &);
+
+		atomic<Entry *> segments[MAX_SEGMENTS];
+		atomic<unsigned int> numChunks;
+		vector<unsigned int> resident;
+		unsigned int hand;
+		unsigned long budget;
+		float fuzziness;
+		unsigned long bytesUsed;
+		unsigned long peakBytesUsed;
+		unsigned long misses;
+		unsigned long evictions;
+		unsigned int failures;
+		mutable QMutex mutex;
+};
@@ -11,6 +11,8 @@
  */
 
 #include "KDTreeNode.hpp"
+#include "TaskPool.hpp"
+#include <algorithm>
 
 bool KDTreeNode::_lineInBox (const Vec3Df & origin, const Vec3Df & direction, const BoundingBox & bbox, Vec3Df & intersectionPoint) const {
 	unsigned int NUMDIM = 3;
@@ -94,20 +96,20 @@ bool KDTreeNode::_triangleInBox (const Vec3Df & v0, const Vec3Df & v1, const Vec
 
 void KDTreeNode::load () {
 	// Generate vertex list
-	vector<unsigned int> belongs (mesh->getVertices().size(), false);
-	vector<unsigned int> verts (mesh->getVertices().size(), 0);
-	vector<unsigned int> tri (mesh->getTriangles().size(), 0);
-	Vec3Df min = mesh->getVertices()[verts[0]].getPos(), max = min;
+	vector<unsigned int> belongs (mesh->getNumVertices(), false);
+	vector<unsigned int> verts (mesh->getNumVertices(), 0);
+	vector<unsigned int> tri (mesh->getNumTriangles(), 0);
+	Vec3Df min = mesh->getVertexPos(verts[0]), max = min;
 
-	for (unsigned int v = 0; v < mesh->getVertices().size(); v++) {
+	for (unsigned int v = 0; v < mesh->getNumVertices(); v++) {
 		verts[v] = v;
 		for (unsigned int i = 0; i < 3; i++) {
-			if (mesh->getVertices()[v].getPos()[i] < min[i]) min[i] = mesh->getVertices()[v].getPos()[i];
-			if (mesh->getVertices()[v].getPos()[i] > max[i]) max[i] = mesh->getVertices()[v].getPos()[i];
+			if (mesh->getVertexPos(v)[i] < min[i]) min[i] = mesh->getVertexPos(v)[i];
+			if (mesh->getVertexPos(v)[i] > max[i]) max[i] = mesh->getVertexPos(v)[i];
 		}
 	}
 
-	for (unsigned int t = 0; t < mesh->getTriangles().size(); t++) tri[t] = t;
+	for (unsigned int t = 0; t < mesh->getNumTriangles(); t++) tri[t] = t;
 
 	bbox = BoundingBox (min, max);
 	
@@ -117,8 +119,8 @@ void KDTreeNode::load () {
 
 bool KDTreeNode::loadVertices (vector<unsigned int> & verts, vector<unsigned int> & tri, unsigned int axis) {
 	// Initialize stuff
-	if (kleft != NULL) { delete kleft; kleft = NULL; }
-	if (kright != NULL) { delete kright; kright = NULL; }
+	kleft.reset();
+	kright.reset();
 	if (verts.size() == 0) { cout << "Hum... bizarre at KDTreeNode.cpp:28!" << endl; return false; }
 
 	// If leaf is too small, we don't do anything but initialize bounding box and loading triangles
@@ -131,10 +133,11 @@ bool KDTreeNode::loadVertices (vector<unsigned int> & verts, vector<unsigned int
 		// Compute split plane
 		split = 0.;
 		if (NSAMPLES > verts.size()) {
-			for (unsigned int i = 0; i < verts.size(); i++) split += mesh->getVertices()[verts[i]].getPos()[axis];
+			for (unsigned int i = 0; i < verts.size(); i++) split += mesh->getVertexPos(verts[i])[axis];
 			split /= (float)verts.size();
 		}	else {
-			for (unsigned int i = 0; i < NSAMPLES; i++) split += mesh->getVertices()[verts[rand()%verts.size()]].getPos()[axis];
+			// Evenly spaced samples, so that subtrees can be built by any thread in any order
+			for (unsigned int i = 0; i < NSAMPLES; i++) split += mesh->getVertexPos(verts[(unsigned long) i*verts.size()/NSAMPLES])[axis];
 			split /= (float)NSAMPLES;
 		}
 
@@ -154,7 +157,7 @@ bool KDTreeNode::loadVertices (vector<unsigned int> & verts, vector<unsigned int
 		vector<unsigned int> rverts;
 
 		for (vector<unsigned int>::iterator v = verts.begin(); v != verts.end(); v++) {
-			if (mesh->getVertices()[*v].getPos()[axis] < split) lverts.push_back (*v);
+			if (mesh->getVertexPos(*v)[axis] < split) lverts.push_back (*v);
 			else rverts.push_back (*v);
 		}
 
@@ -163,23 +166,23 @@ bool KDTreeNode::loadVertices (vector<unsigned int> & verts, vector<unsigned int
 		vector<unsigned int> rtri;
 
 		for (vector<unsigned int>::iterator t = tri.begin(); t != tri.end(); t++) {
-			Triangle tr = mesh->getTriangles()[*t];
-			bool sl0 = l_bbox.contains (mesh->getVertices()[tr.getVertex(0)].getPos());
-			bool sl1 = l_bbox.contains (mesh->getVertices()[tr.getVertex(1)].getPos());
-			bool sl2 = l_bbox.contains (mesh->getVertices()[tr.getVertex(2)].getPos());
+			Triangle tr = mesh->getTriangle(*t);
+			bool sl0 = l_bbox.contains (mesh->getVertexPos(tr.getVertex(0)));
+			bool sl1 = l_bbox.contains (mesh->getVertexPos(tr.getVertex(1)));
+			bool sl2 = l_bbox.contains (mesh->getVertexPos(tr.getVertex(2)));
 			int sl = (sl0?1:0) + (sl1?1:0) + (sl2?1:0);
 
-			sl0 = r_bbox.contains (mesh->getVertices()[tr.getVertex(0)].getPos());
-			sl1 = r_bbox.contains (mesh->getVertices()[tr.getVertex(1)].getPos());
-			sl2 = r_bbox.contains (mesh->getVertices()[tr.getVertex(2)].getPos());
+			sl0 = r_bbox.contains (mesh->getVertexPos(tr.getVertex(0)));
+			sl1 = r_bbox.contains (mesh->getVertexPos(tr.getVertex(1)));
+			sl2 = r_bbox.contains (mesh->getVertexPos(tr.getVertex(2)));
 			int sr = (sl0?1:0) + (sl1?1:0) + (sl2?1:0);
 
 			bool bl = false, br = false;
 			if (sl > 0) bl = true;
-			else if (_triangleInBox (mesh->getVertices()[tr.getVertex(0)].getPos(), mesh->getVertices()[tr.getVertex(1)].getPos(), mesh->getVertices()[tr.getVertex(2)].getPos(), l_bbox)) bl = true;
+			else if (_triangleInBox (mesh->getVertexPos(tr.getVertex(0)), mesh->getVertexPos(tr.getVertex(1)), mesh->getVertexPos(tr.getVertex(2)), l_bbox)) bl = true;
 
 			if (sr > 0) br = true;
-			else if (_triangleInBox (mesh->getVertices()[tr.getVertex(0)].getPos(), mesh->getVertices()[tr.getVertex(1)].getPos(), mesh->getVertices()[tr.getVertex(2)].getPos(), r_bbox)) br = true;
+			else if (_triangleInBox (mesh->getVertexPos(tr.getVertex(0)), mesh->getVertexPos(tr.getVertex(1)), mesh->getVertexPos(tr.getVertex(2)), r_bbox)) br = true;
 
 			if (bl) ltri.push_back (*t);
 			//else cout << "No tri left (" << sl << "," << sr << ")" << endl;
@@ -189,19 +192,28 @@ bool KDTreeNode::loadVertices (vector<unsigned int> & verts, vector<unsigned int
 
 		if (lverts.size() > 0 && rverts.size() > 0 && lverts.size()+rverts.size() > LEAFSIZE) {
 			// Create left node
-			kleft = new KDTreeNode (fuzziness);
+			kleft.reset (new KDTreeNode (fuzziness));
 			kleft->mesh = mesh;
 			kleft->bbox = l_bbox;
-			kleft->loadVertices(lverts, ltri, (axis+1)%3);
 
 			// Create right node
-			kright = new KDTreeNode (fuzziness);
+			kright.reset (new KDTreeNode (fuzziness));
 			kright->mesh = mesh;
 			kright->bbox = r_bbox;
-			kright->loadVertices(rverts, rtri, (axis+1)%3);
+
+			// Build large subtrees in parallel
+			if (verts.size() >= PARALLEL_VERTICES) {
+				TaskPool::Group group;
+				group.run ([&] () { kleft->loadVertices (lverts, ltri, (axis+1)%3); });
+				kright->loadVertices (rverts, rtri, (axis+1)%3);
+				group.wait ();
+			} else {
+				kleft->loadVertices(lverts, ltri, (axis+1)%3);
+				kright->loadVertices(rverts, rtri, (axis+1)%3);
+			}
 		} else {
-			kleft = NULL;
-			kright = NULL;
+			kleft.reset();
+			kright.reset();
 			data = verts;
 			triangles = tri;
 		}
@@ -211,10 +223,46 @@ bool KDTreeNode::loadVertices (vector<unsigned int> & verts, vector<unsigned int
 
 const KDTreeNode & KDTreeNode::_find (const Vec3Df & v, unsigned int axis) const {
 	if (v[axis] < split) {
-		if (kleft != NULL) return kleft->_find (v, (axis+1)%3);
+		if (kleft) return kleft->_find (v, (axis+1)%3);
 		else return *this;
 	} else {
-		if (kright != NULL)	return kright->_find (v, (axis+1)%3);
+		if (kright)	return kright->_find (v, (axis+1)%3);
 		else return *this;
 	}
 }
+
+void KDTreeNode::remap (const vector<unsigned int> & triangleMap, const vector<unsigned int> & vertexMap) {
+	for (vector<unsigned int>::iterator it = data.begin(); it != data.end(); it++) *it = vertexMap[*it];
+	for (vector<unsigned int>::iterator it = triangles.begin(); it != triangles.end(); it++) *it = triangleMap[*it];
+	sort (data.begin(), data.end());
+	sort (triangles.begin(), triangles.end());
+	if (kleft) kleft->remap (triangleMap, vertexMap);
+	if (kright) kright->remap (triangleMap, vertexMap);
+}
+
+unsigned int KDTreeNode::simulateCacheMisses (unsigned int numLines) const {
+	vector<unsigned long> lines (numLines, (unsigned long)-1);
+	unsigned int misses = 0;
+	_simulateCacheMisses (lines, misses);
+	return misses;
+}
+
+void KDTreeNode::_simulateCacheMisses (vector<unsigned long> & lines, unsigned int & misses) const {
+	const unsigned long LINE = 64;
+	const unsigned long VERTEX_BASE = 1ul << 40;
+	if (!kleft && !kright) {
+		for (vector<unsigned int>::const_iterator t = triangles.begin(); t != triangles.end(); t++) {
+			unsigned long address[4];
+			Triangle tri = mesh->getTriangle(*t);
+			address[0] = (unsigned long)*t * mesh->getBytesPerTriangle();
+			for (unsigned int i = 0; i < 3; i++) address[i+1] = VERTEX_BASE + (unsigned long)tri.getVertex(i) * mesh->getBytesPerVertex();
+			for (unsigned int i = 0; i < 4; i++) {
+				unsigned long line = address[i] / LINE;
+				unsigned long & slot = lines[line % lines.size()];
+				if (slot != line) { slot = line; misses++; }
+			}
+		}
+	}
+	if (kleft) kleft->_simulateCacheMisses (lines, misses);
+	if (kright) kright->_simulateCacheMisses (lines, misses);
+}
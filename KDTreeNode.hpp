@@ -12,6 +12,7 @@
 
 #pragma once
 #include <vector>
+#include <memory>
 #include <cstdlib>
 #include <ctime>
 #include <QObject>
@@ -42,19 +43,20 @@ class KDTreeNode : public QObject {
 		float fuzziness;
 		float split;
 		const Mesh *mesh;
-		KDTreeNode *kleft;
-		KDTreeNode *kright;
+		unique_ptr<KDTreeNode> kleft;
+		unique_ptr<KDTreeNode> kright;
 		vector <unsigned int> data;
 		vector <unsigned int> triangles;
 		BoundingBox bbox;
 
 		const KDTreeNode & _find (const Vec3Df & v, unsigned int axis) const;
+		void _simulateCacheMisses (vector<unsigned long> & lines, unsigned int & misses) const;
 		bool _lineInBox (const Vec3Df & origin, const Vec3Df & direction, const BoundingBox & bbox, Vec3Df & intersectionPoint) const;
 		bool _triangleInBox (const Vec3Df & v0, const Vec3Df & v1, const Vec3Df & v2, const BoundingBox & bbox) const;
 
 	public:
 		/**
-		 * Number of random samples for the median
+		 * Number of samples for the split position
 		 */
 		const static unsigned int NSAMPLES = 200;
 
@@ -63,6 +65,11 @@ class KDTreeNode : public QObject {
 		 */
 		const static unsigned int LEAFSIZE = 2;
 
+		/**
+		 * Nodes with at least this many vertices build their children in parallel
+		 */
+		const static unsigned int PARALLEL_VERTICES = 4096;
+
 		/**
 		 * Tree fuzziness
 		 */
@@ -74,7 +81,7 @@ class KDTreeNode : public QObject {
 		 * @see load
 		 * @author François-Xavier Thomas
 		 */
-		KDTreeNode() : split(0),kleft(NULL),kright(NULL) { /*cout << "Creating KD-Tree " << this << endl;*/ }
+		KDTreeNode() : split(0),mesh(NULL) { /*cout << "Creating KD-Tree " << this << endl;*/ }
 
 		/**
 		 * KDTreeNode Class Constructor. You first have to load the KD-Tree with a mesh to use it.
@@ -82,29 +89,27 @@ class KDTreeNode : public QObject {
 		 * @see load
 		 * @author François-Xavier Thomas
 		 */
-		KDTreeNode(float fuzz) : fuzziness(fuzz),split(0),kleft(NULL),kright(NULL) { /*cout << "Creating KD-Tree " << this << endl;*/ }
+		KDTreeNode(float fuzz) : fuzziness(fuzz),split(0),mesh(NULL) { /*cout << "Creating KD-Tree " << this << endl;*/ }
 
 		/**
 		 * KDTreeNode Class Constructor, with direct mesh loading.
 		 * 
 		 * @author François-Xavier Thomas
 		 */
-		KDTreeNode(const Mesh & m) : fuzziness(0.005f),mesh(&m),kleft(NULL),kright(NULL) { cout << "     Creating KD-Tree " << this << endl; load (); }
+		KDTreeNode(const Mesh & m) : fuzziness(0.005f),mesh(&m) { cout << "     Creating KD-Tree " << this << endl; load (); }
 
 		/**
 		 * KDTreeNode Class Constructor, with direct mesh loading and fuzziness.
 		 * 
 		 * @author François-Xavier Thomas
 		 */
-		KDTreeNode(const Mesh & m, float fuzz) : fuzziness(fuzz),mesh(&m),kleft(NULL),kright(NULL) { cout << "     Creating KD-Tree " << this << endl; load (); }
+		KDTreeNode(const Mesh & m, float fuzz) : fuzziness(fuzz),mesh(&m) { cout << "     Creating KD-Tree " << this << endl; load (); }
 
 		/**
-		 * Class destructor
+		 * Class destructor. Children are owned by their parent.
 		 */
 		~KDTreeNode () {
 			//cout << "     Destroying KD-Tree " << this << endl;
-			if (kleft != NULL) { delete kleft; kleft = NULL; }
-			if (kright != NULL) { delete kright; kright = NULL; }
 		}
 
 		/**
@@ -119,8 +124,8 @@ class KDTreeNode : public QObject {
 			data.clear();
 			triangles.clear();
 			split = 0;
-			if (kleft != NULL) { delete kleft; kleft = NULL; }
-			if (kright != NULL) { delete kright; kright = NULL; }
+			kleft.reset();
+			kright.reset();
 		}
 
 		/**
@@ -134,30 +139,37 @@ class KDTreeNode : public QObject {
 		/**
 		 * Setters and getters
 		 */
-		inline const KDTreeNode* getLeft () const { return kleft; }
-		inline const KDTreeNode* getRight () const { return kright; }
+		inline const KDTreeNode* getLeft () const { return kleft.get(); }
+		inline const KDTreeNode* getRight () const { return kright.get(); }
 		inline const vector<unsigned int> & getVertices () const { return data; }
 		inline float getSplit() const { return split; }
 		inline const Mesh * getMesh () const { return mesh; }
 		inline const BoundingBox & getBoundingBox () const { return bbox; }
 		inline const vector<unsigned int> & getTriangles () const { return triangles; }
 
-		inline KDTreeNode & operator= (const KDTreeNode & kd) {
-			clear();
-			mesh = kd.mesh;
-			bbox = bbox;
-			return *this;
-		}
-
 		void show () const {
-			if (kleft == NULL && kright == NULL) {
+			if (!kleft && !kright) {
 				for (vector<unsigned int>::const_iterator it = triangles.begin(); it != triangles.end(); it++) cout << "Tri: " << *it << endl;
 			}
-			cout << "-- " << this << endl << "left: " << kleft << ", right: " << kright << endl;
-			if (kleft != NULL) kleft->show();
-			if (kright != NULL) kright->show();
+			cout << "-- " << this << endl << "left: " << kleft.get() << ", right: " << kright.get() << endl;
+			if (kleft) kleft->show();
+			if (kright) kright->show();
 		}
 
+		/**
+		 * Renumber the triangles and vertices referenced by the tree, after the mesh has been reordered.
+		 * The maps give the new index of each old triangle and vertex.
+		 *
+		 * @see Mesh::reorderMorton
+		 */
+		void remap (const vector<unsigned int> & triangleMap, const vector<unsigned int> & vertexMap);
+
+		/**
+		 * Number of misses of a direct-mapped cache of numLines 64-byte lines, when fetching
+		 * the triangles and vertex positions of each leaf in depth-first order
+		 */
+		unsigned int simulateCacheMisses (unsigned int numLines) const;
+
 		/**
 		 * Find vertices
 		 */
@@ -166,7 +178,7 @@ class KDTreeNode : public QObject {
 		public slots:
 			void setFuzziness (float f) {
 				fuzziness = f;
-				if (kleft != NULL) kleft->setFuzziness(f);
-				if (kright != NULL) kright->setFuzziness(f);
+				if (kleft) kleft->setFuzziness(f);
+				if (kright) kright->setFuzziness(f);
 			}
 };
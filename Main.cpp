@@ -10,6 +10,9 @@
 
 #include "QTUtils.h"
 #include "KDTreeNode.hpp"
+#include "Scene.h"
+#include "TextureCache.hpp"
+#include "TaskPool.hpp"
 
 using namespace std;
 
@@ -29,6 +32,10 @@ int main (int argc, char **argv)
 	// Load application
   QApplication raymini (argc, argv);
 
+	// Optional scene file, after Qt removed its own arguments
+	if (argc > 1)
+		Scene::setSceneFile (argv[1]);
+
 	// Load other stuff
   setBoubekQTStyle (raymini);
   QApplication::setStyle (new QPlastiqueStyle);
@@ -40,6 +47,13 @@ int main (int argc, char **argv)
   
 	// Run app
 	cout << endl << " --- Starting Main GUI" << endl << endl;
-  return raymini.exec ();
+  int status = raymini.exec ();
+
+	// Removes the tiled texture files
+	TextureCache::destroyInstance ();
+
+	// Stops the worker threads
+	TaskPool::destroyInstance ();
+  return status;
 }
 
@@ -0,0 +1,234 @@
+/**
+ * Headless renderer C++ Source code (MainCli.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include <QCoreApplication>
+#include <QImage>
+#include <QRect>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <string>
+#include <iostream>
+
+#include "Scene.h"
+#include "RayTracer.h"
+#include "Camera.hpp"
+#include "TextureCache.hpp"
+#include "TaskPool.hpp"
+
+using namespace std;
+
+static void usage (const char * program) {
+	cerr << "Usage: " << program << " [options] <scene file> <output image>" << endl
+		<< endl
+		<< "Renders a scene without any window, and writes the image in the format" << endl
+		<< "given by the extension of its name (png, jpg, ppm, bmp...). pfm and exr" << endl
+		<< "files keep the unclamped floating-point colours." << endl
+		<< endl
+		<< "  --size <width>x<height>   Image size (default 640x480)" << endl
+		<< "  --eye <x>,<y>,<z>         Camera position" << endl
+		<< "  --target <x>,<y>,<z>      Point the camera looks at" << endl
+		<< "  --fov <degrees>           Vertical field of view (default 45)" << endl
+		<< "  --depth <n>               Maximum ray depth" << endl
+		<< "  --aa                      Adaptive anti-aliasing, 4 to 16 rays per pixel" << endl
+		<< "  --roulette                Trace the faintest reflections and refractions at" << endl
+		<< "                            random instead of dropping them" << endl
+		<< "  --samples <n>             Progressive refinement up to n rays per pixel" << endl
+		<< "  --sample-map <file>       Also write the number of rays of each pixel, in grey" << endl
+		<< "  --light-aovs <prefix>     Also write the image lit by each light alone in" << endl
+		<< "                            white, as <prefix><light number>.pfm (not with" << endl
+		<< "                            --crop)" << endl
+		<< "  --crop <x>,<y>,<w>x<h>    Render and write only this rectangle of the image," << endl
+		<< "                            from its top left corner" << endl
+		<< endl
+		<< "Without --eye and --target, the camera of the scene file is used, or" << endl
+		<< "else the whole scene is framed from +z." << endl;
+}
+
+static bool parseVector (const char * text, Vec3Df & v) {
+	return sscanf (text, "%f,%f,%f", &v[0], &v[1], &v[2]) == 3;
+}
+
+// The whole text must be the number, strictly between min and max
+static bool parseFloat (const char * text, float min, float max, float & value) {
+	char * end;
+	errno = 0;
+	double d = strtod (text, &end);
+	if (end == text || *end != '\0' || errno == ERANGE || !(d > min && d < max)) return false;
+	value = d;
+	return true;
+}
+
+// The whole text must be the number, from min to max
+static bool parseInt (const char * text, int min, int max, int & value) {
+	char * end;
+	errno = 0;
+	long l = strtol (text, &end, 10);
+	if (end == text || *end != '\0' || errno == ERANGE || l < min || l > max) return false;
+	value = l;
+	return true;
+}
+
+int main (int argc, char **argv)
+{
+	cout << "Renderboy (headless)" << endl << endl;
+	QCoreApplication app (argc, argv);
+
+	int width = 640, height = 480, depth = -1, samples = 0;
+	float fieldOfView = 45.f;
+	bool eyeGiven = false, targetGiven = false, fovGiven = false, antiAliasing = false, roulette = false;
+	Vec3Df eye, target;
+	string sampleMap, aovPrefix;
+	QRect crop;
+	vector<string> files;
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = (i + 1 < argc);
+		if (!strcmp (argv[i], "--size") && hasValue) {
+			if (sscanf (argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) { usage (argv[0]); return 1; }
+		} else if (!strcmp (argv[i], "--eye") && hasValue) {
+			if (!parseVector (argv[++i], eye)) { usage (argv[0]); return 1; }
+			eyeGiven = true;
+		} else if (!strcmp (argv[i], "--target") && hasValue) {
+			if (!parseVector (argv[++i], target)) { usage (argv[0]); return 1; }
+			targetGiven = true;
+		} else if (!strcmp (argv[i], "--fov") && hasValue) {
+			if (!parseFloat (argv[++i], 0.f, 180.f, fieldOfView)) { usage (argv[0]); return 1; }
+			fovGiven = true;
+		} else if (!strcmp (argv[i], "--depth") && hasValue) {
+			if (!parseInt (argv[++i], 0, INT_MAX, depth)) { usage (argv[0]); return 1; }
+		} else if (!strcmp (argv[i], "--samples") && hasValue) {
+			if (!parseInt (argv[++i], 1, INT_MAX, samples)) { usage (argv[0]); return 1; }
+		} else if (!strcmp (argv[i], "--crop") && hasValue) {
+			int x, y, w, h;
+			if (sscanf (argv[++i], "%d,%d,%dx%d", &x, &y, &w, &h) != 4 || x < 0 || y < 0 || w <= 0 || h <= 0) { usage (argv[0]); return 1; }
+			crop = QRect (x, y, w, h);
+		} else if (!strcmp (argv[i], "--sample-map") && hasValue) {
+			sampleMap = argv[++i];
+		} else if (!strcmp (argv[i], "--light-aovs") && hasValue) {
+			aovPrefix = argv[++i];
+		} else if (!strcmp (argv[i], "--aa")) {
+			antiAliasing = true;
+		} else if (!strcmp (argv[i], "--roulette")) {
+			roulette = true;
+		} else if (argv[i][0] == '-') {
+			usage (argv[0]);
+			return 1;
+		} else
+			files.push_back (argv[i]);
+	}
+	if (files.size() != 2 || eyeGiven != targetGiven) {
+		usage (argv[0]);
+		return 1;
+	}
+	if (!crop.isNull ()) {
+		crop = crop.intersected (QRect (0, 0, width, height));
+		if (crop.isEmpty ()) {
+			cerr << "[renderboy-cli] The crop rectangle is outside of the image" << endl;
+			return 1;
+		}
+	}
+
+	// Load scene, failing rather than rendering the default one
+	Scene::setSceneFile (files[0]);
+	Scene::setDefaultSceneFallback (false);
+	Scene * scene;
+	try {
+		scene = Scene::getInstance ();
+	} catch (const SceneFile::Exception & e) {
+		cerr << e.getMessage () << endl;
+		TaskPool::destroyInstance ();
+		return 1;
+	}
+
+	// Camera from the command line, the scene file, or framing the scene
+	const SceneFile::CameraDecl & hint = scene->getCameraHint ();
+	if (!eyeGiven && hint.defined) {
+		eye = hint.position;
+		target = hint.target;
+		if (hint.fieldOfView > 0.f && !fovGiven) fieldOfView = hint.fieldOfView;
+	} else if (!eyeGiven) {
+		const BoundingBox & bbox = scene->getBoundingBox ();
+		float fov = fieldOfView * M_PI / 180.f;
+		if (width < height) fov = 2.f * atan (tan (fov/2.f) * width / height);
+		target = bbox.getCenter ();
+		eye = target + Vec3Df (0.f, 0.f, bbox.getRadius () / sin (fov/2.f));
+	}
+	Camera cam = Camera::lookAt (eye, target, fieldOfView * M_PI / 180.f, width, height);
+
+	// Render in this thread: no event loop is needed
+	RayTracer * rayTracer = RayTracer::getInstance ();
+	rayTracer->setCamera (cam);
+	rayTracer->setAntiAliasing (antiAliasing);
+	rayTracer->setRussianRoulette (roulette);
+	if (samples > 0) {
+		rayTracer->setProgressive (true);
+		rayTracer->setSamples (samples);
+	}
+	if (depth >= 0) rayTracer->setDepth (depth);
+	rayTracer->setLightAOVs (!aovPrefix.empty ());
+	rayTracer->setRegion (crop);
+	QImage image = rayTracer->render ();
+	FrameBuffer frameBuffer = rayTracer->getFrameBuffer ();
+	if (!crop.isNull ()) {
+		image = image.copy (crop);
+		frameBuffer = frameBuffer.copy (crop.x (), crop.y (), crop.width (), crop.height ());
+	}
+
+	// The image is still written, with the triangles of unreadable chunks missing
+	int status = 0;
+	if (scene->getGeometryCache ().getNumFailures () > 0) {
+		cerr << "[renderboy-cli] " << scene->getGeometryCache ().getNumFailures () << " geometry chunks could not be read" << endl;
+		status = 1;
+	}
+	if (FrameBuffer::isFloatFormat (files[1])) {
+		// High dynamic range, straight from the frame buffer
+		try {
+			frameBuffer.save (files[1]);
+			cout << " (I) Wrote " << files[1] << endl;
+		} catch (const FrameBuffer::Exception & e) {
+			cerr << e.getMessage () << endl;
+			status = 1;
+		}
+	} else if (!image.save (QString (files[1].c_str()))) {
+		cerr << "[renderboy-cli] Failed writing " << files[1] << endl;
+		status = 1;
+	} else
+		cout << " (I) Wrote " << files[1] << endl;
+
+	if (!sampleMap.empty ()) {
+		if (!frameBuffer.toWeightImage ().save (QString (sampleMap.c_str()))) {
+			cerr << "[renderboy-cli] Failed writing " << sampleMap << endl;
+			status = 1;
+		} else
+			cout << " (I) Wrote " << sampleMap << endl;
+	}
+
+	// They are kept with the primary hits, of whole images only
+	if (!aovPrefix.empty () && rayTracer->getNumLightAOVs () == 0 && !scene->getLights().empty ()) {
+		cerr << "[renderboy-cli] Light AOVs need the whole image, and at most " << GBuffer::MAX_SAMPLES << " rays per pixel" << endl;
+		status = 1;
+	}
+	for (unsigned int l = 0; l < rayTracer->getNumLightAOVs (); l++) {
+		char filename[32];
+		snprintf (filename, sizeof (filename), "%u.pfm", l);
+		try {
+			rayTracer->getLightAOV (l).savePFM (aovPrefix + filename);
+			cout << " (I) Wrote " << aovPrefix + filename << endl;
+		} catch (const FrameBuffer::Exception & e) {
+			cerr << e.getMessage () << endl;
+			status = 1;
+		}
+	}
+
+	TextureCache::destroyInstance ();
+
+	// Stops the worker threads
+	TaskPool::destroyInstance ();
+	return status;
+}
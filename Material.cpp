@@ -6,3 +6,19 @@
 // *********************************************************
 
 #include "Material.h"
+#include "TextureCache.hpp"
+
+#include <cmath>
+
+Vec3Df Material::getColor (const Vec3Df & point, const Vec3Df & normal, float footprint) const {
+    if (texture == NO_TEXTURE)
+        return color;
+    unsigned int axis = 0;
+    for (unsigned int i = 1; i < 3; i++)
+        if (fabs (normal[i]) > fabs (normal[axis]))
+            axis = i;
+    float u = point[(axis + 1) % 3] / textureSize;
+    float v = point[(axis + 2) % 3] / textureSize;
+    Vec3Df t = TextureCache::getInstance ()->sample (texture, u, v, footprint / textureSize);
+    return Vec3Df (color[0] * t[0], color[1] * t[1], color[2] * t[2]);
+}
@@ -17,9 +17,9 @@
 
 class Material {
 public:
-    inline Material () : diffuse (0.8f), specular (0.2f), shine (1.0f), color (0.5f, 0.5f, 0.5f), ior(1.0f), refract(0.0f), reflect(0.0f) {}
+    inline Material () : diffuse (0.8f), specular (0.2f), shine (1.0f), color (0.5f, 0.5f, 0.5f), ior(1.0f), refract(0.0f), reflect(0.0f), texture (NO_TEXTURE), textureSize (1.0f) {}
     inline Material (float diffuse, float specular, float shine, const Vec3Df & color, const float ior, const float refract, const float reflect)
-        : diffuse (diffuse), specular (specular), shine (shine), color (color), ior (ior), refract (refract), reflect (reflect) {}
+        : diffuse (diffuse), specular (specular), shine (shine), color (color), ior (ior), refract (refract), reflect (reflect), texture (NO_TEXTURE), textureSize (1.0f) {}
     virtual ~Material () {}
 
     inline float getDiffuse () const { return diffuse; }
@@ -29,6 +29,14 @@ public:
 		inline float getIOR () const { return ior; }
 		inline float getRefract () const { return refract; }
 		inline float getReflect () const { return reflect; }
+		inline bool hasTexture () const { return texture != NO_TEXTURE; }
+		inline unsigned int getTexture () const { return texture; }
+		inline float getTextureSize () const { return textureSize; }
+
+    // Colour at a surface point, modulated by the texture if any. The texture
+    // is projected along the dominant axis of the normal, one repeat every
+    // textureSize world units; footprint is the size of the shaded area.
+    Vec3Df getColor (const Vec3Df & point, const Vec3Df & normal, float footprint) const;
 
     inline void setDiffuse (float d) { diffuse = d; }
 		inline void setShininess (float sh) { shine = sh; }
@@ -37,6 +45,10 @@ public:
 		inline void setIOR (const float f) { ior = f; }
 		inline void setRefract (const float r) { refract = r; }
 		inline void setReflect (const float r) { reflect = r; }
+		inline void setTexture (unsigned int t, float size) { texture = t; textureSize = size; }
+
+    // Same value as TextureCache::NO_TEXTURE
+    static const unsigned int NO_TEXTURE = (unsigned int)-1;
 
 private:
     float diffuse;
@@ -46,6 +58,8 @@ private:
 		float ior;
 		float refract;
 		float reflect;
+		unsigned int texture;
+		float textureSize;
 };
 
 inline std::ostream & operator<< (std::ostream & out, const Material & m) {
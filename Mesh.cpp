@@ -6,25 +6,56 @@
 // ---------------------------------------------------------
 
 #include "Mesh.h"
+#include "MeshAdjacency.hpp"
+#include "TaskPool.hpp"
 #include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cmath>
+#ifndef RENDERBOY_HEADLESS
 #include <GL/glut.h>
+#endif
 
 using namespace std;
 
+Mesh & Mesh::operator= (Mesh && mesh) {
+    if (this == &mesh)
+        return *this;
+    vertices = std::move (mesh.vertices);
+    triangles = std::move (mesh.triangles);
+    geometryVersion = mesh.geometryVersion;
+    normalsVersion = mesh.normalsVersion;
+    normalsWeight = mesh.normalsWeight;
+    compressed = mesh.compressed;
+    positions = std::move (mesh.positions);
+    packedPositions = std::move (mesh.packedPositions);
+    packedNormals = std::move (mesh.packedNormals);
+    quantOrigin = mesh.quantOrigin;
+    quantStep = mesh.quantStep;
+    packedIndices = std::move (mesh.packedIndices);
+    mesh.clear ();
+    return *this;
+}
+
 void Mesh::clear () {
     clearTopology ();
     clearGeometry ();
 }
 
 void Mesh::clearGeometry () {
+    geometryVersion++;
     vertices.clear ();
+    compressed = false;
+    positions.clear ();
+    packedPositions.clear ();
+    packedNormals.clear ();
 }
 
 void Mesh::clearTopology () {
+    geometryVersion++;
     triangles.clear ();
+    packedIndices.clear ();
 }
 
 void Mesh::unmarkAllVertices () {
@@ -33,30 +64,45 @@ void Mesh::unmarkAllVertices () {
 }
 
 void Mesh::computeTriangleNormals (vector<Vec3Df> & triangleNormals) {
-    for (vector<Triangle>::const_iterator it = triangles.begin ();
-         it != triangles.end ();
-         it++) {
-        Vec3Df e01 (vertices[it->getVertex (1)].getPos () - vertices[it->getVertex (0)].getPos ());
-        Vec3Df e02 (vertices[it->getVertex (2)].getPos () - vertices[it->getVertex (0)].getPos ());
+    unsigned int base = triangleNormals.size ();
+    unsigned int numTriangles = getNumTriangles ();
+    triangleNormals.resize (base + numTriangles);
+    TaskPool::getInstance ()->parallelFor (0, numTriangles, [&] (unsigned int t) {
+        Triangle tri = getTriangle (t);
+        Vec3Df e01 (getVertexPos (tri.getVertex (1)) - getVertexPos (tri.getVertex (0)));
+        Vec3Df e02 (getVertexPos (tri.getVertex (2)) - getVertexPos (tri.getVertex (0)));
         Vec3Df n (Vec3Df::crossProduct (e01, e02));
         n.normalize ();
-        triangleNormals.push_back (n);
-    }
+        triangleNormals[base + t] = n;
+    });
+}
+
+bool Mesh::updateSmoothVertexNormals (unsigned int normWeight) {
+    if (normalsVersion == geometryVersion && normalsWeight == (int) normWeight)
+        return false;
+    recomputeSmoothVertexNormals (normWeight);
+    return true;
 }
 
 void Mesh::recomputeSmoothVertexNormals (unsigned int normWeight) {
     vector<Vec3Df> triangleNormals;
     computeTriangleNormals (triangleNormals);
-    for (std::vector<Vertex>::iterator it = vertices.begin (); it != vertices.end (); it++)
-        it->setNormal (Vec3Df (0.0, 0.0, 0.0));
-    vector<Vec3Df>::const_iterator itNormal = triangleNormals.begin ();
-    vector<Triangle>::const_iterator it = triangles.begin ();
-    for ( ; it != triangles.end (); it++, itNormal++) 
-        for (unsigned int  j = 0; j < 3; j++) {
-            Vertex & vj = vertices[it->getVertex (j)];
+    MeshAdjacency adjacency (*this);
+    const vector<unsigned int> & offsets = adjacency.getCornerOffsets ();
+    const vector<unsigned int> & corners = adjacency.getCorners ();
+
+    // Each vertex gathers the weighted normals of its incident triangles
+    unsigned int numVertices = getNumVertices ();
+    vector<Vec3Df> normals (numVertices);
+    TaskPool::getInstance ()->parallelFor (0, numVertices, [&] (unsigned int i) {
+        Vec3Df ni (0.0, 0.0, 0.0);
+        Vec3Df pi = getVertexPos (i);
+        for (unsigned int k = offsets[i]; k < offsets[i+1]; k++) {
+            Triangle tri = getTriangle (corners[k] / 3);
+            unsigned int j = corners[k] % 3;
             float w = 1.0; // uniform weights
-            Vec3Df e0 = vertices[it->getVertex ((j+1)%3)].getPos () - vj.getPos ();
-            Vec3Df e1 = vertices[it->getVertex ((j+2)%3)].getPos () - vj.getPos ();
+            Vec3Df e0 = getVertexPos (tri.getVertex ((j+1)%3)) - pi;
+            Vec3Df e1 = getVertexPos (tri.getVertex ((j+2)%3)) - pi;
             if (normWeight == 1) { // area weight
                 w = Vec3Df::crossProduct (e0, e1).getLength () / 2.0;
             } else if (normWeight == 2) { // angle weight
@@ -66,30 +112,284 @@ void Mesh::recomputeSmoothVertexNormals (unsigned int normWeight) {
             } 
             if (w <= 0.0)
                 continue;
-            vj.setNormal (vj.getNormal () + (*itNormal) * w);
+            ni += triangleNormals[corners[k] / 3] * w;
         }
-    Vertex::normalizeNormals (vertices);
+        normals[i] = ni;
+    });
+    setVertexNormals (normals);
+    normalsVersion = geometryVersion;
+    normalsWeight = normWeight;
 }
 
-void Mesh::collectOneRing (vector<vector<unsigned int> > & oneRing) const {
-    oneRing.resize (vertices.size ());
-    for (unsigned int i = 0; i < triangles.size (); i++) {
-        const Triangle & ti = triangles[i];
+void Mesh::setVertexNormals (const vector<Vec3Df> & normals) {
+    TaskPool::getInstance ()->parallelFor (0, normals.size (), [&] (unsigned int i) {
+        Vec3Df n = normals[i];
+        if (n != Vec3Df (0.0, 0.0, 0.0))
+            n.normalize ();
+        if (compressed)
+            packedNormals[i] = PackedVertex::encodeNormal (n);
+        else
+            vertices[i].setNormal (n);
+    });
+}
+
+void Mesh::compress (bool quantizePositions) {
+    if (compressed)
+        decompress ();
+    unsigned int n = vertices.size ();
+    packedNormals.resize (n);
+    for (unsigned int i = 0; i < n; i++)
+        packedNormals[i] = PackedVertex::encodeNormal (vertices[i].getNormal ());
+    if (quantizePositions && n > 0) {
+        Vec3Df min = vertices[0].getPos (), max = min;
+        for (unsigned int i = 1; i < n; i++)
+            for (unsigned int j = 0; j < 3; j++) {
+                min[j] = std::min (min[j], vertices[i].getPos ()[j]);
+                max[j] = std::max (max[j], vertices[i].getPos ()[j]);
+            }
+        quantOrigin = min;
+        quantStep = (max - min) / float (PackedVertex::QMAX);
+        packedPositions.resize (3*n);
+        for (unsigned int i = 0; i < n; i++)
+            PackedVertex::quantizePosition (vertices[i].getPos (), quantOrigin, quantStep, &packedPositions[3*i]);
+        geometryVersion++;
+    } else {
+        positions.resize (n);
+        for (unsigned int i = 0; i < n; i++)
+            positions[i] = vertices[i].getPos ();
+    }
+    vector<Vertex> ().swap (vertices);
+    compressed = true;
+}
+
+void Mesh::decompress () {
+    if (!compressed)
+        return;
+    unsigned int n = getNumVertices ();
+    vertices.resize (n);
+    for (unsigned int i = 0; i < n; i++)
+        vertices[i] = Vertex (getVertexPos (i), getVertexNormal (i));
+    compressed = false;
+    vector<Vec3Df> ().swap (positions);
+    vector<unsigned short> ().swap (packedPositions);
+    vector<unsigned int> ().swap (packedNormals);
+}
+
+bool Mesh::packIndices () {
+    if (hasPackedIndices ())
+        return true;
+    if (triangles.empty () || getNumVertices () > 65536)
+        return false;
+    packedIndices.resize (3*triangles.size ());
+    for (unsigned int t = 0; t < triangles.size (); t++)
+        for (unsigned int j = 0; j < 3; j++)
+            packedIndices[3*t+j] = (unsigned short) triangles[t].getVertex (j);
+    vector<Triangle> ().swap (triangles);
+    return true;
+}
+
+void Mesh::unpackIndices () {
+    if (!hasPackedIndices ())
+        return;
+    unsigned int n = getNumTriangles ();
+    triangles.resize (n);
+    for (unsigned int t = 0; t < n; t++)
+        triangles[t] = getTriangle (t);
+    vector<unsigned short> ().swap (packedIndices);
+}
+
+size_t Mesh::getMemoryFootprint () const {
+    return vertices.size () * sizeof (Vertex)
+        + positions.size () * sizeof (Vec3Df)
+        + packedPositions.size () * sizeof (unsigned short)
+        + packedNormals.size () * sizeof (unsigned int)
+        + triangles.size () * sizeof (Triangle)
+        + packedIndices.size () * sizeof (unsigned short);
+}
+
+typedef unsigned long long CellKey;
+
+// Hash of the integer coordinates of a welding cell
+static inline CellKey cellKey (int x, int y, int z) {
+    return ((CellKey) (unsigned int) x * 73856093ULL) ^ ((CellKey) (unsigned int) y * 19349663ULL << 21) ^ ((CellKey) (unsigned int) z * 83492791ULL << 42);
+}
+
+unsigned int Mesh::weld (float tolerance) {
+    decompress ();
+    unpackIndices ();
+    unsigned int numVertices = vertices.size ();
+    if (numVertices == 0 || tolerance <= 0.f)
+        return 0;
+
+    // Sort vertices by the hash of their cell
+    vector<int> cells (3*numVertices);
+    vector<pair<CellKey, unsigned int> > keys (numVertices);
+    TaskPool::getInstance ()->parallelFor (0, numVertices, [&] (unsigned int i) {
+        const Vec3Df & p = vertices[i].getPos ();
+        for (unsigned int j = 0; j < 3; j++)
+            cells[3*i+j] = (int) floor (p[j] / tolerance);
+        keys[i] = make_pair (cellKey (cells[3*i], cells[3*i+1], cells[3*i+2]), i);
+    });
+    TaskPool::getInstance ()->parallelSort (keys.begin (), keys.end ());
+
+    // Map each vertex to the first kept vertex within tolerance in the 27
+    // neighbouring cells, or keep it. Keys are sorted by index within a cell,
+    // so only vertices before the current one are looked at.
+    vector<unsigned int> remap (numVertices);
+    vector<bool> kept (numVertices, false);
+    vector<Vertex> welded;
+    float sqTolerance = tolerance * tolerance;
+    for (unsigned int i = 0; i < numVertices; i++) {
+        const Vec3Df & p = vertices[i].getPos ();
+        unsigned int target = numVertices;
+        for (int d = 0; d < 27 && target == numVertices; d++) {
+            CellKey key = cellKey (cells[3*i] + d%3 - 1, cells[3*i+1] + (d/3)%3 - 1, cells[3*i+2] + d/9 - 1);
+            vector<pair<CellKey, unsigned int> >::const_iterator it = lower_bound (keys.begin (), keys.end (), make_pair (key, 0u));
+            for (; it != keys.end () && it->first == key && it->second < i; it++)
+                if (kept[it->second] && Vec3Df::squaredDistance (p, vertices[it->second].getPos ()) <= sqTolerance) {
+                    target = remap[it->second];
+                    break;
+                }
+        }
+        if (target == numVertices) {
+            kept[i] = true;
+            remap[i] = welded.size ();
+            welded.push_back (vertices[i]);
+        } else
+            remap[i] = target;
+    }
+
+    // Renumber triangles, dropping the ones that collapsed
+    vector<Triangle> remaining;
+    remaining.reserve (triangles.size ());
+    for (unsigned int t = 0; t < triangles.size (); t++) {
+        Triangle tri (remap[triangles[t].getVertex (0)], remap[triangles[t].getVertex (1)], remap[triangles[t].getVertex (2)]);
+        if (tri.getVertex (0) != tri.getVertex (1) && tri.getVertex (1) != tri.getVertex (2) && tri.getVertex (2) != tri.getVertex (0))
+            remaining.push_back (tri);
+    }
+    unsigned int removed = numVertices - welded.size ();
+    vertices.swap (welded);
+    triangles.swap (remaining);
+    geometryVersion++;
+    return removed;
+}
+
+// Spread the 10 lower bits of x so that there are two zero bits between each
+static inline unsigned int expandMortonBits (unsigned int x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x <<  8)) & 0x0300f00f;
+    x = (x | (x <<  4)) & 0x030c30c3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+void Mesh::reorderMorton () {
+    vector<unsigned int> triangleMap, vertexMap;
+    reorderMorton (triangleMap, vertexMap);
+}
+
+void Mesh::reorderMorton (vector<unsigned int> & triangleMap, vector<unsigned int> & vertexMap) {
+    bool packed = hasPackedIndices ();
+    unpackIndices ();
+    unsigned int numVertices = getNumVertices ();
+    triangleMap.resize (triangles.size ());
+    vertexMap.assign (numVertices, numVertices);
+    if (triangles.empty ()) {
+        for (unsigned int i = 0; i < numVertices; i++)
+            vertexMap[i] = i;
+        return;
+    }
+
+    // Morton code of each triangle centroid, quantized to 10 bits per axis
+    Vec3Df min = getVertexPos (0), max = min;
+    for (unsigned int i = 1; i < numVertices; i++) {
+        Vec3Df p = getVertexPos (i);
         for (unsigned int j = 0; j < 3; j++) {
-            unsigned int vj = ti.getVertex (j);
-            for (unsigned int k = 1; k < 3; k++) {
-                unsigned int vk = ti.getVertex ((j+k)%3);
-                if (find (oneRing[vj].begin (), oneRing[vj].end (), vk) == oneRing[vj].end ())
-                    oneRing[vj].push_back (vk);
+            min[j] = std::min (min[j], p[j]);
+            max[j] = std::max (max[j], p[j]);
+        }
+    }
+    Vec3Df scale;
+    for (unsigned int j = 0; j < 3; j++)
+        scale[j] = (max[j] > min[j]) ? 1023.f / (max[j] - min[j]) : 0.f;
+    vector<pair<unsigned int, unsigned int> > codes (triangles.size ());
+    for (unsigned int t = 0; t < triangles.size (); t++) {
+        const Triangle & tri = triangles[t];
+        Vec3Df c = (getVertexPos (tri.getVertex (0)) + getVertexPos (tri.getVertex (1)) + getVertexPos (tri.getVertex (2))) / 3.f;
+        unsigned int code = 0;
+        for (unsigned int j = 0; j < 3; j++)
+            code |= expandMortonBits ((unsigned int) ((c[j] - min[j]) * scale[j])) << j;
+        codes[t] = make_pair (code, t);
+    }
+    TaskPool::getInstance ()->parallelSort (codes.begin (), codes.end ());
+
+    // Reorder triangles, and number vertices as they are first used
+    vector<Triangle> sorted (triangles.size ());
+    vector<unsigned int> order;
+    order.reserve (numVertices);
+    for (unsigned int t = 0; t < codes.size (); t++) {
+        const Triangle & tri = triangles[codes[t].second];
+        triangleMap[codes[t].second] = t;
+        for (unsigned int j = 0; j < 3; j++) {
+            unsigned int v = tri.getVertex (j);
+            if (vertexMap[v] == numVertices) {
+                vertexMap[v] = order.size ();
+                order.push_back (v);
             }
+            sorted[t].setVertex (j, vertexMap[v]);
         }
     }
+    // Unreferenced vertices go last
+    for (unsigned int v = 0; v < numVertices; v++)
+        if (vertexMap[v] == numVertices) {
+            vertexMap[v] = order.size ();
+            order.push_back (v);
+        }
+    triangles.swap (sorted);
+    geometryVersion++;
+
+    // Permute vertex attributes
+    if (!compressed) {
+        vector<Vertex> permuted (numVertices);
+        for (unsigned int i = 0; i < numVertices; i++)
+            permuted[i] = vertices[order[i]];
+        vertices.swap (permuted);
+    } else {
+        vector<unsigned int> permutedNormals (numVertices);
+        for (unsigned int i = 0; i < numVertices; i++)
+            permutedNormals[i] = packedNormals[order[i]];
+        packedNormals.swap (permutedNormals);
+        if (!packedPositions.empty ()) {
+            vector<unsigned short> permuted (3*numVertices);
+            for (unsigned int i = 0; i < numVertices; i++)
+                for (unsigned int j = 0; j < 3; j++)
+                    permuted[3*i+j] = packedPositions[3*order[i]+j];
+            packedPositions.swap (permuted);
+        } else {
+            vector<Vec3Df> permuted (numVertices);
+            for (unsigned int i = 0; i < numVertices; i++)
+                permuted[i] = positions[order[i]];
+            positions.swap (permuted);
+        }
+    }
+    if (packed)
+        packIndices ();
+}
+
+void Mesh::collectOneRing (vector<vector<unsigned int> > & oneRing) const {
+    MeshAdjacency adjacency (*this);
+    const vector<unsigned int> & offsets = adjacency.getNeighbourOffsets ();
+    const vector<unsigned int> & neighbours = adjacency.getNeighbours ();
+    oneRing.resize (getNumVertices ());
+    for (unsigned int i = 0; i < oneRing.size (); i++)
+        oneRing[i].assign (neighbours.begin () + offsets[i], neighbours.begin () + offsets[i+1]);
 }
 
 void Mesh::collectOrderedOneRing (vector<vector<unsigned int> > & oneRing) const {
-    oneRing.resize (vertices.size ());
-    for (unsigned int t = 0; t < triangles.size (); t++) {
-        const Triangle & ti = triangles[t];
+    oneRing.resize (getNumVertices ());
+    for (unsigned int t = 0; t < getNumTriangles (); t++) {
+        Triangle ti = getTriangle (t);
         for (unsigned int i = 0; i < 3; i++) {
             unsigned int vi = ti.getVertex (i);
             unsigned int vj = ti.getVertex ((i+1)%3);
@@ -114,33 +414,7 @@ void Mesh::collectOrderedOneRing (vector<vector<unsigned int> > & oneRing) const
     }
 }
 
-void Mesh::computeDualEdgeMap (EdgeMapIndex & dualVMap1, EdgeMapIndex & dualVMap2) {
-    for (vector<Triangle>::iterator it = triangles.begin ();
-         it != triangles.end (); it++) {
-        for (unsigned int i = 0; i < 3; i++) {
-            Edge eij (it->getVertex (i), it->getVertex ((i+1)%3)); 
-            if (dualVMap1.find (eij) == dualVMap1.end ())
-                dualVMap1[eij] = it->getVertex ((i+2)%3);
-            else
-                dualVMap2[eij] = it->getVertex ((i+2)%3);
-        }
-    } 
-}
-
-void Mesh::markBorderEdges (EdgeMapIndex & edgeMap) {
-    for (vector<Triangle>::iterator it = triangles.begin ();
-         it != triangles.end (); it++) {
-        for (unsigned int i = 0; i < 3; i++) {
-            unsigned int j = (i+1)%3;
-            Edge eij (it->getVertex (i), it->getVertex (j)); 
-            if (edgeMap.find (eij) == edgeMap.end ())
-                edgeMap[eij] = 0;
-            else 
-                edgeMap[eij] += 1;
-        }
-    } 
-}
-
+#ifndef RENDERBOY_HEADLESS
 inline void glVertexVec3Df (const Vec3Df & v) {
     glVertex3f (v[0], v[1], v[2]);
 }
@@ -160,11 +434,11 @@ inline void glDrawPoint (const Vertex & v) {
 
 void Mesh::renderGL (bool flat) const {
     glBegin (GL_TRIANGLES);
-    for (unsigned int i = 0; i < triangles.size (); i++) {
-        const Triangle & t = triangles[i];
+    for (unsigned int i = 0; i < getNumTriangles (); i++) {
+        Triangle t = getTriangle (i);
         Vertex v[3];
         for (unsigned int j = 0; j < 3; j++)
-            v[j] = vertices[t.getVertex(j)];
+            v[j] = compressed ? Vertex (getVertexPos (t.getVertex(j)), getVertexNormal (t.getVertex(j))) : vertices[t.getVertex(j)];
 
         if (flat) {
             Vec3Df normal = Vec3Df::crossProduct (v[1].getPos () - v[0].getPos (),
@@ -183,6 +457,7 @@ void Mesh::renderGL (bool flat) const {
     }
     glEnd ();
 }
+#endif
 
 void Mesh::loadOFF (const std::string & filename) {
     clear ();
@@ -211,9 +486,21 @@ void Mesh::loadOFF (const std::string & filename) {
             triangles.push_back (Triangle (index[0], index[j], index[j+1]));
     }
     input.close ();
+    geometryVersion++;
     recomputeSmoothVertexNormals (0);
 }
 
 void Mesh::translate (const Vec3Df & v) {
 	for (vector<Vertex>::iterator vr = vertices.begin(); vr != vertices.end(); vr++) vr->setPos (vr->getPos() + v);
+	for (vector<Vec3Df>::iterator vr = positions.begin(); vr != positions.end(); vr++) *vr += v;
+	quantOrigin += v;
+	geometryVersion++;
+}
+
+void Mesh::scale (float s) {
+	for (vector<Vertex>::iterator vr = vertices.begin(); vr != vertices.end(); vr++) vr->setPos (vr->getPos() * s);
+	for (vector<Vec3Df>::iterator vr = positions.begin(); vr != positions.end(); vr++) *vr *= s;
+	quantOrigin *= s;
+	quantStep *= s;
+	geometryVersion++;
 }
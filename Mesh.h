@@ -10,46 +10,201 @@
 
 #include <vector>
 #include <string>
+#include <utility>
+#include <cstddef>
+#include <cassert>
 
 #include "Vec3D.h"
 #include "Vertex.h"
 #include "Triangle.h"
-#include "Edge.h"
+#include "PackedVertex.hpp"
 
 class Mesh {
 public:
-    inline Mesh () {} 
-    inline Mesh (const std::vector<Vertex> & v) 
-        : vertices (v) {}
-    inline Mesh (const std::vector<Vertex> & v, 
-                 const std::vector<Triangle> & t) 
-        : vertices (v), triangles (t)  {}
+    inline Mesh () : geometryVersion (1), normalsVersion (0), normalsWeight (-1), compressed (false) {} 
+    inline Mesh (std::vector<Vertex> v) 
+        : vertices (std::move (v)), geometryVersion (1), normalsVersion (0), normalsWeight (-1), compressed (false) {}
+    inline Mesh (std::vector<Vertex> v, 
+                 std::vector<Triangle> t) 
+        : vertices (std::move (v)), triangles (std::move (t)), geometryVersion (1), normalsVersion (0), normalsWeight (-1), compressed (false)  {}
     inline Mesh (const Mesh & mesh) 
         : vertices (mesh.vertices), 
-          triangles (mesh.triangles) {}
+          triangles (mesh.triangles),
+          geometryVersion (mesh.geometryVersion),
+          normalsVersion (mesh.normalsVersion),
+          normalsWeight (mesh.normalsWeight),
+          compressed (mesh.compressed),
+          positions (mesh.positions),
+          packedPositions (mesh.packedPositions),
+          packedNormals (mesh.packedNormals),
+          quantOrigin (mesh.quantOrigin),
+          quantStep (mesh.quantStep),
+          packedIndices (mesh.packedIndices) {}
+
+    // Moving steals the vertex and index arrays, leaving mesh empty
+    inline Mesh (Mesh && mesh) 
+        : vertices (std::move (mesh.vertices)), 
+          triangles (std::move (mesh.triangles)),
+          geometryVersion (mesh.geometryVersion),
+          normalsVersion (mesh.normalsVersion),
+          normalsWeight (mesh.normalsWeight),
+          compressed (mesh.compressed),
+          positions (std::move (mesh.positions)),
+          packedPositions (std::move (mesh.packedPositions)),
+          packedNormals (std::move (mesh.packedNormals)),
+          quantOrigin (mesh.quantOrigin),
+          quantStep (mesh.quantStep),
+          packedIndices (std::move (mesh.packedIndices)) {
+        mesh.clear ();
+    }
         
     inline virtual ~Mesh () {}
+
+    Mesh & operator= (const Mesh & mesh) = default;
+    Mesh & operator= (Mesh && mesh);
+
+    /**
+     * Full-precision vertices and triangles. Vertices are empty while the
+     * mesh is compressed: use the getVertexPos/getVertexNormal/getTriangle
+     * accessors to read geometry in every mode. Triangles are unpacked
+     * before being handed out for modification, and must not be read
+     * through the const accessor while packed. Call markGeometryChanged
+     * after modifying vertices or triangles in place.
+     */
     std::vector<Vertex> & getVertices () { return vertices; }
     const std::vector<Vertex> & getVertices () const { return vertices; }
-    std::vector<Triangle> & getTriangles () { return triangles; }
-    const std::vector<Triangle> & getTriangles () const { return triangles; }
+    std::vector<Triangle> & getTriangles () { unpackIndices (); return triangles; }
+    const std::vector<Triangle> & getTriangles () const { assert (!hasPackedIndices ()); return triangles; }
     void clear ();
     void clearGeometry ();
     void clearTopology ();
     void unmarkAllVertices ();
     void recomputeSmoothVertexNormals (unsigned int weight);
     void computeTriangleNormals (std::vector<Vec3Df> & triangleNormals);  
+
+    /**
+     * Geometry version, incremented by every operation that modifies
+     * vertices or triangles. Derived data compare it to decide whether
+     * they are stale.
+     */
+    inline unsigned int getGeometryVersion () const { return geometryVersion; }
+    inline void markGeometryChanged () { geometryVersion++; }
+
+    /**
+     * Recompute smooth vertex normals only if geometry or weighting changed
+     * since the last computation. Returns true if they were recomputed.
+     */
+    bool updateSmoothVertexNormals (unsigned int weight);
+
     void collectOneRing (std::vector<std::vector<unsigned int> > & oneRing) const;
     void collectOrderedOneRing (std::vector<std::vector<unsigned int> > & oneRing) const;
-    void computeDualEdgeMap (EdgeMapIndex & dualVMap1, EdgeMapIndex & dualVMap2);
-    void markBorderEdges (EdgeMapIndex & edgeMap);
 
 		/**
 		 * Translate mesh by the given vector
 		 */
 		void translate (const Vec3Df & v);
+
+		/**
+		 * Scale mesh by the given factor, around the origin
+		 */
+		void scale (float s);
+
+    /**
+     * Replace the full-precision vertices by octahedral-encoded normals (32
+     * bits) and, if quantizePositions is set, 16-bit positions quantized to
+     * the mesh bounding box. Topology is left untouched.
+     */
+    void compress (bool quantizePositions);
+    void decompress ();
+    inline bool isCompressed () const { return compressed; }
+
+    /**
+     * Sort triangles along a Morton (Z-order) curve of their centroids and
+     * renumber vertices in first-use order, so that spatially close
+     * triangles and their vertices are close in memory. triangleMap and
+     * vertexMap receive the old to new index of each triangle and vertex.
+     */
+    void reorderMorton (std::vector<unsigned int> & triangleMap, std::vector<unsigned int> & vertexMap);
+    void reorderMorton ();
+
+    /**
+     * Size of the position record of one vertex, in the current mode
+     */
+    inline unsigned int getBytesPerVertex () const {
+        if (!compressed)
+            return sizeof (Vertex);
+        return packedPositions.empty () ? sizeof (Vec3Df) : 3*sizeof (unsigned short);
+    }
+
+    /**
+     * Size of the index record of one triangle, in the current mode
+     */
+    inline unsigned int getBytesPerTriangle () const {
+        return packedIndices.empty () ? sizeof (Triangle) : 3*sizeof (unsigned short);
+    }
+
+    inline unsigned int getNumVertices () const {
+        return compressed ? packedNormals.size () : vertices.size ();
+    }
+    inline Vec3Df getVertexPos (unsigned int i) const {
+        if (!compressed)
+            return vertices[i].getPos ();
+        if (packedPositions.empty ())
+            return positions[i];
+        return PackedVertex::dequantizePosition (&packedPositions[3*i], quantOrigin, quantStep);
+    }
+    inline Vec3Df getVertexNormal (unsigned int i) const {
+        if (!compressed)
+            return vertices[i].getNormal ();
+        return PackedVertex::decodeNormal (packedNormals[i]);
+    }
+
+    /**
+     * Shading normal at barycentric coordinates (iu, iv) of triangle t, as
+     * returned by the ray intersection routines.
+     */
+    inline Vec3Df interpolateNormal (unsigned int t, float iu, float iv) const {
+        Triangle tri = getTriangle (t);
+        Vec3Df n = (1-iu-iv)*getVertexNormal (tri.getVertex (0))
+            + iv*getVertexNormal (tri.getVertex (1))
+            + iu*getVertexNormal (tri.getVertex (2));
+        n.normalize ();
+        return n;
+    }
     
+    /**
+     * Merge vertices closer than tolerance, found through a spatial hash of
+     * cells of that size, and drop the triangles that collapse. Decompresses
+     * the mesh and unpacks indices first. Returns the number of vertices removed.
+     */
+    unsigned int weld (float tolerance);
+
+    /**
+     * Store triangle indices on 16 bits, if the mesh has few enough
+     * vertices. Returns true if indices are packed.
+     */
+    bool packIndices ();
+    void unpackIndices ();
+    inline bool hasPackedIndices () const { return !packedIndices.empty (); }
+
+    inline unsigned int getNumTriangles () const {
+        return packedIndices.empty () ? triangles.size () : packedIndices.size () / 3;
+    }
+    inline Triangle getTriangle (unsigned int t) const {
+        if (packedIndices.empty ())
+            return triangles[t];
+        const unsigned short * i = &packedIndices[3*t];
+        return Triangle (i[0], i[1], i[2]);
+    }
+
+    /**
+     * Memory used by vertex attributes and triangle indices, in bytes
+     */
+    size_t getMemoryFootprint () const;
+
+#ifndef RENDERBOY_HEADLESS
     void renderGL (bool flat) const;
+#endif
     
     void loadOFF (const std::string & filename);
   
@@ -63,8 +218,24 @@ public:
     };
 
 private:
+    void setVertexNormals (const std::vector<Vec3Df> & normals);
+
     std::vector<Vertex> vertices;
     std::vector<Triangle> triangles;
+    unsigned int geometryVersion;
+    unsigned int normalsVersion;
+    int normalsWeight;
+
+    // Compressed attributes
+    bool compressed;
+    std::vector<Vec3Df> positions;
+    std::vector<unsigned short> packedPositions;
+    std::vector<unsigned int> packedNormals;
+    Vec3Df quantOrigin;
+    Vec3Df quantStep;
+
+    // 16-bit triangle indices, three per triangle
+    std::vector<unsigned short> packedIndices;
 };
 
 #endif // MESH_H
@@ -0,0 +1,108 @@
+/**
+ * MeshAdjacency C++ Source code (MeshAdjacency.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "MeshAdjacency.hpp"
+#include "TaskPool.hpp"
+#include <algorithm>
+
+typedef unsigned long long Key;
+
+static inline Key makeKey (unsigned int hi, unsigned int lo) { return ((Key)hi << 32) | lo; }
+static inline unsigned int keyHi (Key k) { return (unsigned int)(k >> 32); }
+static inline unsigned int keyLo (Key k) { return (unsigned int)(k & 0xffffffffu); }
+
+/**
+ * Fill CSR offsets from keys sorted by their high word
+ */
+static void computeOffsets (const vector<Key> & keys, unsigned int numVertices, vector<unsigned int> & offsets) {
+	offsets.resize (numVertices + 1);
+	TaskPool::getInstance()->parallelFor (0, numVertices + 1, [&] (unsigned int v) {
+		offsets[v] = lower_bound (keys.begin(), keys.end(), makeKey (v, 0)) - keys.begin();
+	});
+}
+
+/**
+ * Half-edge, sorted by edge then by triangle
+ */
+struct HalfEdge {
+	Key edge;
+	unsigned int triangle;
+	unsigned int opposite;
+	inline bool operator< (const HalfEdge & h) const { return edge < h.edge || (edge == h.edge && triangle < h.triangle); }
+};
+
+void MeshAdjacency::clear () {
+	cornerOffsets.clear();
+	corners.clear();
+	neighbourOffsets.clear();
+	neighbours.clear();
+	edges.clear();
+}
+
+void MeshAdjacency::build (const Mesh & mesh) {
+	unsigned int numVertices = mesh.getNumVertices();
+	unsigned int numCorners = 3*mesh.getNumTriangles();
+
+	// Vertex to corners
+	vector<Key> keys (numCorners);
+	TaskPool::getInstance()->parallelFor (0, numCorners, [&] (unsigned int c) { keys[c] = makeKey (mesh.getTriangle (c/3).getVertex (c%3), c); });
+	TaskPool::getInstance()->parallelSort (keys.begin(), keys.end());
+	corners.resize (numCorners);
+	TaskPool::getInstance()->parallelFor (0, numCorners, [&] (unsigned int c) { corners[c] = keyLo (keys[c]); });
+	computeOffsets (keys, numVertices, cornerOffsets);
+
+	// Edge table
+	vector<HalfEdge> halfEdges (numCorners);
+	TaskPool::getInstance()->parallelFor (0, numCorners, [&] (unsigned int c) {
+		Triangle t = mesh.getTriangle (c/3);
+		Edge e (t.getVertex (c%3), t.getVertex ((c+1)%3));
+		halfEdges[c].edge = makeKey (e.v[0], e.v[1]);
+		halfEdges[c].triangle = c/3;
+		halfEdges[c].opposite = t.getVertex ((c+2)%3);
+	});
+	TaskPool::getInstance()->parallelSort (halfEdges.begin(), halfEdges.end());
+	edges.clear();
+	for (unsigned int h = 0; h < numCorners; h++) {
+		if (h == 0 || halfEdges[h].edge != halfEdges[h-1].edge) {
+			EdgeRecord r;
+			r.v[0] = keyHi (halfEdges[h].edge);
+			r.v[1] = keyLo (halfEdges[h].edge);
+			r.opposite[0] = halfEdges[h].opposite;
+			r.opposite[1] = NONE;
+			r.count = 1;
+			edges.push_back (r);
+		} else {
+			EdgeRecord & r = edges.back();
+			if (r.count == 1) r.opposite[1] = halfEdges[h].opposite;
+			r.count++;
+		}
+	}
+
+	// Vertex to vertices, from both directions of each edge. Degenerate edges
+	// get a key past every vertex, and are dropped after sorting.
+	keys.resize (2*edges.size());
+	TaskPool::getInstance()->parallelFor (0, edges.size(), [&] (unsigned int e) {
+		bool degenerate = (edges[e].v[0] == edges[e].v[1]);
+		keys[2*e] = degenerate ? makeKey (NONE, NONE) : makeKey (edges[e].v[0], edges[e].v[1]);
+		keys[2*e+1] = degenerate ? makeKey (NONE, NONE) : makeKey (edges[e].v[1], edges[e].v[0]);
+	});
+	TaskPool::getInstance()->parallelSort (keys.begin(), keys.end());
+	computeOffsets (keys, numVertices, neighbourOffsets);
+	neighbours.resize (neighbourOffsets[numVertices]);
+	TaskPool::getInstance()->parallelFor (0, neighbours.size(), [&] (unsigned int k) { neighbours[k] = keyLo (keys[k]); });
+}
+
+unsigned int MeshAdjacency::findEdge (const Edge & e) const {
+	unsigned int lo = 0, hi = edges.size();
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		const EdgeRecord & r = edges[mid];
+		if (r.v[0] < e.v[0] || (r.v[0] == e.v[0] && r.v[1] < e.v[1])) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo < edges.size() && edges[lo].v[0] == e.v[0] && edges[lo].v[1] == e.v[1]) return lo;
+	return NONE;
+}
@@ -0,0 +1,95 @@
+/**
+ * MeshAdjacency C++ Header (MeshAdjacency.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+
+#include "Mesh.h"
+#include "Edge.h"
+
+using namespace std;
+
+/**
+ * MeshAdjacency Class
+ * Vertex and edge adjacency of a triangle mesh, stored in compressed sparse
+ * row (CSR) form: one offset array per relation, and a flat array of
+ * neighbours, so that the neighbours of vertex v are the entries
+ * [offsets[v], offsets[v+1]) of that array.
+ *
+ * Everything is built with sort-based passes (parallel on the TaskPool),
+ * without any per-edge or per-vertex allocation.
+ */
+class MeshAdjacency {
+	public:
+		/**
+		 * Opposite vertex index for border edges
+		 */
+		static const unsigned int NONE = (unsigned int)-1;
+
+		/**
+		 * Edge table record: the two (sorted) vertices of the edge, the vertices
+		 * opposite to it in the first two triangles that contain it, in triangle
+		 * order, and the number of such triangles (1 on a border, 2 inside a manifold).
+		 */
+		struct EdgeRecord {
+			unsigned int v[2];
+			unsigned int opposite[2];
+			unsigned int count;
+		};
+
+		/**
+		 * MeshAdjacency Class Constructor. Call build to fill it.
+		 */
+		MeshAdjacency() { }
+
+		/**
+		 * MeshAdjacency Class Constructor, with direct mesh loading.
+		 */
+		MeshAdjacency(const Mesh & mesh) { build (mesh); }
+
+		/**
+		 * Build every relation of the given mesh
+		 */
+		void build (const Mesh & mesh);
+
+		/**
+		 * Clear all relations
+		 */
+		void clear ();
+
+		/**
+		 * Vertex to triangle corners: corner c is vertex c%3 of triangle c/3
+		 */
+		inline const vector<unsigned int> & getCornerOffsets () const { return cornerOffsets; }
+		inline const vector<unsigned int> & getCorners () const { return corners; }
+
+		/**
+		 * Vertex to vertices (one-ring), sorted by index. A vertex is never its own
+		 * neighbour, even if it is repeated in a degenerate triangle.
+		 */
+		inline const vector<unsigned int> & getNeighbourOffsets () const { return neighbourOffsets; }
+		inline const vector<unsigned int> & getNeighbours () const { return neighbours; }
+		inline unsigned int getValence (unsigned int v) const { return neighbourOffsets[v+1] - neighbourOffsets[v]; }
+
+		/**
+		 * Edge table, sorted by vertices
+		 */
+		inline const vector<EdgeRecord> & getEdges () const { return edges; }
+
+		/**
+		 * Index of the given edge in the edge table, or NONE if it does not exist
+		 */
+		unsigned int findEdge (const Edge & e) const;
+
+		inline bool isBorderEdge (unsigned int e) const { return edges[e].count == 1; }
+
+	protected:
+		vector<unsigned int> cornerOffsets;
+		vector<unsigned int> corners;
+		vector<unsigned int> neighbourOffsets;
+		vector<unsigned int> neighbours;
+		vector<EdgeRecord> edges;
+};
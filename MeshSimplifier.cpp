@@ -0,0 +1,235 @@
+/**
+ * MeshSimplifier C++ Source code (MeshSimplifier.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "MeshSimplifier.hpp"
+#include "MeshAdjacency.hpp"
+#include <algorithm>
+#include <queue>
+#include <cmath>
+
+/**
+ * Weight of the penalty planes keeping border edges in place
+ */
+static const float BORDER_WEIGHT = 10.f;
+
+/**
+ * Smallest cosine between the normals of a triangle before and after a collapse
+ */
+static const float MIN_NORMAL_COSINE = 0.2f;
+
+MeshSimplifier::Quadric::Quadric (const Vec3Df & n, float d, float w) {
+	q[0] = w*n[0]*n[0]; q[1] = w*n[0]*n[1]; q[2] = w*n[0]*n[2]; q[3] = w*n[0]*d;
+	q[4] = w*n[1]*n[1]; q[5] = w*n[1]*n[2]; q[6] = w*n[1]*d;
+	q[7] = w*n[2]*n[2]; q[8] = w*n[2]*d;
+	q[9] = w*d*d;
+}
+
+double MeshSimplifier::Quadric::error (const Vec3Df & v) const {
+	double x = v[0], y = v[1], z = v[2];
+	double e = q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+		+ q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+		+ q[7]*z*z + 2*q[8]*z
+		+ q[9];
+	return (e > 0.) ? e : 0.;
+}
+
+bool MeshSimplifier::Quadric::optimum (Vec3Df & v) const {
+	// Solve A v = -b, with A the upper-left 3x3 block, by Cramer's rule
+	double a00 = q[0], a01 = q[1], a02 = q[2], a11 = q[4], a12 = q[5], a22 = q[7];
+	double c00 = a11*a22 - a12*a12, c01 = a02*a12 - a01*a22, c02 = a01*a12 - a02*a11;
+	double det = a00*c00 + a01*c01 + a02*c02;
+	double scale = a00 + a11 + a22;
+	if (fabs (det) <= 1e-9 * scale * scale * scale || scale == 0.) return false;
+	double c11 = a00*a22 - a02*a02, c12 = a01*a02 - a00*a12, c22 = a00*a11 - a01*a01;
+	double b0 = -q[3], b1 = -q[6], b2 = -q[8];
+	v = Vec3Df ((c00*b0 + c01*b1 + c02*b2) / det, (c01*b0 + c11*b1 + c12*b2) / det, (c02*b0 + c12*b1 + c22*b2) / det);
+	return true;
+}
+
+void MeshSimplifier::collectNeighbours (unsigned int v, vector<unsigned int> & neighbours) const {
+	neighbours.clear();
+	for (vector<unsigned int>::const_iterator t = vertexTriangles[v].begin(); t != vertexTriangles[v].end(); t++) {
+		if (!triangleAlive[*t]) continue;
+		for (unsigned int j = 0; j < 3; j++)
+			if (triangles[*t].getVertex (j) != v) neighbours.push_back (triangles[*t].getVertex (j));
+	}
+	sort (neighbours.begin(), neighbours.end());
+	neighbours.erase (unique (neighbours.begin(), neighbours.end()), neighbours.end());
+}
+
+void MeshSimplifier::evaluate (unsigned int a, unsigned int b, Candidate & c) const {
+	Quadric q = quadrics[a];
+	q += quadrics[b];
+
+	// Optimal position, or the best of both ends and the midpoint
+	Vec3Df opt;
+	if (q.optimum (opt)) {
+		c.target = opt;
+		c.cost = q.error (opt);
+	} else {
+		Vec3Df choices[3] = { positions[a], positions[b], (positions[a] + positions[b]) / 2.f };
+		c.target = choices[0];
+		c.cost = q.error (choices[0]);
+		for (unsigned int i = 1; i < 3; i++) {
+			double e = q.error (choices[i]);
+			if (e < c.cost) { c.cost = e; c.target = choices[i]; }
+		}
+	}
+	c.v[0] = a; c.v[1] = b;
+	c.stamp[0] = stamps[a]; c.stamp[1] = stamps[b];
+}
+
+bool MeshSimplifier::isCollapseValid (unsigned int a, unsigned int b, const Vec3Df & target) const {
+	// Link condition: the only vertices adjacent to both ends are the ones
+	// opposite to the collapsed edge
+	vector<unsigned int> na, nb, common;
+	collectNeighbours (a, na);
+	collectNeighbours (b, nb);
+	set_intersection (na.begin(), na.end(), nb.begin(), nb.end(), back_inserter (common));
+	unsigned int shared = 0;
+	for (vector<unsigned int>::const_iterator t = vertexTriangles[a].begin(); t != vertexTriangles[a].end(); t++)
+		if (triangleAlive[*t] && triangles[*t].contains (b)) shared++;
+	if (common.size() > shared) return false;
+
+	// No remaining triangle may flip or degenerate
+	for (unsigned int s = 0; s < 2; s++) {
+		unsigned int v = (s == 0) ? a : b;
+		for (vector<unsigned int>::const_iterator t = vertexTriangles[v].begin(); t != vertexTriangles[v].end(); t++) {
+			if (!triangleAlive[*t] || (triangles[*t].contains (a) && triangles[*t].contains (b))) continue;
+			const Triangle & tri = triangles[*t];
+			Vec3Df p[3], q[3];
+			for (unsigned int j = 0; j < 3; j++) {
+				p[j] = positions[tri.getVertex (j)];
+				q[j] = (tri.getVertex (j) == v) ? target : p[j];
+			}
+			Vec3Df n0 = Vec3Df::crossProduct (p[1] - p[0], p[2] - p[0]);
+			Vec3Df n1 = Vec3Df::crossProduct (q[1] - q[0], q[2] - q[0]);
+			float l0 = n0.normalize(), l1 = n1.normalize();
+			if (l1 <= 1e-4f * l0) return false;
+			if (Vec3Df::dotProduct (n0, n1) < MIN_NORMAL_COSINE) return false;
+		}
+	}
+	return true;
+}
+
+float MeshSimplifier::simplify (unsigned int targetTriangles, Mesh & result) {
+	unsigned int numVertices = mesh.getNumVertices();
+	triangles.resize (mesh.getNumTriangles());
+	for (unsigned int t = 0; t < triangles.size(); t++) triangles[t] = mesh.getTriangle (t);
+	positions.resize (numVertices);
+	for (unsigned int v = 0; v < numVertices; v++) positions[v] = mesh.getVertexPos (v);
+	quadrics.assign (numVertices, Quadric());
+	triangleAlive.assign (triangles.size(), true);
+	vertexAlive.assign (numVertices, true);
+	stamps.assign (numVertices, 0);
+	vertexTriangles.assign (numVertices, vector<unsigned int>());
+
+	MeshAdjacency adjacency (mesh);
+	const vector<unsigned int> & cornerOffsets = adjacency.getCornerOffsets();
+	const vector<unsigned int> & corners = adjacency.getCorners();
+	for (unsigned int v = 0; v < numVertices; v++)
+		for (unsigned int k = cornerOffsets[v]; k < cornerOffsets[v+1]; k++) vertexTriangles[v].push_back (corners[k]/3);
+
+	// Plane quadrics. They are not area-weighted, so that the error of a
+	// position stays a sum of squared distances, in world units.
+	unsigned int liveTriangles = triangles.size();
+	for (unsigned int t = 0; t < triangles.size(); t++) {
+		const Triangle & tri = triangles[t];
+		Vec3Df p0 = positions[tri.getVertex (0)];
+		Vec3Df n = Vec3Df::crossProduct (positions[tri.getVertex (1)] - p0, positions[tri.getVertex (2)] - p0);
+		if (n.normalize() == 0.f) continue;
+		Quadric q (n, -Vec3Df::dotProduct (n, p0), 1.f);
+		for (unsigned int j = 0; j < 3; j++) quadrics[tri.getVertex (j)] += q;
+	}
+
+	// Penalty planes orthogonal to border edges
+	const vector<MeshAdjacency::EdgeRecord> & edges = adjacency.getEdges();
+	for (unsigned int e = 0; e < edges.size(); e++) {
+		if (!adjacency.isBorderEdge (e) || edges[e].v[0] == edges[e].v[1]) continue;
+		Vec3Df p0 = positions[edges[e].v[0]], p1 = positions[edges[e].v[1]];
+		Vec3Df dir = p1 - p0;
+		Vec3Df fn = Vec3Df::crossProduct (dir, positions[edges[e].opposite[0]] - p0);
+		Vec3Df n = Vec3Df::crossProduct (dir, fn);
+		if (n.normalize() == 0.f) continue;
+		Quadric q (n, -Vec3Df::dotProduct (n, p0), BORDER_WEIGHT);
+		quadrics[edges[e].v[0]] += q;
+		quadrics[edges[e].v[1]] += q;
+	}
+
+	priority_queue<Candidate> queue;
+	for (unsigned int e = 0; e < edges.size(); e++) {
+		if (edges[e].v[0] == edges[e].v[1]) continue;
+		Candidate c;
+		evaluate (edges[e].v[0], edges[e].v[1], c);
+		queue.push (c);
+	}
+
+	// Collapse edges by increasing error
+	double maxError = 0.;
+	vector<unsigned int> neighbours;
+	while (liveTriangles > targetTriangles && !queue.empty()) {
+		Candidate c = queue.top();
+		queue.pop();
+		unsigned int a = c.v[0], b = c.v[1];
+		if (!vertexAlive[a] || !vertexAlive[b] || stamps[a] != c.stamp[0] || stamps[b] != c.stamp[1]) continue;
+		if (!isCollapseValid (a, b, c.target)) continue;
+
+		// Merge b into a
+		positions[a] = c.target;
+		quadrics[a] += quadrics[b];
+		vertexAlive[b] = false;
+		stamps[a]++;
+		maxError = max (maxError, c.cost);
+		vector<unsigned int> merged;
+		for (unsigned int s = 0; s < 2; s++) {
+			unsigned int v = (s == 0) ? a : b;
+			for (vector<unsigned int>::const_iterator t = vertexTriangles[v].begin(); t != vertexTriangles[v].end(); t++) {
+				if (!triangleAlive[*t]) continue;
+				Triangle & tri = triangles[*t];
+				if (tri.contains (a) && tri.contains (b)) {
+					triangleAlive[*t] = false;
+					liveTriangles--;
+					continue;
+				}
+				for (unsigned int j = 0; j < 3; j++) if (tri.getVertex (j) == b) tri.setVertex (j, a);
+				merged.push_back (*t);
+			}
+		}
+		sort (merged.begin(), merged.end());
+		merged.erase (unique (merged.begin(), merged.end()), merged.end());
+		vertexTriangles[a].swap (merged);
+		vector<unsigned int> ().swap (vertexTriangles[b]);
+
+		// Re-evaluate the edges around the new vertex
+		collectNeighbours (a, neighbours);
+		for (vector<unsigned int>::const_iterator n = neighbours.begin(); n != neighbours.end(); n++) {
+			Candidate nc;
+			evaluate (a, *n, nc);
+			queue.push (nc);
+		}
+	}
+
+	// Compact the remaining vertices and triangles
+	vector<unsigned int> remap (numVertices, (unsigned int)-1);
+	vector<Vertex> outVertices;
+	vector<Triangle> outTriangles;
+	for (unsigned int t = 0; t < triangles.size(); t++) {
+		if (!triangleAlive[t]) continue;
+		Triangle tri;
+		for (unsigned int j = 0; j < 3; j++) {
+			unsigned int v = triangles[t].getVertex (j);
+			if (remap[v] == (unsigned int)-1) {
+				remap[v] = outVertices.size();
+				outVertices.push_back (Vertex (positions[v]));
+			}
+			tri.setVertex (j, remap[v]);
+		}
+		outTriangles.push_back (tri);
+	}
+	result = Mesh (outVertices, outTriangles);
+	result.recomputeSmoothVertexNormals (1);
+	return sqrt (maxError);
+}
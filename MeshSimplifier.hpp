@@ -0,0 +1,74 @@
+/**
+ * MeshSimplifier C++ Header (MeshSimplifier.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+
+#include "Mesh.h"
+#include "Vec3D.h"
+
+using namespace std;
+
+/**
+ * MeshSimplifier Class
+ * Edge-collapse simplification driven by quadric error metrics. Edges are
+ * collapsed by increasing error until the target triangle count is reached;
+ * collapses that would flip a triangle or make the mesh non-manifold are
+ * skipped, and border edges are kept in place by penalty quadrics.
+ *
+ * @see http://mgarland.org/files/papers/quadrics.pdf
+ */
+class MeshSimplifier {
+	public:
+		/**
+		 * MeshSimplifier Class Constructor
+		 */
+		MeshSimplifier(const Mesh & mesh) : mesh(mesh) { }
+
+		/**
+		 * Simplify the mesh down to (about) targetTriangles triangles into result.
+		 * Returns the geometric error of the result, as the square root of the
+		 * largest quadric error of all collapses, in world units.
+		 */
+		float simplify (unsigned int targetTriangles, Mesh & result);
+
+	protected:
+		/**
+		 * Symmetric 4x4 error quadric, upper triangle only
+		 */
+		struct Quadric {
+			double q[10];
+			Quadric () { for (unsigned int i = 0; i < 10; i++) q[i] = 0.; }
+			Quadric (const Vec3Df & n, float d, float w);
+			Quadric & operator+= (const Quadric & o) { for (unsigned int i = 0; i < 10; i++) q[i] += o.q[i]; return *this; }
+			double error (const Vec3Df & v) const;
+			bool optimum (Vec3Df & v) const;
+		};
+
+		/**
+		 * Collapse candidate, ordered by increasing cost
+		 */
+		struct Candidate {
+			double cost;
+			unsigned int v[2];
+			unsigned int stamp[2];
+			Vec3Df target;
+			inline bool operator< (const Candidate & c) const { return cost > c.cost; }
+		};
+
+		void evaluate (unsigned int a, unsigned int b, Candidate & c) const;
+		bool isCollapseValid (unsigned int a, unsigned int b, const Vec3Df & target) const;
+		void collectNeighbours (unsigned int v, vector<unsigned int> & neighbours) const;
+
+		const Mesh & mesh;
+		vector<Vec3Df> positions;
+		vector<Quadric> quadrics;
+		vector<Triangle> triangles;
+		vector<bool> triangleAlive;
+		vector<bool> vertexAlive;
+		vector<unsigned int> stamps;
+		vector<vector<unsigned int> > vertexTriangles;
+};
@@ -9,13 +9,21 @@
 
 using namespace std;
 
+Object::Object (const shared_ptr<const Shape> & shape, const Material & mat, const Placement & placement) : mat (mat) {
+    setShape (shape, placement);
+}
+
+void Object::setShape (const shared_ptr<const Shape> & s, const Placement & p) {
+    shape = s;
+    placement = p;
+    placed = (p.center != Vec3Df (0.f, 0.f, 0.f) || p.scale != 1.f || p.translation != Vec3Df (0.f, 0.f, 0.f));
+    updateBoundingBox ();
+}
+
 void Object::updateBoundingBox () {
-    const vector<Vertex> & V = mesh.getVertices ();
-    if (V.empty ())
-        bbox = BoundingBox ();
-    else {
-        bbox = BoundingBox (V[0].getPos ());
-        for (unsigned int i = 1; i < V.size (); i++)
-            bbox.extendTo (V[i].getPos ());
-    }
+    const BoundingBox & b = shape->getBoundingBox ();
+    if (placed)
+        bbox = BoundingBox (toWorld (b.getMin ()), toWorld (b.getMax ()));
+    else
+        bbox = b;
 }
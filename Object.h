@@ -9,62 +9,73 @@
 #define OBJECT_H
 
 #include <iostream>
-#include <vector>
+#include <memory>
 
-#include "Mesh.h"
-#include "KDTreeNode.hpp"
+#include "Shape.hpp"
 #include "Material.h"
 #include "BoundingBox.h"
 
 using namespace std;
 
+// An object of the scene: a shape, where it is placed, and its material.
+// Objects made from the same mesh file share its shape, each with its own
+// placement. Objects are copied into the snapshot of each render, sharing
+// their shape too, so that the scene may change its own objects while
+// renders read theirs.
 class Object {
 public:
-    inline Object () { cout << "     Creating object " << this << endl; }
-    inline Object (const Mesh & mesh, const Material & mat) :mesh (mesh), mat (mat) {
-				cout << "     Creating object " << this << endl;
-        updateBoundingBox ();
-				kdt = NULL;
-    }
-
-    virtual ~Object () {
-			cout << "     Destroying object " << this << endl;
-			if (kdt != NULL) { delete kdt; kdt = NULL; }
-		}
+    // Where a shape is placed: its point p is at (p - center) * scale + translation
+    struct Placement {
+        Vec3Df center;
+        float scale;
+        Vec3Df translation;
+        Placement () : scale (1.f) { }
+    };
+
+    Object (const shared_ptr<const Shape> & shape, const Material & mat, const Placement & placement = Placement ());
+
+    inline const Shape & getShape () const { return *shape; }
+    inline const shared_ptr<const Shape> & shareShape () const { return shape; }
+    void setShape (const shared_ptr<const Shape> & s, const Placement & p);
+
+    // Geometry of the shape, in its own coordinates
+    inline const Mesh & getMesh () const { return shape->getMesh (); }
 
-    inline const Mesh & getMesh () const { return mesh; }
-    inline Mesh & getMesh () { return mesh; }
-    
     inline const Material & getMaterial () const { return mat; }
-    inline Material & getMaterial () { return mat; }
+    inline void setMaterial (const Material & m) { mat = m; }
 
+    // In scene coordinates
     inline const BoundingBox & getBoundingBox () const { return bbox; }
-    void updateBoundingBox ();
 
-		inline void computeKdTree () {
-			if (kdt == NULL) {
-				cout << " (I) Building KD-Tree..." << endl;
-				kdt = new KDTreeNode (mesh, pow(10,-3.f+6.f/8.f));
-			}
-		}
+    inline const Placement & getPlacement () const { return placement; }
+    inline bool isPlaced () const { return placed; }
+    inline Vec3Df toWorld (const Vec3Df & p) const { return (p - placement.center) * placement.scale + placement.translation; }
+    inline Vec3Df toShape (const Vec3Df & p) const { return (p - placement.translation) / placement.scale + placement.center; }
 
-		inline KDTreeNode * getKdTree () const {
-			return kdt;
-		}
+		inline const KDTreeNode * getKdTree () const { return shape->getKdTree (); }
+		inline bool isOutOfCore () const { return shape->isOutOfCore (); }
+		inline const ChunkedMesh & getChunkedMesh () const { return shape->getChunkedMesh (); }
 
-		inline Object & operator= (const Object & o) {
-			mesh = o.mesh;
-			mat = o.mat;
-			bbox = o.bbox;
-			if (kdt != NULL) { delete kdt; kdt = NULL; }
-			return *this;
+		/**
+		 * Shading normal of a ray hit, the same in the scene as in the shape
+		 * since placements only scale uniformly
+		 */
+		inline Vec3Df interpolateNormal (unsigned int t, float iu, float iv) const {
+			return shape->interpolateNormal (t, iu, iv);
 		}
+
+		/**
+		 * @see Shape::selectLOD, with maxError in scene units
+		 */
+		inline const Mesh & selectLOD (float maxError) const { return shape->selectLOD (maxError / placement.scale); }
     
 private:
-    Mesh mesh;
+    void updateBoundingBox ();
+    shared_ptr<const Shape> shape;
     Material mat;
+    Placement placement;
+    bool placed;
     BoundingBox bbox;
-		KDTreeNode *kdt;
 };
 
 
@@ -0,0 +1,67 @@
+/**
+ * ObjectSet C++ Header (ObjectSet.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * ObjectSet Class
+ * Set of object indices, one bit per object of the scene. It grows as
+ * needed, so an empty set costs nothing.
+ */
+class ObjectSet {
+	public:
+		/**
+		 * ObjectSet Class Constructor
+		 */
+		ObjectSet () { }
+
+		inline void insert (unsigned int o) {
+			if (o / 64 >= words.size()) words.resize (o / 64 + 1, 0);
+			words[o / 64] |= (uint64_t) 1 << (o % 64);
+		}
+
+		inline bool contains (unsigned int o) const {
+			return o / 64 < words.size() && (words[o / 64] >> (o % 64) & 1);
+		}
+
+		/**
+		 * Add all the objects of s
+		 */
+		inline void insert (const ObjectSet & s) {
+			if (s.words.size() > words.size()) words.resize (s.words.size(), 0);
+			for (unsigned int w = 0; w < s.words.size(); w++) words[w] |= s.words[w];
+		}
+
+		/**
+		 * True if s and this set have an object in common
+		 */
+		inline bool intersects (const ObjectSet & s) const {
+			for (unsigned int w = 0; w < words.size() && w < s.words.size(); w++)
+				if (words[w] & s.words[w]) return true;
+			return false;
+		}
+
+		inline bool empty () const {
+			for (unsigned int w = 0; w < words.size(); w++)
+				if (words[w]) return false;
+			return true;
+		}
+
+		/**
+		 * Remove all objects, keeping the memory
+		 */
+		inline void clear () { fill (words.begin(), words.end(), 0); }
+
+		inline void swap (ObjectSet & s) { words.swap (s.words); }
+
+	protected:
+		vector<uint64_t> words;
+};
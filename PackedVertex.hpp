@@ -0,0 +1,88 @@
+/**
+ * PackedVertex C++ Header (PackedVertex.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <cmath>
+
+#include "Vec3D.h"
+
+/**
+ * PackedVertex Class
+ * Encoding and decoding of compressed vertex attributes: unit normals are
+ * stored as two 16-bit octahedral coordinates in a single 32-bit word, and
+ * positions as three 16-bit integers quantized to a bounding box.
+ *
+ * @see http://jcgt.org/published/0003/02/01/
+ */
+class PackedVertex {
+	public:
+		/**
+		 * Largest quantized coordinate value
+		 */
+		static const unsigned int QMAX = 65535;
+
+		/**
+		 * Encode a normal into 32 bits using an octahedral projection
+		 */
+		static inline unsigned int encodeNormal (const Vec3Df & n) {
+			float l1 = fabs (n[0]) + fabs (n[1]) + fabs (n[2]);
+			if (l1 == 0.f) return pack (0.f, 0.f);
+			float x = n[0] / l1, y = n[1] / l1;
+			if (n[2] < 0.f) {
+				float ox = x;
+				x = (1.f - fabs (y)) * sign (ox);
+				y = (1.f - fabs (ox)) * sign (y);
+			}
+			return pack (x, y);
+		}
+
+		/**
+		 * Decode a normal encoded with encodeNormal
+		 */
+		static inline Vec3Df decodeNormal (unsigned int e) {
+			float x = unpack (e & 0xffff);
+			float y = unpack (e >> 16);
+			float z = 1.f - fabs (x) - fabs (y);
+			if (z < 0.f) {
+				float ox = x;
+				x = (1.f - fabs (y)) * sign (ox);
+				y = (1.f - fabs (ox)) * sign (y);
+			}
+			Vec3Df n (x, y, z);
+			n.normalize ();
+			return n;
+		}
+
+		/**
+		 * Quantize a position to 16 bits per axis, given the box origin and the size of one quantization step
+		 */
+		static inline void quantizePosition (const Vec3Df & p, const Vec3Df & origin, const Vec3Df & step, unsigned short * q) {
+			for (unsigned int i = 0; i < 3; i++) {
+				float f = (step[i] > 0.f) ? (p[i] - origin[i]) / step[i] : 0.f;
+				q[i] = (unsigned short) (f <= 0.f ? 0 : (f >= QMAX ? QMAX : (unsigned int) (f + 0.5f)));
+			}
+		}
+
+		/**
+		 * Dequantize a position quantized with quantizePosition
+		 */
+		static inline Vec3Df dequantizePosition (const unsigned short * q, const Vec3Df & origin, const Vec3Df & step) {
+			return Vec3Df (origin[0] + q[0]*step[0], origin[1] + q[1]*step[1], origin[2] + q[2]*step[2]);
+		}
+
+	protected:
+		static inline float sign (float f) { return (f >= 0.f) ? 1.f : -1.f; }
+
+		static inline unsigned int pack (float x, float y) {
+			unsigned int ux = (unsigned int) ((x * 0.5f + 0.5f) * QMAX + 0.5f);
+			unsigned int uy = (unsigned int) ((y * 0.5f + 0.5f) * QMAX + 0.5f);
+			return (ux & 0xffff) | ((uy & 0xffff) << 16);
+		}
+
+		static inline float unpack (unsigned int u) {
+			return (float) u / QMAX * 2.f - 1.f;
+		}
+};
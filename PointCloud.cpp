@@ -11,3 +11,92 @@
  */
 
 #include "PointCloud.hpp"
+#include "TaskPool.hpp"
+#include "SceneGenerator.hpp"
+
+void PointCloud::add (const vector<Object> & objects, const vector<Light> & lights, const Camera & cam) {
+	vector<vector<Surfel> > samples (objects.size());
+	vector<vector<Vec3Df> > sampleResponses (objects.size());
+	TaskPool::getInstance()->parallelFor (0, objects.size(), 1, [&] (unsigned int o) {
+		sample (objects[o], lights, cam, o + 1, samples[o], sampleResponses[o]);
+	});
+	numLights = lights.size();
+	for (unsigned int o = 0; o < objects.size(); o++) {
+		surfels.insert (surfels.end(), samples[o].begin(), samples[o].end());
+		responses.insert (responses.end(), sampleResponses[o].begin(), sampleResponses[o].end());
+		objectSurfels.push_back (surfels.size());
+	}
+	cout << " (I) Point cloud size is now: " << surfels.size() << endl;
+}
+
+bool PointCloud::sameSurfels (unsigned int o, const PointCloud & p) const {
+	unsigned int first = getFirstSurfel (o), last = getFirstSurfel (o+1), pFirst = p.getFirstSurfel (o);
+	if (numLights != p.numLights || last - first != p.getFirstSurfel (o+1) - pFirst) return false;
+	for (unsigned int s = 0; s < last - first; s++) {
+		const Surfel & a = surfels[first + s], & b = p.surfels[pFirst + s];
+		if (a.getPosition() != b.getPosition() || a.getRadius() != b.getRadius() || a.getColor() != b.getColor()) return false;
+		for (unsigned int l = 0; l < numLights; l++)
+			if (getResponse (first + s, l) != p.getResponse (pFirst + s, l)) return false;
+	}
+	return true;
+}
+
+void PointCloud::copySurfels (unsigned int o, const PointCloud & p) {
+	unsigned int first = getFirstSurfel (o), last = getFirstSurfel (o+1), pFirst = p.getFirstSurfel (o), pLast = p.getFirstSurfel (o+1);
+	surfels.erase (surfels.begin() + first, surfels.begin() + last);
+	surfels.insert (surfels.begin() + first, p.surfels.begin() + pFirst, p.surfels.begin() + pLast);
+	responses.erase (responses.begin() + first * numLights, responses.begin() + last * numLights);
+	responses.insert (responses.begin() + first * numLights, p.responses.begin() + pFirst * numLights, p.responses.begin() + pLast * numLights);
+	for (unsigned int i = o; i < objectSurfels.size(); i++) objectSurfels[i] += (pLast - pFirst) - (last - first);
+}
+
+void PointCloud::sample (const Object & o, const vector<Light> & lights, const Camera & cam, unsigned int seed, vector<Surfel> & out, vector<Vec3Df> & responses) {
+	SceneGenerator generator (seed);
+	for (unsigned int i = 0; i < MAX_POINTS && i < o.getMesh().getNumTriangles(); i++) {
+		Triangle it = o.getMesh().getTriangle (generator.index (o.getMesh().getNumTriangles()));
+		Vec3Df v0 = o.toWorld (o.getMesh().getVertexPos(it.getVertex(0)));
+		Vec3Df v1 = o.toWorld (o.getMesh().getVertexPos(it.getVertex(1)));
+		Vec3Df v2 = o.toWorld (o.getMesh().getVertexPos(it.getVertex(2)));
+		Vec3Df u = v1 - v0;
+		Vec3Df v = v2 - v0;
+
+		// Compute Surfel radius
+		float dp = Vec3Df::dotProduct (u, v);
+		float sin0 = sqrtf (1.f - dp*dp);
+		float radius = (v2 - v1).getLength() / (2.f * sin0);
+
+		// Compute Surfel color
+		Vec3Df eye = cam.position();
+		Vec3Df point = (v0 + v1 + v2)/3.f;
+		Vec3Df normal = Vec3Df::crossProduct (u, v);
+		Material mat = o.getMaterial();
+
+		Vec3Df c;
+		Vec3Df vv = eye - point;
+		Vec3Df lpos, lm;
+		vv.normalize();
+
+		for (vector<Light>::const_iterator light = lights.begin(); light != lights.end(); light++) {
+			lpos = cam.toWorld (light->getPos());
+			lm = lpos - point;
+			lm.normalize();
+
+			// Diffuse Light
+			float sc = Vec3D<float>::dotProduct(lm, normal);
+			Vec3Df response = mat.getDiffuse() * fabs (sc) * mat.getColor();
+
+			// Specular Light
+			sc = Vec3D<float>::dotProduct(normal*sc*2.f-lm, vv);
+			if (sc > 0.) {
+				sc = pow (sc, mat.getShininess() * 40.f);
+				response += Vec3Df (1.f, 1.f, 1.f) * (mat.getSpecular() * sc);
+			}
+
+			// Response to this light, and its part of the colour
+			responses.push_back (response);
+			c += light->getColor() * response;
+		}
+
+		out.push_back (Surfel (point, normal, radius, c));
+	}
+}
@@ -38,67 +38,59 @@ class PointCloud {
 		 * 
 		 * @author François-Xavier Thomas
 		 */
-		PointCloud() { }
+		PointCloud() : numLights (0) { }
 
-		inline void clear () { surfels.clear(); }
-		inline void add (Surfel s) { surfels.push_back (s); }
-		inline void add (const Object & o, const Camera & cam) {
-			const unsigned int MAX_POINT = 100;
-			for (unsigned int i = 0; i < MAX_POINT && i < (unsigned int)(o.getMesh().getTriangles().size()); i++) {
-				Triangle it = o.getMesh().getTriangles ()[rand()%o.getMesh().getTriangles().size()];
-				Vec3Df v0 = o.getMesh().getVertices()[it.getVertex(0)].getPos();
-				Vec3Df v1 = o.getMesh().getVertices()[it.getVertex(1)].getPos();
-				Vec3Df v2 = o.getMesh().getVertices()[it.getVertex(2)].getPos();
-				Vec3Df u = v1 - v0;
-				Vec3Df v = v2 - v0;
-
-				// Compute Surfel radius
-				float dp = Vec3Df::dotProduct (u, v);
-				float sin0 = sqrtf (1.f - dp*dp);
-				float radius = (v2 - v1).getLength() / (2.f * sin0);
-
-				// Compute Surfel color
-				Vec3Df eye = cam.position();
-				Vec3Df point = (v0 + v1 + v2)/3.f;
-				Vec3Df normal = Vec3Df::crossProduct (u, v);
-				Material mat = o.getMaterial();
-
-				Vec3Df diffuseSelf,specularSelf;
-				Vec3Df c = mat.getColor();
-				Vec3Df vv = eye - point;
-				Vec3Df lpos, lm;
-				vv.normalize();
+		inline void clear () { surfels.clear(); responses.clear(); objectSurfels.clear(); numLights = 0; }
+		/**
+		 * Add the surfels of all the objects, lit by lights, sampled in
+		 * parallel. The surfels only depend on the objects and the lights,
+		 * whatever the number of threads.
+		 */
+		void add (const vector<Object> & objects, const vector<Light> & lights, const Camera & cam);
 
-				for (vector<Light>::iterator light = Scene::getInstance()->getLights().begin(); light != Scene::getInstance()->getLights().end(); light++) {
-					lpos = cam.toWorld (light->getPos());
-					lm = lpos - point;
-					lm.normalize();
+		/**
+		 * Surfels of up to MAX_POINTS random triangles of o lit by lights, appended
+		 * to out, and their response to each light, appended to responses.
+		 * Triangles are drawn from a generator seeded by seed.
+		 */
+		static void sample (const Object & o, const vector<Light> & lights, const Camera & cam, unsigned int seed, vector<Surfel> & out, vector<Vec3Df> & responses);
 
-					// Diffuse Light
-					float sc = Vec3D<float>::dotProduct(lm, normal);
-					diffuseSelf += light->getColor() * fabs (sc);
+		/**
+		 * Most surfels per object
+		 */
+		static const unsigned int MAX_POINTS = 100;
 
-					// Specular Light
-					sc = Vec3D<float>::dotProduct(normal*sc*2.f-lm, vv);
-					if (sc > 0.) {
-						sc = pow (sc, mat.getShininess() * 40.f);
-						specularSelf += light->getColor() * sc;
-					}
-				}
+		inline const vector<Surfel> & getSurfels() const { return surfels; }
 
-				// Total color blend
-				c[0] = (mat.getDiffuse()*c[0]*diffuseSelf[0] + mat.getSpecular()*specularSelf[0]);
-				c[1] = (mat.getDiffuse()*c[1]*diffuseSelf[1] + mat.getSpecular()*specularSelf[1]);
-				c[2] = (mat.getDiffuse()*c[2]*diffuseSelf[2] + mat.getSpecular()*specularSelf[2]);
+		/**
+		 * Surfels of object o: from getFirstSurfel (o) to getFirstSurfel (o+1)
+		 */
+		inline unsigned int getNumObjects () const { return objectSurfels.size(); }
+		inline unsigned int getFirstSurfel (unsigned int o) const { return o == 0 ? 0 : objectSurfels[o-1]; }
 
-				surfels.push_back (Surfel (point, normal, radius, c));
-			}
+		/**
+		 * True if object o has the same surfels, lit the same, in p
+		 */
+		bool sameSurfels (unsigned int o, const PointCloud & p) const;
 
-			cout << " (I) Point cloud size is now: " << surfels.size() << endl;
-		}
+		/**
+		 * Replace the surfels of object o by those it has in p, lit by the
+		 * same lights
+		 */
+		void copySurfels (unsigned int o, const PointCloud & p);
 
-		inline const vector<Surfel> & getSurfels() const { return surfels; }
+		/**
+		 * Colour of surfel s lit by light l alone, when the colour of the light
+		 * is white: the colour of the surfel is the sum of these times the
+		 * colours of the lights.
+		 */
+		inline const Vec3Df & getResponse (unsigned int s, unsigned int l) const { return responses[s * numLights + l]; }
+		inline unsigned int getNumLights () const { return numLights; }
 		
 	protected:
 		vector<Surfel> surfels;
+		vector<Vec3Df> responses;
+		// End of the surfels of each object
+		vector<unsigned int> objectSurfels;
+		unsigned int numLights;
 };
@@ -11,4 +11,27 @@
  */
 
 #include "QClickableLabel.hpp"
+#include <QApplication>
 
+void QClickableLabel::mousePressEvent (QMouseEvent * me) {
+	origin = me->pos ();
+	if (rubberBand != NULL) rubberBand->hide ();
+}
+
+void QClickableLabel::mouseMoveEvent (QMouseEvent * me) {
+	if (!(me->buttons () & Qt::LeftButton)) return;
+	// Short moves are still clicks
+	bool dragging = (rubberBand != NULL && rubberBand->isVisible ());
+	if (!dragging && (me->pos () - origin).manhattanLength () < QApplication::startDragDistance ()) return;
+	if (rubberBand == NULL) rubberBand = new QRubberBand (QRubberBand::Rectangle, this);
+	rubberBand->setGeometry (QRect (origin, me->pos ()).normalized ().intersected (rect ()));
+	rubberBand->show ();
+}
+
+void QClickableLabel::mouseReleaseEvent (QMouseEvent * me) {
+	if (rubberBand != NULL && rubberBand->isVisible ()) {
+		rubberBand->hide ();
+		emit selected (rubberBand->geometry ());
+	} else
+		emit clicked (me);
+}
@@ -12,6 +12,7 @@
 
 #include <QLabel>
 #include <QMouseEvent>
+#include <QRubberBand>
 
 /**
  * QClickableLabel Class
@@ -28,14 +29,26 @@ class QClickableLabel : public QLabel {
 		 * 
 		 * @author François-Xavier Thomas
 		 */
-		QClickableLabel() : QLabel() { }
+		QClickableLabel() : QLabel(), rubberBand (NULL) { }
 
 	signals:
+		/**
+		 * Emitted when the mouse is released without dragging
+		 */
 		void clicked (QMouseEvent * me);
+
+		/**
+		 * Emitted when a rectangle is dragged, in the coordinates of the label
+		 */
+		void selected (const QRect & rect);
 	
 	protected:
-		virtual void mousePressEvent (QMouseEvent * me) {
-			emit clicked (me);
-		}
+		virtual void mousePressEvent (QMouseEvent * me);
+		virtual void mouseMoveEvent (QMouseEvent * me);
+		virtual void mouseReleaseEvent (QMouseEvent * me);
+
+	private:
+		QRubberBand * rubberBand;
+		QPoint origin;
 };
 
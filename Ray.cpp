@@ -6,6 +6,7 @@
 // *********************************************************
 
 #include "Ray.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -71,9 +72,17 @@ bool Ray::intersectFuzzy (const BoundingBox & bbox, Vec3Df & intersectionPoint)
 /**
  * Finds the intersecting leaf, inside the KD-Tree
  */
-const KDTreeNode* Ray::intersect (const KDTreeNode* kdtree, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle) const {
-	if (kdtree == NULL) return NULL;
-	else if (kdtree->getLeft() == NULL && kdtree->getRight() == NULL) {
+const KDTreeNode* Ray::intersect (const KDTreeNode* kdtree, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered) const {
+	if (kdtree == NULL) {
+		if (entered != NULL) *entered = false;
+		return NULL;
+	} else if (kdtree->getLeft() == NULL && kdtree->getRight() == NULL) {
+		// A tree of a single leaf tests no bounds on its own
+		if (entered != NULL) {
+			Vec3Df entry;
+			*entered = intersect (kdtree->getBoundingBox(), entry);
+		}
+
 		// Initialize stuff
 		ir = INFINITY;
 		bool hasIntersection = false;
@@ -83,10 +92,10 @@ const KDTreeNode* Ray::intersect (const KDTreeNode* kdtree, Vertex & intersectio
 		Vertex tmpPoint;
 
 		for (vector<unsigned int>::const_iterator ti = kdtree->getTriangles().begin(); ti != kdtree->getTriangles().end(); ti++) {
-			Triangle tri = kdtree->getMesh()->getTriangles()[*ti];
-			Vertex v0 = kdtree->getMesh()->getVertices()[tri.getVertex(0)];
-			Vertex v1 = kdtree->getMesh()->getVertices()[tri.getVertex(1)];
-			Vertex v2 = kdtree->getMesh()->getVertices()[tri.getVertex(2)];
+			Triangle tri = kdtree->getMesh()->getTriangle (*ti);
+			Vec3Df v0 = kdtree->getMesh()->getVertexPos (tri.getVertex(0));
+			Vec3Df v1 = kdtree->getMesh()->getVertexPos (tri.getVertex(1));
+			Vec3Df v2 = kdtree->getMesh()->getVertexPos (tri.getVertex(2));
 			tmpIntersection = intersect (v0, v1, v2, tmpPoint, tmpIr, tmpIu, tmpIv);
 			if (tmpIntersection) {
 				hasIntersection = true;
@@ -105,12 +114,14 @@ const KDTreeNode* Ray::intersect (const KDTreeNode* kdtree, Vertex & intersectio
 		}
 		else return NULL;
 
-	} else if (kdtree->getLeft() == NULL) return intersect (kdtree->getRight(), intersectionPoint, ir, iu, iv, triangle);
-	else if (kdtree->getRight() == NULL) return intersect (kdtree->getLeft(), intersectionPoint, ir, iu, iv, triangle);
+	} else if (kdtree->getLeft() == NULL) return intersect (kdtree->getRight(), intersectionPoint, ir, iu, iv, triangle, entered);
+	else if (kdtree->getRight() == NULL) return intersect (kdtree->getLeft(), intersectionPoint, ir, iu, iv, triangle, entered);
 	else {
+		// The children split the bounds of the node between them
 		Vec3Df vleft, vright;
 		bool ileft = intersect(kdtree->getLeft()->getBoundingBox(), vleft);
 		bool iright = intersect(kdtree->getRight()->getBoundingBox(), vright);
+		if (entered != NULL) *entered = ileft || iright;
 
 		if (!ileft && iright) return intersect (kdtree->getRight(), intersectionPoint, ir, iu, iv, triangle);
 		else if (!iright && ileft) return intersect (kdtree->getLeft(), intersectionPoint, ir, iu, iv, triangle);
@@ -165,10 +176,20 @@ const KDTreeNode* Ray::intersect (const KDTreeNode* kdtree, Vertex & intersectio
  * @see http://fr.wikipedia.org/wiki/Lancer_de_rayon#Exemple_du_calcul_de_l.27intersection_d.27un_rayon_et_d.27un_triangle
  */
 bool Ray::intersect (const Vertex & v0, const Vertex & v1, const Vertex & v2, Vertex & intersectionPoint, float & ir, float & iu, float & iv) const {
-	Vec3Df v = v1.getPos() - v0.getPos();
-	Vec3Df u = v2.getPos() - v0.getPos();
+	bool hasIntersection = intersect (v0.getPos(), v1.getPos(), v2.getPos(), intersectionPoint, ir, iu, iv);
+	if (hasIntersection) intersectionPoint.setNormal (v0.getNormal());
+	return hasIntersection;
+}
+
+/**
+ * Computes the intersection of a light ray and a triangle, defined by the positions of its 3 vertices.
+ * The normal of the intersection point is set to the geometric normal of the triangle.
+ */
+bool Ray::intersect (const Vec3Df & p0, const Vec3Df & p1, const Vec3Df & p2, Vertex & intersectionPoint, float & ir, float & iu, float & iv) const {
+	Vec3Df v = p1 - p0;
+	Vec3Df u = p2 - p0;
 	Vec3Df nn = Vec3Df::crossProduct(u, v);
-	Vec3Df otr = origin - v0.getPos();
+	Vec3Df otr = origin - p0;
 	Vec3Df otrv = Vec3Df::crossProduct (otr, v);
 	Vec3Df uotr = Vec3Df::crossProduct (u, otr);
 
@@ -181,7 +202,7 @@ bool Ray::intersect (const Vertex & v0, const Vertex & v1, const Vertex & v2, Ve
 	bool hasIntersection = (0 <= iu && iu <= 1 && 0 <= iv && iv <= 1 && ir >= EPSILON && iu + iv <= 1);
 	if (hasIntersection) {
 		nn.normalize();
-		intersectionPoint = Vertex (origin + ir*direction, v0.getNormal());
+		intersectionPoint = Vertex (origin + ir*direction, nn);
 	}
  
 	// We return true if the ray really intersects
@@ -189,30 +210,100 @@ bool Ray::intersect (const Vertex & v0, const Vertex & v1, const Vertex & v2, Ve
 }
 
 /**
- * Computes the intersection of a light ray and a triangle
+ * Computes the intersection of a light ray and a triangle of an object
  */
 bool Ray::intersect (const Object & object, const Triangle & tri, Vertex & intersectionPoint, float & ir, float & iu, float & iv) const {
-	Vertex v0 = object.getMesh().getVertices()[tri.getVertex(0)];
-	Vertex v1 = object.getMesh().getVertices()[tri.getVertex(1)];
-	Vertex v2 = object.getMesh().getVertices()[tri.getVertex(2)];
-	return intersect (v0, v1, v2, intersectionPoint, ir, iu, iv);
+	const Mesh & mesh = object.getMesh();
+	return intersect (object.toWorld (mesh.getVertexPos (tri.getVertex(0))), object.toWorld (mesh.getVertexPos (tri.getVertex(1))), object.toWorld (mesh.getVertexPos (tri.getVertex(2))), intersectionPoint, ir, iu, iv);
 }
 
 /**
- * Tests intersection with an object
+ * Tests intersection with an object. A placed object is tested in the
+ * coordinates of its shape, which other objects share.
  */
-bool Ray::intersect (const Object & object, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle) const {
+bool Ray::intersect (const Object & object, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered) const {
+	if (!object.isPlaced())
+		return intersect (object.getShape(), intersectionPoint, ir, iu, iv, triangle, entered);
+	if (!inShape (object).intersect (object.getShape(), intersectionPoint, ir, iu, iv, triangle, entered)) return false;
+	intersectionPoint.setPos (object.toWorld (intersectionPoint.getPos()));
+	return true;
+}
+
+/**
+ * Tests intersection with a shape, in its own coordinates
+ */
+bool Ray::intersect (const Shape & shape, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered) const {
+	if (shape.isOutOfCore())
+		return intersect (shape.getChunkedMesh(), intersectionPoint, ir, iu, iv, triangle, entered);
+
 	// Find KD-Tree node
-	const KDTreeNode* ktf = intersect (object.getKdTree(), intersectionPoint, ir, iu, iv, triangle);
+	const KDTreeNode* ktf = intersect (shape.getKdTree(), intersectionPoint, ir, iu, iv, triangle, entered);
 
 	// If not found return false
 	return (ktf != NULL);
 }
 
+/**
+ * Tests intersection with an out-of-core mesh. The hierarchy over its chunks
+ * is walked front to back, paging in the chunks of the leaves the ray enters,
+ * and skipping the nodes that start behind the closest hit.
+ */
+bool Ray::intersect (const ChunkedMesh & chunks, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered) const {
+	ir = INFINITY;
+	Vec3Df entry;
+	bool enteredRoot = chunks.getNumNodes() > 0 && intersect (chunks.getNode (0).bounds, entry);
+	if (entered != NULL) *entered = enteredRoot;
+	if (!enteredRoot) return false;
+
+	// Nodes entered and not visited yet, the nearest on top
+	struct Pending { unsigned int node; float distance; };
+	Pending pending[ChunkedMesh::MAX_PENDING_NODES];
+	unsigned int numPending = 0;
+	pending[numPending].node = 0;
+	pending[numPending++].distance = (entry - origin).getLength() / direction.getLength();
+
+	bool hasIntersection = false;
+	while (numPending > 0) {
+		Pending p = pending[--numPending];
+		if (p.distance > ir) continue;
+		const ChunkedMesh::Node & node = chunks.getNode (p.node);
+		if (node.isLeaf()) {
+			unsigned int c = node.first;
+			GeometryCache::Lock chunk (chunks.getCache(), chunks.getChunkId (c));
+			// The cache reported a chunk it cannot read: its triangles are missed
+			if (!chunk.isValid()) continue;
+			Vertex tmpPoint;
+			float tmpIr, tmpIu, tmpIv;
+			unsigned int tmpTriangle;
+			if (intersect (chunk->kdt.get(), tmpPoint, tmpIr, tmpIu, tmpIv, tmpTriangle) != NULL && tmpIr < ir) {
+				hasIntersection = true;
+				intersectionPoint = tmpPoint;
+				ir = tmpIr;
+				iu = tmpIu;
+				iv = tmpIv;
+				triangle = chunks.getFirstTriangle (c) + tmpTriangle;
+			}
+			continue;
+		}
+
+		Pending children[2];
+		unsigned int numChildren = 0;
+		unsigned int nodes[2] = { p.node + 1, node.right };
+		for (unsigned int n = 0; n < 2; n++)
+			if (intersect (chunks.getNode (nodes[n]).bounds, entry)) {
+				children[numChildren].node = nodes[n];
+				children[numChildren++].distance = (entry - origin).getLength() / direction.getLength();
+			}
+		if (numChildren == 2 && children[0].distance < children[1].distance) swap (children[0], children[1]);
+		for (unsigned int n = 0; n < numChildren; n++) pending[numPending++] = children[n];
+	}
+	return hasIntersection;
+}
+
 /**
  * Tests intersection with the scene
  */
-bool Ray::intersect (const Scene & scene, Vertex & intersectionPoint, const Object ** intersectionObject, float & ir, float & iu, float & iv, unsigned int & triangle) const {
+bool Ray::intersect (const RenderSnapshot & snapshot, Vertex & intersectionPoint, const Object ** intersectionObject, float & ir, float & iu, float & iv, unsigned int & triangle, ObjectSet * touched) const {
 	ir = INFINITY;
 	bool hasIntersection = false;
 
@@ -220,8 +311,12 @@ bool Ray::intersect (const Scene & scene, Vertex & intersectionPoint, const Obje
 	bool tmpIntersection = false;
 	Vertex tmpPoint;
 	unsigned int tritri;
-	for (vector<Object>::const_iterator obj = scene.getObjects().begin(); obj != scene.getObjects().end(); obj++) {
-		tmpIntersection = intersect (*obj, tmpPoint, tmpIr, tmpIu, tmpIv, tritri);
+	const vector<Object> & objects = snapshot.getObjects();
+	for (vector<Object>::const_iterator obj = objects.begin(); obj != objects.end(); obj++) {
+		// Whether the ray enters the object comes from the traversal itself
+		bool entered = false;
+		tmpIntersection = intersect (*obj, tmpPoint, tmpIr, tmpIu, tmpIv, tritri, touched != NULL ? &entered : NULL);
+		if (entered) touched->insert (obj - objects.begin());
 			if (tmpIntersection){
 			{
 				hasIntersection = true;
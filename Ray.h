@@ -17,6 +17,8 @@
 #include "BoundingBox.h"
 #include "KDTreeNode.hpp"
 #include "Scene.h"
+#include "RenderSnapshot.hpp"
+#include "ObjectSet.hpp"
 
 using namespace std;
 
@@ -32,19 +34,33 @@ public:
     inline const Vec3Df & getDirection () const { return direction; }
     inline Vec3Df & getDirection () { return direction; }
 
-		const KDTreeNode* intersect (const KDTreeNode* kdtree, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle) const;
+		// The same ray in the coordinates of the shape of object, its direction scaled along with it so that the
+		// distances to the hits stay the same
+		inline Ray inShape (const Object & object) const {
+			return Ray (object.toShape (origin), direction / object.getPlacement().scale);
+		}
+
+		// Leaf of kdtree holding the closest hit. If entered is not NULL, it tells whether the ray enters the bounds of the tree,
+		// from the tests of its traversal.
+		const KDTreeNode* intersect (const KDTreeNode* kdtree, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered = NULL) const;
 
     bool intersect (const BoundingBox & bbox, Vec3Df & intersectionPoint) const;
 		bool intersectFuzzy (const BoundingBox & bbox, Vec3Df & intersectionPoint) const;
 		bool intersect (const Vertex & v0, const Vertex & v1, const Vertex & v2, Vertex & intersectionPoint, float & ir, float & iu, float & iv) const;
+		bool intersect (const Vec3Df & p0, const Vec3Df & p1, const Vec3Df & p2, Vertex & intersectionPoint, float & ir, float & iu, float & iv) const;
 		bool intersect (const Object & object, const Triangle & tri, Vertex & intersectionPoint, float & ir, float & iu, float & iv) const;
-		bool intersect (const Object & object, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle) const;
-		bool intersect (const Scene & scene, Vertex & intersectionPoint, const Object ** intersectionObject, float & ir, float & iu, float & iv, unsigned int & triangle) const;
+		// Closest hit on object, and whether the ray enters its bounds if entered is not NULL
+		bool intersect (const Object & object, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered = NULL) const;
+		// Same in the coordinates of a shape, through its kD-tree unless it is out of core
+		bool intersect (const Shape & shape, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered = NULL) const;
+		bool intersect (const ChunkedMesh & chunks, Vertex & intersectionPoint, float & ir, float & iu, float & iv, unsigned int & triangle, bool * entered = NULL) const;
+		// Closest hit in the scene of a snapshot. If touched is not NULL, the objects whose bounds the ray enters are added to it.
+		bool intersect (const RenderSnapshot & snapshot, Vertex & intersectionPoint, const Object ** intersectionObject, float & ir, float & iu, float & iv, unsigned int & triangle, ObjectSet * touched = NULL) const;
     
 private:
     Vec3Df origin;
     Vec3Df direction;
-		const static float EPSILON = 1e-3f;
+		static constexpr float EPSILON = 1e-3f;
 };
 
 
@@ -6,16 +6,41 @@
 // *********************************************************
 
 #include "RayTracer.h"
+#include <cstring>
+#include <stdint.h>
 #include "Ray.h"
 #include "Scene.h"
+#include "TextureCache.hpp"
+#include "TileScheduler.hpp"
+#include "TaskPool.hpp"
+#include "SceneGenerator.hpp"
 
 #define NB_RAY 64
 
+// Most rays per pixel added by a single progressive pass
+static const unsigned int MAX_PASS_SAMPLES = 4;
+
+// Smallest part of a pixel worth tracing a reflected or refracted ray for
+static const float MIN_CONTRIBUTION = 0.01f;
+
+// Adaptive anti-aliasing: rays per pixel at first, added at once, and at most
+static const unsigned int MIN_ADAPTIVE_SAMPLES = 4;
+static const unsigned int ADAPTIVE_BATCH = 4;
+static const unsigned int MAX_ADAPTIVE_SAMPLES = 16;
+
+// Largest standard error of the luminance of a pixel, relative to its
+// luminance plus ADAPTIVE_BLACK, so that dark pixels need less absolute
+// precision than bright ones, without dividing by zero
+static const float ADAPTIVE_THRESHOLD = 0.02f;
+static const float ADAPTIVE_BLACK = 0.05f;
+
 static RayTracer * instance = NULL;
 
 RayTracer * RayTracer::getInstance () {
-    if (instance == NULL)
+    if (instance == NULL) {
         instance = new RayTracer ();
+        instance->updateScene ();
+    }
     return instance;
 }
 
@@ -26,14 +51,134 @@ void RayTracer::destroyInstance () {
     }
 }
 
+/**
+ * i-th term of the van der Corput sequence in base b, in [0, 1)
+ */
+static float radicalInverse (unsigned int i, unsigned int b) {
+	float inverse = 0.f, scale = 1.f / b;
+	for (; i > 0; i /= b, scale /= b) inverse += (i % b) * scale;
+	return inverse;
+}
+
+/**
+ * Offset of the s-th ray of a pixel from its centre along one axis, in
+ * [-0.5, 0.5): the van der Corput sequence in base b shifted by half a
+ * pixel, modulo one pixel, so that the first ray goes through the centre
+ * and the mean of the first rays stays near it
+ */
+static float pixelOffset (unsigned int s, unsigned int b) {
+	float u = radicalInverse (s, b) + 0.5f;
+	return (u >= 1.f ? u - 1.f : u) - 0.5f;
+}
+
+static inline float luminance (const Vec3Df & c) {
+	return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+static bool sameLights (const vector<Light> & a, const vector<Light> & b) {
+	if (a.size() != b.size()) return false;
+	for (unsigned int l = 0; l < a.size(); l++)
+		if (a[l].getPos() != b[l].getPos() || a[l].getColor() != b[l].getColor() || a[l].getRadius() != b[l].getRadius()
+			|| a[l].getOrientation() != b[l].getOrientation() || a[l].getIntensity() != b[l].getIntensity())
+			return false;
+	return true;
+}
+
+void RayTracer::requestRender (const Camera & c, const QRect & r) {
+	QMutexLocker locker (&requestMutex);
+	requestedCamera = c;
+	requestedRegion = r;
+	hasRequest = true;
+	generation.fetch_add (1, memory_order_release);
+	if (!looping) {
+		// run may still be returning after its last render
+		looping = true;
+		wait ();
+		start ();
+	}
+}
+
+bool RayTracer::getFinishedCamera (Camera & c) {
+	QMutexLocker locker (&requestMutex);
+	if (hasFinished) c = finishedCamera;
+	return hasFinished;
+}
+
+void RayTracer::invalidateObject (int o) {
+	QMutexLocker locker (&requestMutex);
+	editedObjects.insert (o);
+}
+
+shared_ptr<const RenderSnapshot> RayTracer::getSnapshot () {
+	QMutexLocker locker (&snapshotMutex);
+	return snapshot;
+}
+
+void RayTracer::updateScene () {
+	Scene * scene = Scene::getInstance ();
+	QMutexLocker locker (&snapshotMutex);
+	if (!sameLights (snapshot->getLights(), scene->getLights())) snapshot = snapshot->withLights (scene->getLights());
+	snapshot = snapshot->withObjects (scene->getObjects());
+}
+
+void RayTracer::stop () {
+	stopRequested = true;
+	bool progressive;
+	{
+		QMutexLocker locker (&snapshotMutex);
+		progressive = running && running->getOptions().progressive;
+	}
+	if (!progressive) cancel ();
+}
+
+void RayTracer::cancel () {
+	QMutexLocker locker (&requestMutex);
+	hasRequest = false;
+	generation.fetch_add (1, memory_order_release);
+}
+
+void RayTracer::run () {
+	cout << " (I) RayTracer: Starting thread" << endl;
+	for (;;) {
+		{
+			QMutexLocker locker (&requestMutex);
+			if (!hasRequest) {
+				looping = false;
+				break;
+			}
+			cam = requestedCamera;
+			region = requestedRegion;
+			hasRequest = false;
+			hasFinished = false;
+		}
+
+		// Initialize everything listening to the raytracer status
+		emit init (0, cam.screenWidth());
+
+		// Render image, unless a newer request cancels it
+		QImage image = render ();
+		if (image.isNull ()) continue;
+		renderedimage = image;
+		{
+			QMutexLocker locker (&requestMutex);
+			finishedCamera = cam;
+			hasFinished = true;
+		}
+
+		// Signal the listeners the image is ready!
+		emit finished (renderedimage);
+	}
+	cout << " (I) RayTracer: End of thread" << endl;
+}
+
 inline int clamp (float f, int inf, int sup) {
     int v = static_cast<int> (f);
     return (v < inf ? inf : (v > sup ? sup : v));
 }
 
-Vec3Df RayTracer::getColor (const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints) {
-	Vec3Df diffuseSelf,specularSelf;
-	Vec3Df c = mat.getColor();
+Vec3Df RayTracer::getColor (const RenderSnapshot & snapshot, const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, LightTerms * terms, ObjectSet * touched) {
+	Vec3Df color;
+	Vec3Df c = mat.getColor (point, normal, pixelFootprint (eye, point));
 	Vec3Df vv = eye - point;
 	Vec3Df lpos, lm;
 	Light light;
@@ -48,8 +193,10 @@ Vec3Df RayTracer::getColor (const Vec3Df & eye, const Vec3Df & point, const Vec3
 	const Object* intersectionObject;
 	double visibility;
 
-	for (unsigned int j = 0; j < Scene::getInstance()->getLights().size(); j++) {
-		light = Scene::getInstance()->getLights()[j];
+	const vector<Light> & lights = snapshot.getLights();
+	for (unsigned int j = 0; j < lights.size(); j++) {
+		if (terms != NULL && !terms->active[j]) continue;
+		light = lights[j];
 		lpos = cam.toWorld (light.getPos());
 		//lpos = light->getPos();
 		lm = lpos - point;
@@ -62,12 +209,12 @@ Vec3Df RayTracer::getColor (const Vec3Df & eye, const Vec3Df & point, const Vec3
 			// Test Occlusion
 			oc_dir=rand_lpoints[i][j]-point;	
 			Ray oc_ray (point, oc_dir);
-			occlusion = (oc_ray.intersect(*Scene::getInstance(), tmp, &intersectionObject, ir, iu_tmp, iv_tmp, tri_tmp)) && (ir<oc_dir.getLength());
+			occlusion = (oc_ray.intersect(snapshot, tmp, &intersectionObject, ir, iu_tmp, iv_tmp, tri_tmp, touched)) && (ir<oc_dir.getLength());
 
 			if (occlusion && (ir <0.000001)) {
 				//cout<<"Je m'auto intersecte"<<ir<<endl;
 				Ray oc_ray2(point+ oc_dir*(ir + 0.000001), oc_dir);
-				occlusion = (oc_ray2.intersect(*Scene::getInstance(), tmp, &intersectionObject, ir, iu_tmp, iv_tmp, tri_tmp)) && (ir<oc_dir.getLength());
+				occlusion = (oc_ray2.intersect(snapshot, tmp, &intersectionObject, ir, iu_tmp, iv_tmp, tri_tmp, touched)) && (ir<oc_dir.getLength());
 			}
 
 			if (occlusion) {
@@ -84,34 +231,39 @@ Vec3Df RayTracer::getColor (const Vec3Df & eye, const Vec3Df & point, const Vec3
 
 		// Diffuse Light
 		float sc = Vec3D<float>::dotProduct(lm, normal);
-		diffuseSelf += light.getColor() * fabs (sc);
+		Vec3Df response = mat.getDiffuse() * fabs (sc) * c;
 
 		// Specular Light
 		sc = Vec3D<float>::dotProduct(normal*sc*2.f-lm, vv);
 		if (sc > 0.) {
 			sc = pow (sc, mat.getShininess() * 40.f);
-			specularSelf += light.getColor() * sc;
+			response += Vec3Df (1.f, 1.f, 1.f) * (mat.getSpecular() * sc);
 		}
-	}
 
-	// Total color blend
-	c[0] = (mat.getDiffuse()*c[0]*diffuseSelf[0] + mat.getSpecular()*specularSelf[0])*visibility;
-	c[1] = (mat.getDiffuse()*c[1]*diffuseSelf[1] + mat.getSpecular()*specularSelf[1])*visibility;
-	c[2] = (mat.getDiffuse()*c[2]*diffuseSelf[2] + mat.getSpecular()*specularSelf[2])*visibility;
-	return c;
+		// Total color blend, each light shadowed by its own visibility
+		response *= visibility;
+		color += light.getColor() * response;
+		if (terms != NULL) terms->response[j] = response;
+	}
+	return color;
 }
 
 
-Vec3Df RayTracer::lightModel (const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints) {
-	Vec3Df cdirect = getColor (eye, point, normal, mat, nb_iter, rand_lpoints);
+Vec3Df RayTracer::lightModel (const RenderSnapshot & snapshot, const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, LightTerms * terms, ObjectSet * touched) {
+	Vec3Df cdirect = getColor (snapshot, eye, point, normal, mat, nb_iter, rand_lpoints, terms, touched);
 	Vec3Df cindirect;
 	Vec3Df diffuseSelf,specularSelf;
-	Vec3Df c = mat.getColor();
+	Vec3Df c = mat.getColor (point, normal, pixelFootprint (eye, point));
 	Vec3Df vv = eye - point;
 	Vec3Df lpos, lm;
 	vv.normalize();
 	float ff = 0.f;
 
+	// Indirect response to each light, through the responses of the surfels
+	vector<Vec3Df> none;
+	vector<Vec3Df> & indirect = (terms != NULL) ? terms->indirect : none;
+	if (terms != NULL) indirect.assign (terms->response.size(), Vec3Df ());
+
 	for (vector<Surfel>::const_iterator surfel = pc.getSurfels().begin(); surfel != pc.getSurfels().end(); surfel++) {
 		ff += (surfel->getRadius()*surfel->getRadius());
 		lpos = surfel->getPosition();
@@ -120,13 +272,21 @@ Vec3Df RayTracer::lightModel (const Vec3Df & eye, const Vec3Df & point, const Ve
 
 		// Diffuse Light
 		float sc = Vec3D<float>::dotProduct(lm, normal);
-		diffuseSelf += surfel->getColor() * fabs (sc);
+		float diffuse = fabs (sc), specular = 0.f;
+		diffuseSelf += surfel->getColor() * diffuse;
 
 		// Specular Light
 		sc = Vec3D<float>::dotProduct(normal*sc*2.f-lm, vv);
 		if (sc > 0.) {
-			sc = pow (sc, mat.getShininess() * 40.f);
-			specularSelf += surfel->getColor() * sc;
+			specular = pow (sc, mat.getShininess() * 40.f);
+			specularSelf += surfel->getColor() * specular;
+		}
+
+		if (terms != NULL) {
+			unsigned int s = surfel - pc.getSurfels().begin();
+			Vec3Df response = mat.getDiffuse() * diffuse * c + Vec3Df (1.f, 1.f, 1.f) * (mat.getSpecular() * specular);
+			for (unsigned int l = 0; l < indirect.size(); l++)
+				if (terms->active[l]) indirect[l] += pc.getResponse (s, l) * response;
 		}
 	}
 
@@ -139,6 +299,9 @@ Vec3Df RayTracer::lightModel (const Vec3Df & eye, const Vec3Df & point, const Ve
 	if (pc.getSurfels().size() !=0){
 	c = (cindirect + cdirect) / 2.f;
 	//Vec3Df c = cdirect;
+	if (terms != NULL)
+		for (unsigned int l = 0; l < indirect.size(); l++)
+			if (terms->active[l]) terms->response[l] = (indirect[l] / ff + terms->response[l]) / 2.f;
 	}
 	else c=cdirect;
 
@@ -152,68 +315,124 @@ Vec3Df RayTracer::lightModel (const Vec3Df & eye, const Vec3Df & point, const Ve
 	return c;
 }
 
-Vec3Df RayTracer::lightBounce (const Vec3Df & eye, const Vec3Df & dir, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, int d, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints) {
-	// If no refraction, or depth too big, return classic light model
-	if (d >= depth) return lightModel (eye, point, normal, mat, pc, debug, nb_iter, rand_lpoints);
-	if (debug) cout << " (I) Bounce depth " << d << endl;
-	if (debug) cout << " (I) For point " << point << endl;
+/**
+ * Ray waiting on the stack of lightBounce, with the part of the pixel
+ * colour it carries
+ */
+struct PendingRay {
+	Vec3Df origin, direction;
+	float weight;
+	int depth;
+};
 
-	// Prepare color variables
-	Vec3Df dirRefr, dirRefl;
-	Vec3Df colRefr, colRefl, colSelf;
-	Ray ray;
-	const Object* intersectionObject;
-	unsigned int triangle;
-	float ir, iu, iv;
-	Vertex intersectionPoint;
-	bool hasIntersection;
-
-	// Get color from self lighting
-	colSelf   = lightModel (eye, point, normal, mat, pc, debug, nb_iter, rand_lpoints);
-
-	// Compute refraction/reflection vector
-	bool refract = dir.bounce (mat.getIOR(), normal, dirRefr, dirRefl);
-
-	// Compute refracted ray
-	if (refract && mat.getIOR() != 1.f && mat.getRefract() > 0.f) {
-		ray = Ray (point, dirRefr);
-		intersectionObject = NULL;
-		hasIntersection = ray.intersect (*Scene::getInstance(), intersectionPoint, &intersectionObject, ir, iu, iv, triangle);
-
-		if (!hasIntersection) {
-			colRefr = backgroundColor;
-		} else {
-			// Get color from bouncing, and compute next normal
-			Vec3Df p0 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (0)].getNormal();
-			Vec3Df p1 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (1)].getNormal();
-			Vec3Df p2 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (2)].getNormal();
-			Vec3Df nor = (1-iu-iv)*p0 + iv*p1 + iu*p2;
-			nor.normalize();
-			colRefr = lightBounce (point, dirRefr, intersectionPoint.getPos(), nor, intersectionObject->getMaterial(), pc, debug, d+1, nb_iter, rand_lpoints);
-		}
+/**
+ * Next number of a xorshift sequence, in [0, 1)
+ */
+static inline float nextRandom (uint32_t & state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state >> 8) * (1.f / 16777216.f);
+}
+
+Vec3Df RayTracer::lightBounce (const RenderSnapshot & snapshot, const Vec3Df & eye, const Vec3Df & dir, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, int d, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, LightTerms * terms, ObjectSet * touched) {
+	// The ray tree is walked depth first with a stack of rays instead of
+	// recursion. Each ray carries the product of the reflection and
+	// refraction factors along its branch, which is what it adds to the
+	// pixel: branches worth less than MIN_CONTRIBUTION are not traced at
+	// all, or, with Russian roulette, traced with a probability proportional
+	// to their weight and weighted up to keep the same mean.
+	const RenderSnapshot::Options & options = snapshot.getOptions();
+	Vec3Df c;
+	vector<PendingRay> stack;
+	stack.reserve (2 * max (options.depth, 1));
+
+	// Roulette draws are seeded by the direction of the ray, so that a given
+	// ray always gets the same colour
+	uint32_t state = 2166136261u;
+	for (unsigned int k = 0; k < 3; k++) {
+		uint32_t bits;
+		memcpy (&bits, &dir[k], sizeof (bits));
+		state = (state ^ bits) * 16777619u;
+	}
+	if (state == 0) state = 1;
+
+	// Parts of the colour of each point, added to terms with its weight
+	LightTerms * local = NULL;
+	if (terms != NULL) {
+		if (!terms->point) terms->point.reset (new LightTerms (terms->response.size()));
+		local = terms->point.get();
+		local->active = terms->active;
 	}
 
-	// Compute reflected ray
-	if (mat.getReflect() > 0.f) {
-		ray = Ray (point, dirRefl);
-		intersectionObject = NULL;
-		hasIntersection = ray.intersect (*Scene::getInstance(), intersectionPoint, &intersectionObject, ir, iu, iv, triangle);
-
-		if (!hasIntersection) {
-			colRefl = backgroundColor;
-		} else {
-			// Get color from bouncing, and compute next normal
-			Vec3Df p0 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (0)].getNormal();
-			Vec3Df p1 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (1)].getNormal();
-			Vec3Df p2 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (2)].getNormal();
-			Vec3Df nor = (1-iu-iv)*p0 + iv*p1 + iu*p2;
-			nor.normalize();
-			colRefl = lightBounce (point, dirRefl, intersectionPoint.getPos(), nor, intersectionObject->getMaterial(), pc, debug, d+1, nb_iter, rand_lpoints);
+	Vec3Df from = eye, incoming = dir, at = point, nor = normal;
+	const Material * m = &mat;
+	float weight = 1.f;
+	for (;;) {
+		if (debug) cout << " (I) Bounce depth " << d << endl;
+		if (debug) cout << " (I) For point " << at << endl;
+
+		// Color from self lighting
+		float self = (d >= options.depth) ? weight : weight * (1.f - m->getRefract());
+		if (d >= options.depth || m->getRefract() != 1.f) {
+			c += self * lightModel (snapshot, from, at, nor, *m, pc, debug, nb_iter, rand_lpoints, local, touched);
+			if (terms != NULL)
+				for (unsigned int l = 0; l < local->response.size(); l++)
+					if (local->active[l]) terms->response[l] += self * local->response[l];
+		}
+		if (d < options.depth) {
+			// Compute refraction/reflection vector
+			Vec3Df dirRefr, dirRefl;
+			bool refract = incoming.bounce (m->getIOR(), nor, dirRefr, dirRefl);
+			PendingRay children[2];
+			unsigned int numChildren = 0;
+			if (refract && m->getIOR() != 1.f && m->getRefract() > 0.f) {
+				PendingRay r = { at, dirRefr, weight * m->getRefract(), d + 1 };
+				children[numChildren++] = r;
+			}
+			if (m->getReflect() > 0.f) {
+				PendingRay r = { at, dirRefl, weight * m->getReflect(), d + 1 };
+				children[numChildren++] = r;
+			}
+			for (unsigned int k = 0; k < numChildren; k++) {
+				PendingRay & r = children[k];
+				if (r.weight < MIN_CONTRIBUTION) {
+					if (!options.russianRoulette || nextRandom (state) * MIN_CONTRIBUTION >= r.weight) {
+						if (debug) cout << " (I) Pruned branch of weight " << r.weight << endl;
+						continue;
+					}
+					r.weight = MIN_CONTRIBUTION;
+				}
+				stack.push_back (r);
+			}
 		}
-	}
 
-	// Total color blend
-	Vec3Df c = colRefl*mat.getReflect() + colRefr*mat.getRefract() + colSelf*(1.f-mat.getRefract());
+		// Next ray that hits something
+		bool hit = false;
+		while (!hit && !stack.empty()) {
+			PendingRay r = stack.back();
+			stack.pop_back();
+			Ray ray (r.origin, r.direction);
+			const Object * intersectionObject = NULL;
+			Vertex intersectionPoint;
+			unsigned int triangle;
+			float ir, iu, iv;
+			if (!ray.intersect (snapshot, intersectionPoint, &intersectionObject, ir, iu, iv, triangle, touched)) {
+				c += r.weight * options.background;
+				if (terms != NULL) terms->background += r.weight;
+				continue;
+			}
+			from = r.origin;
+			incoming = r.direction;
+			at = intersectionPoint.getPos();
+			nor = intersectionObject->interpolateNormal (triangle, iu, iv);
+			m = &intersectionObject->getMaterial();
+			weight = r.weight;
+			d = r.depth;
+			hit = true;
+		}
+		if (!hit) break;
+	}
 
 	if (debug) {
 		cout << "     [ Total color blend ]" << endl;
@@ -221,17 +440,13 @@ Vec3Df RayTracer::lightBounce (const Vec3Df & eye, const Vec3Df & dir, const Vec
 		cout << "       Computed Clamped Color: (" << clamp (c[0]*255.,0,255) << ", " << clamp (c[1]*255.,0,255) << ", " << clamp (c[2]*255.,0,255) << ")" << endl << endl;
 	}
 
-	c.scale (1.f);
 	return c;
 }
 
 /**
  * Raytrace a single point
  */
-Vec3Df RayTracer::raytraceSingle (const PointCloud & pc, float i, float j, bool debug, BoundingBox & bb, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints) {
-	Scene * scene = Scene::getInstance ();
-	
-	const Vec3Df camPos = cam.position();
+Vec3Df RayTracer::primaryDirection (float i, float j) const {
 	const Vec3Df direction = cam.viewDirection();
 	const Vec3Df upVector = cam.upVector();
 	const Vec3Df rightVector = cam.rightVector();
@@ -247,6 +462,12 @@ Vec3Df RayTracer::raytraceSingle (const PointCloud & pc, float i, float j, bool
 	Vec3Df step = stepX + stepY;
 	Vec3Df dir = direction + step;
 	dir.normalize();
+	return dir;
+}
+
+Vec3Df RayTracer::raytraceSingle (const RenderSnapshot & snapshot, const PointCloud & pc, float i, float j, bool debug, BoundingBox & bb, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, GBuffer::Hit * hit, LightTerms * terms, ObjectSet * touched) {
+	const Vec3Df camPos = cam.position();
+	Vec3Df dir = primaryDirection (i, j);
 	if (debug) {
 		cout << "     [ Basic Information ]" << endl;
 		cout << "       Ray Direction: " << dir << endl << endl;
@@ -257,14 +478,18 @@ Vec3Df RayTracer::raytraceSingle (const PointCloud & pc, float i, float j, bool
 	const Object* intersectionObject = NULL;
 	unsigned int triangle;
 	float ir, iu, iv;
-	bool hasIntersection = ray.intersect (*scene, intersectionPoint, &intersectionObject, ir, iu, iv, triangle);
+	bool hasIntersection = ray.intersect (snapshot, intersectionPoint, &intersectionObject, ir, iu, iv, triangle, touched);
 	if (debug) {
 		cout << "     [ kD-Tree ]" << endl;
 		float f,fu,fv;
 		Vertex vd;
-		const KDTreeNode* kdt = ray.intersect (Scene::getInstance()->getObjects()[1].getKdTree(), vd, f, fu, fv, triangle);
+		const KDTreeNode* kdt = NULL;
+		if (snapshot.getObjects().size() > 1) {
+			const Object & o = snapshot.getObjects()[1];
+			kdt = ray.inShape (o).intersect (o.getKdTree(), vd, f, fu, fv, triangle);
+			if (kdt != NULL) bb = BoundingBox (o.toWorld (kdt->getBoundingBox().getMin()), o.toWorld (kdt->getBoundingBox().getMax()));
+		}
 		if (kdt != NULL) {
-			bb = kdt->getBoundingBox();
 			cout << "       Point distance: " << f << endl;
 			for (vector<unsigned int>::const_iterator it = kdt->getTriangles().begin(); it != kdt->getTriangles().end(); it++) cout << "       Triangle: " << *it << endl;
 		} else cout << "       Not found... ;(" << endl;
@@ -274,57 +499,46 @@ Vec3Df RayTracer::raytraceSingle (const PointCloud & pc, float i, float j, bool
 		if (debug) {
 			cout << "     [ Intersection ]" << endl;
 			cout << "       Intersection with " << intersectionPoint.getPos() << endl;
-			cout << "       Object number of triangles: " << intersectionObject->getMesh().getTriangles().size() << endl;
+			cout << "       Object number of triangles: " << intersectionObject->getMesh().getNumTriangles() << endl;
 			cout << "       Intersection with triangle: " << triangle << endl;
 			cout << "       Material: " << intersectionObject->getMaterial() << endl << endl;
 		}
 
-		Vec3Df p0 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (0)].getNormal();
-		Vec3Df p1 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (1)].getNormal();
-		Vec3Df p2 = intersectionObject->getMesh().getVertices()[intersectionObject->getMesh().getTriangles()[triangle].getVertex (2)].getNormal();
-		Vec3Df normal = (1-iu-iv)*p0 + iv*p1 + iu*p2;
-		normal.normalize();
+		Vec3Df normal = intersectionObject->interpolateNormal (triangle, iu, iv);
+		if (hit != NULL) {
+			hit->object = intersectionObject - &snapshot.getObjects()[0];
+			hit->position = intersectionPoint.getPos();
+			hit->normal = normal;
+		}
 
-		return lightBounce (camPos, dir, intersectionPoint.getPos(), normal, intersectionObject->getMaterial(), pc, debug, 0, nb_iter, rand_lpoints);
+		return lightBounce (snapshot, camPos, dir, intersectionPoint.getPos(), normal, intersectionObject->getMaterial(), pc, debug, 0, nb_iter, rand_lpoints, terms, touched);
 	} else {
 		if (debug) cout << "     [ No intersection ]" << endl << endl;
-		return backgroundColor;
+		if (hit != NULL) hit->object = -1;
+		if (terms != NULL) terms->background += 1.f;
+		return snapshot.getOptions().background;
 	}
 }
 
-/**
- * Renders the given scene with the given camera parameters into a QImage, and returns it.
- */
-QImage RayTracer::render () {
-	// Count elapsed time
-	cout << " (R) Generating point cloud..." << endl;
-	PointCloud pc;
-	
-	for (vector<Object>::iterator it = Scene::getInstance()->getObjects().begin(); it != Scene::getInstance()->getObjects().end(); it++) {
-		it->getMesh().recomputeSmoothVertexNormals(1);
-		pc.add (*it, cam);
+Vec3Df RayTracer::reshadeSingle (const RenderSnapshot & snapshot, const PointCloud & pc, float i, float j, const GBuffer::Hit & hit, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, LightTerms * terms, ObjectSet * touched) {
+	if (hit.object < 0) {
+		if (terms != NULL) terms->background += 1.f;
+		return snapshot.getOptions().background;
 	}
+	const Object & object = snapshot.getObjects()[hit.object];
+	if (touched != NULL) touched->insert (hit.object);
+	return lightBounce (snapshot, cam.position(), primaryDirection (i, j), hit.position, hit.normal, object.getMaterial(), pc, false, 0, nb_iter, rand_lpoints, terms, touched);
+}
 
-	QTime timer;
-	timer.start();
-
-	cout << " (R) Raytracing: Start" << endl;
-
-	//for (vector<Object>::iterator it = Scene::getInstance()->getObjects().begin(); it != Scene::getInstance()->getObjects().end(); it++) it->getKdTree()->show();
-	// Create an image to hold the final raytraced render
-	QImage image (QSize (cam.screenWidth(), cam.screenHeight()), QImage::Format_RGB888);
-
-	// For each camera pixel, cast a ray and compute its reflecting color
-	BoundingBox b;
-	
-	Scene * scene = Scene::getInstance ();
-
-	unsigned int nb_iter = NB_RAY;
-	vector <vector<Vec3Df> > rand_lpoints(nb_iter, vector<Vec3Df>(scene->getLights().size(), Vec3Df(0.f,0.f,0.f)));
+vector<vector<Vec3Df> > RayTracer::lightPoints (const vector<Light> & lights, unsigned int & nb_iter) const {
+	nb_iter = NB_RAY;
+	vector <vector<Vec3Df> > rand_lpoints(nb_iter, vector<Vec3Df>(lights.size(), Vec3Df(0.f,0.f,0.f)));
 
-	for (vector<Light>::iterator light = scene->getLights().begin(); light != scene->getLights().end(); light++) {
-		
-		int num_light=0;
+	// The same points on the lights for every render, so that a region
+	// rendered again matches the image around it
+	SceneGenerator generator;
+	unsigned int num_light=0;
+	for (vector<Light>::const_iterator light = lights.begin(); light != lights.end(); light++) {
 		Vec3Df lpos = cam.toWorld (light->getPos());
 		float lrad= light->getRadius();
 		Vec3Df lor= cam.toWorld (light->getOrientation());
@@ -336,8 +550,8 @@ QImage RayTracer::render () {
 		rand_lpoints[0][num_light]=lpos;
 
 		for(unsigned int j=1;j<nb_iter;j++){
-			double rand_rad =((double)rand() / ((double)RAND_MAX + 1) * lrad);
-			double rand_ang =((double)rand() / ((double)RAND_MAX + 1) * 2 * PI);
+			double rand_rad = generator.uniform() * lrad;
+			double rand_ang = generator.uniform() * 2 * PI;
 				
 			Vec3Df v0 (0.0f, -lor[2], lor[1]);
 			Vec3Df v1 (lor[1]*lor[1]+lor[2]*lor[2], -lor[0]*lor[1], -lor[0]*lor[2]);
@@ -348,98 +562,387 @@ QImage RayTracer::render () {
 		}
 		num_light++;
 	} 
+	return rand_lpoints;
+}
 
-	if (b.getAliasing()==1){
-#pragma omp parallel for default(shared) schedule(dynamic)
+void RayTracer::addLightTerms (unsigned int x, unsigned int y, LightTerms & terms, bool background) {
+	for (unsigned int l = 0; l < terms.response.size(); l++)
+		if (terms.active[l]) lightResponses[l].add (x, y, terms.response[l]);
+	if (background) backgroundResponse.add (x, y, Vec3Df (terms.background, terms.background, terms.background));
+	terms.clear ();
+}
 
+/**
+ * Renders the given scene with the given camera parameters into a QImage, and returns it.
+ * Returns a null image if the render is cancelled.
+ */
+QImage RayTracer::render () {
+	unsigned int token = generation.load (memory_order_acquire);
+	TaskPool * pool = TaskPool::getInstance ();
+	Scene * scene = Scene::getInstance ();
 
-		for (unsigned int i = 0; i < 2*(unsigned int)cam.screenWidth(); i++) {
-			emit progress (i/2);
+	// The whole render reads this snapshot, whatever the user changes
+	// meanwhile: changes go to the next one
+	shared_ptr<const RenderSnapshot> current;
+	{
+		QMutexLocker locker (&snapshotMutex);
+		current = running = snapshot;
+	}
+	const RenderSnapshot & snapshot = *current;
+	const RenderSnapshot::Options & options = snapshot.getOptions();
+	const vector<Object> & objects = snapshot.getObjects();
+	const vector<Light> & lights = snapshot.getLights();
+	const Vec3Df & backgroundColor = options.background;
+
+	unsigned int nb_iter;
+	vector <vector<Vec3Df> > rand_lpoints = lightPoints (lights, nb_iter);
+
+	// Sub-pixel offsets of the rays, from the Halton sequence shifted so that
+	// it starts at the centre of the pixel, which it fills evenly whenever it
+	// stops. With
+	// anti-aliasing, each pixel gets MIN_ADAPTIVE_SAMPLES rays, then more
+	// while the error estimated from their variance is too large: edges and
+	// reflections get up to MAX_ADAPTIVE_SAMPLES rays, and flat areas few.
+	unsigned int width = cam.screenWidth(), height = cam.screenHeight();
+	bool adaptive = options.antiAliasing && !options.progressive;
+	unsigned int totalSamples = options.progressive ? options.samples : 1;
+	vector<pair<float, float> > offsets;
+	for (unsigned int s = 0; s < (adaptive ? MAX_ADAPTIVE_SAMPLES : totalSamples); s++)
+		offsets.push_back (make_pair (pixelOffset (s, 2), pixelOffset (s, 3)));
+
+	// A region is rendered over the previous image, if there is one to keep
+	QRect area = region.isNull () ? QRect (0, 0, width, height) : region.intersected (QRect (0, 0, width, height));
+	bool wholeImage = (area == QRect (0, 0, width, height));
+
+	// Objects edited since the last render. If the last whole image had the
+	// same view and shading, only the tiles whose rays entered them are
+	// rendered again, over the rest of the image: as long as the edited
+	// objects stay within their former bounds, no other ray can reach them.
+	// Otherwise the whole image is traced again.
+	unsigned int version = sceneVersion.load (memory_order_acquire);
+	unsigned int tilesX = (width + TileScheduler::TILE_SIZE - 1) / TileScheduler::TILE_SIZE, tilesY = (height + TileScheduler::TILE_SIZE - 1) / TileScheduler::TILE_SIZE;
+	ObjectSet edited;
+	{
+		QMutexLocker locker (&requestMutex);
+		edited.swap (editedObjects);
+	}
+	vector<TileScheduler::Tile> dirtyTiles;
+	bool incremental = false;
+	if (!edited.empty ()) {
+		incremental = tileObjectsValid && wholeImage && gbufferValid && gbufferVersion == version && gbufferCamera.sameView (cam)
+			&& gbufferAdaptive == adaptive && gbufferSamples == totalSamples && (!options.lightAOVs || aovValid)
+			&& tileDepth == options.depth && tileRoulette == options.russianRoulette && tileBackground == backgroundColor && sameLights (tileLights, lights)
+			&& tileObjects.size() == tilesX * tilesY && tileObjectBounds.size() == objects.size();
+		for (unsigned int o = 0; incremental && o < objects.size(); o++)
+			if (edited.contains (o))
+				incremental = tileObjectBounds[o].contains (objects[o].getBoundingBox().getMin()) && tileObjectBounds[o].contains (objects[o].getBoundingBox().getMax());
+		for (unsigned int t = 0; incremental && t < tileObjects.size(); t++)
+			if (tileObjects[t].intersects (edited)) {
+				TileScheduler::Tile tile = { (t % tilesX) * TileScheduler::TILE_SIZE, (t / tilesX) * TileScheduler::TILE_SIZE, 0, 0 };
+				tile.width = min (TileScheduler::TILE_SIZE, width - tile.x);
+				tile.height = min (TileScheduler::TILE_SIZE, height - tile.y);
+				dirtyTiles.push_back (tile);
+			}
 
-			for (unsigned int j = 0; j < 2*(unsigned int)cam.screenHeight(); j++) {
-				// Raytrace
+		// The hits of the other tiles are still right, and those of the edited
+		// objects are traced again: the G-buffer is valid again afterwards
+		gbufferValid = false;
+	}
 
-				if ((i%2==0)&&(j%2==0)){
-					Vec3Df c1 = raytraceSingle (pc/*PointCloud()*/, (float)i/2.0f, (float)j/2.0f, false, b, nb_iter, rand_lpoints);
-					Vec3Df c2 = raytraceSingle (pc/*PointCloud()*/, (float)(i-1)/2.0f, (float)j/2.0f, false, b, nb_iter, rand_lpoints);
-					Vec3Df c3 = raytraceSingle (pc/*PointCloud()*/, (float)i/2.0f, (float)(j-1)/2.0f, false, b, nb_iter, rand_lpoints);
-					Vec3Df c4 = raytraceSingle (pc/*PointCloud()*/, (float)(i-1)/2.0f, (float)(j-1)/2.0f, false, b, nb_iter, rand_lpoints);
-					Vec3Df c=(c1+c2+c3+c4)/4;
-				
-					// Depth map
-					//float f = (c - cam.position()).getSquaredLength();
-					//image.setPixel (i, ((cam.screenHeight()-1)-j), qRgb (clamp (f, 0, 255), clamp (f, 0, 255), clamp (f, 0, 255)));
-				
-					// Computed lighting
-				
-					image.setPixel (i/2, ((cam.screenHeight()-1)-j/2), qRgb (clamp (c[0]*255., 0, 255), clamp (c[1]*255., 0, 255), clamp (c[2]*255., 0, 255)));
-				}
-			}
+	// If the previous render had the same view and samples, and the geometry
+	// has not changed since, only colours or lights did: its primary hits are
+	// shaded again instead of tracing the primary rays. Otherwise the hits of
+	// a whole image are kept for the next render, if asked to or for the
+	// light AOVs.
+	bool reshade = gbufferValid && gbufferVersion == version && gbufferCamera.sameView (cam) && gbufferAdaptive == adaptive && gbufferSamples == totalSamples;
+	bool record = !reshade && wholeImage && (options.keepHits || options.lightAOVs) && (adaptive || totalSamples <= GBuffer::MAX_SAMPLES);
+
+	// With light AOVs, the response of each pixel to each light is kept along
+	// with the hits. When they are shaded again, only the lights that moved
+	// are: the image is their sum weighted by the colours of the lights, and
+	// changing colours only takes this sum again.
+	bool aovs = options.lightAOVs && wholeImage && (reshade || record);
+	bool relight = aovs && reshade && aovValid && aovIterations == nb_iter && aovDepth == options.depth && aovRoulette == options.russianRoulette;
+	vector<bool> retrace (lights.size(), true);
+	unsigned int numRetraced = lights.size();
+	if (relight) {
+		numRetraced = 0;
+		for (unsigned int l = 0; l < lights.size(); l++) {
+			retrace[l] = (l >= aovLights.size() || lights[l].getPos() != aovLights[l].getPos()
+				|| lights[l].getRadius() != aovLights[l].getRadius() || lights[l].getOrientation() != aovLights[l].getOrientation());
+			if (retrace[l]) numRetraced++;
 		}
 	}
-	else {
-		for (unsigned int i = 0; i < (unsigned int)cam.screenWidth(); i++) {
-			emit progress (i);
+	aovValid = false;
 
-			for (unsigned int j = 0; j < (unsigned int)cam.screenHeight(); j++) {
-				// Raytrace
-				Vec3Df c = raytraceSingle (pc/*PointCloud()*/, i, j, false, b, nb_iter, rand_lpoints);
-				
-				// Depth map
-				//float f = (c - cam.position()).getSquaredLength();
-				//image.setPixel (i, ((cam.screenHeight()-1)-j), qRgb (clamp (f, 0, 255), clamp (f, 0, 255), clamp (f, 0, 255)));
-				
-				// Computed lighting
-				image.setPixel (i, ((cam.screenHeight()-1)-j), qRgb (clamp (c[0]*255., 0, 255), clamp (c[1]*255., 0, 255), clamp (c[2]*255., 0, 255)));
+	// Nothing is traced if only the colours of the lights changed
+	PointCloud pc;
+	if (!relight || numRetraced > 0) {
+		cout << " (R) Generating point cloud..." << endl;
+		pc.add (objects, lights, cam);
+	}
+
+	// Every shaded point is lit by all the surfels, each taken from a single
+	// object. The edited objects whose surfels did not change leave the
+	// indirect light as it was. The others keep their former surfels, so
+	// that the tiles rendered again match the rest of the image: their part
+	// of the indirect light is only brought up to date when the image is
+	// shaded again as a whole.
+	if (incremental && (pc.getNumObjects() != objects.size() || tilePoints.getNumObjects() != objects.size())) {
+		incremental = false;
+		dirtyTiles.clear ();
+	}
+	if (incremental) {
+		unsigned int kept = 0;
+		for (unsigned int o = 0; o < objects.size(); o++)
+			if (edited.contains (o) && !pc.sameSurfels (o, tilePoints)) {
+				pc.copySurfels (o, tilePoints);
+				kept++;
 			}
-		}
+		if (kept > 0) cout << " (R) Keeping the former indirect light of " << kept << " edited objects" << endl;
 	}
-		// Return image
-	cout << " (R) Raytracing done! (" << timer.elapsed() << " ms)" << endl;
-	emit progress ((unsigned int)cam.screenWidth());
-	return image;
-}
 
-BoundingBox RayTracer::debug (unsigned int i, unsigned int j) {
-	BoundingBox bb;
-	Scene * scene = Scene::getInstance ();
+	// Free the texture tiles evicted during the previous render
+	TextureCache::getInstance()->collect();
 
-	unsigned int nb_iter = NB_RAY;
-	vector <vector<Vec3Df> > rand_lpoints(nb_iter, vector<Vec3Df>(scene->getLights().size(), Vec3Df(0.f,0.f,0.f)));
+	if (isCancelled (token)) return QImage ();
 
-	for (vector<Light>::iterator light = scene->getLights().begin(); light != scene->getLights().end(); light++) {
-		
-		int num_light=0;
-		Vec3Df lpos = cam.toWorld (light->getPos());
-		float lrad= light->getRadius();
-		Vec3Df lor= cam.toWorld (light->getOrientation());
-		
-		
+	// Count elapsed time
+	QTime timer;
+	timer.start();
 
-		const float PI = 3.1415926535;
+	cout << " (R) Raytracing: Start, snapshot " << snapshot.getVersion() << endl;
+
+	// Objects entered by the rays of each tile, kept for whole images along
+	// with their hits. Shading the hits again adds to the objects of the
+	// primary rays traced before.
+	bool track = options.keepHits && wholeImage && (!reshade || tileObjectsValid);
+	if (track && !reshade && !incremental) tileObjects.assign (tilesX * tilesY, ObjectSet ());
+	tileObjectsValid = false;
+
+	unsigned int numPixels = area.width () * area.height ();
+	if (incremental) {
+		cout << " (R) Rendering " << dirtyTiles.size() << " of " << tilesX * tilesY << " tiles again, for the edited objects" << endl;
+		numPixels = 0;
+		for (vector<TileScheduler::Tile>::const_iterator tile = dirtyTiles.begin(); tile != dirtyTiles.end(); tile++) {
+			frameBuffer.clear (tile->x, tile->y, tile->width, tile->height);
+			gbuffer.clear (tile->x, tile->y, tile->width, tile->height);
+			for (unsigned int l = 0; aovs && l < lights.size(); l++) lightResponses[l].clear (tile->x, tile->y, tile->width, tile->height);
+			if (aovs) backgroundResponse.clear (tile->x, tile->y, tile->width, tile->height);
+			tileObjects[(tile->y / TileScheduler::TILE_SIZE) * tilesX + tile->x / TileScheduler::TILE_SIZE].clear ();
+			numPixels += tile->width * tile->height;
+		}
+	} else {
+		if (!edited.empty ()) cout << " (R) Objects were edited: tracing the whole image again" << endl;
+		if (wholeImage || frameBuffer.getWidth () != width || frameBuffer.getHeight () != height)
+			frameBuffer.resize (width, height);
+		else
+			frameBuffer.clear (area.x (), area.y (), area.width (), area.height ());
+
+		if (!reshade) gbufferValid = false;
+		if (record) gbuffer.resize (width, height);
+		if (relight) cout << " (R) Relighting the previous render, " << numRetraced << " of " << lights.size() << " lights shaded again" << endl;
+		else if (reshade) cout << " (R) Shading the primary hits of the previous render" << endl;
+		if (aovs) {
+			lightResponses.resize (lights.size());
+			for (unsigned int l = 0; l < lights.size(); l++)
+				if (retrace[l]) lightResponses[l].resize (width, height);
+			if (!relight) backgroundResponse.resize (width, height);
+		}
+	}
 
-		if (lrad==0) nb_iter=1;
+	// Split the image in tiles, shared among the threads of the pool by work
+	// stealing. Samples are accumulated in the frame buffer, whose tiles are
+	// the same, and only converted to 8 bits at the end of each pass.
+	TileScheduler::Tile bounds = { (unsigned int) area.x (), (unsigned int) area.y (), (unsigned int) area.width (), (unsigned int) area.height () };
+	stopRequested = false;
+	unsigned int samplesDone = 0, numTiles = 0, numSteals = 0;
+	atomic<unsigned long long> primaryRays (0);
+
+	QThread * caller = QThread::currentThread ();
+	while (samplesDone < totalSamples) {
+		// A progressive pass adds as many rays per pixel as all the previous
+		// ones, up to MAX_PASS_SAMPLES: the first image comes after a single
+		// ray per pixel, and the next ones follow at a steady pace
+		unsigned int passSamples = totalSamples - samplesDone;
+		if (options.progressive && !reshade) passSamples = min (passSamples, min (max (samplesDone, 1u), MAX_PASS_SAMPLES));
+		unsigned int first = samplesDone, last = samplesDone + passSamples;
+
+		TileScheduler scheduler (incremental ? dirtyTiles : TileScheduler::split (bounds), pool->getNumThreads());
+		atomic<unsigned int> tilesDone (0);
+		pool->parallelFor (0, pool->getNumThreads(), 1, [&] (unsigned int worker) {
+			BoundingBox b;
+			unsigned int t;
+			LightTerms terms (aovs ? lights.size() : 0);
+			if (relight) terms.active = retrace;
+			LightTerms * parts = aovs ? &terms : NULL;
+			ObjectSet touched;
+			ObjectSet * objectsTouched = track ? &touched : NULL;
+			while (!isCancelled (token) && scheduler.next (worker, t)) {
+				const TileScheduler::Tile & tile = scheduler.getTile (t);
+				unsigned long long rays = 0;
+				for (unsigned int y = tile.y; y < tile.y + tile.height; y++)
+					for (unsigned int x = tile.x; x < tile.x + tile.width; x++) {
+						// Image rows go down, camera rows go up
+						float i = x, j = (height-1) - y;
+						if (relight) {
+							const GBuffer::Hit * hits = gbuffer.getHits (x, y);
+							unsigned int numHits = gbuffer.getNumHits (x, y);
+							if (numRetraced > 0) {
+								for (unsigned int s = 0; s < numHits; s++) {
+									reshadeSingle (snapshot, pc, i + offsets[s].first, j + offsets[s].second, hits[s], nb_iter, rand_lpoints, parts, objectsTouched);
+									addLightTerms (x, y, terms, false);
+								}
+								rays += numHits;
+							}
+
+							// The sums of the samples of the pixel, and their number
+							const float * background = backgroundResponse.pixel (x, y);
+							Vec3Df c = background[0] * backgroundColor;
+							for (unsigned int l = 0; l < lights.size(); l++) {
+								const float * response = lightResponses[l].pixel (x, y);
+								c += lights[l].getColor() * Vec3Df (response[0], response[1], response[2]);
+							}
+							float * p = frameBuffer.pixel (x, y);
+							p[0] = c[0];
+							p[1] = c[1];
+							p[2] = c[2];
+							p[3] = background[3];
+							continue;
+						}
+
+						if (reshade) {
+							const GBuffer::Hit * hits = gbuffer.getHits (x, y);
+							unsigned int numHits = gbuffer.getNumHits (x, y);
+							for (unsigned int s = 0; s < numHits; s++) {
+								frameBuffer.add (x, y, reshadeSingle (snapshot, pc, i + offsets[s].first, j + offsets[s].second, hits[s], nb_iter, rand_lpoints, parts, objectsTouched));
+								if (aovs) addLightTerms (x, y, terms, true);
+							}
+							rays += numHits;
+							continue;
+						}
+
+						GBuffer::Hit hit;
+						GBuffer::Hit * keep = record ? &hit : NULL;
+						if (!adaptive) {
+							for (unsigned int s = first; s < last; s++) {
+								frameBuffer.add (x, y, raytraceSingle (snapshot, pc, i + offsets[s].first, j + offsets[s].second, false, b, nb_iter, rand_lpoints, keep, parts, objectsTouched));
+								if (record) gbuffer.add (x, y, hit);
+								if (aovs) addLightTerms (x, y, terms, true);
+							}
+							rays += passSamples;
+							continue;
+						}
+
+						float sum = 0.f, sumSquares = 0.f;
+						unsigned int n = 0;
+						while (n < MAX_ADAPTIVE_SAMPLES) {
+							for (unsigned int end = min (n + (n == 0 ? MIN_ADAPTIVE_SAMPLES : ADAPTIVE_BATCH), MAX_ADAPTIVE_SAMPLES); n < end; n++) {
+								Vec3Df c = raytraceSingle (snapshot, pc, i + offsets[n].first, j + offsets[n].second, false, b, nb_iter, rand_lpoints, keep, parts, objectsTouched);
+								if (record) gbuffer.add (x, y, hit);
+								if (aovs) addLightTerms (x, y, terms, true);
+								frameBuffer.add (x, y, c);
+								float l = luminance (c);
+								sum += l;
+								sumSquares += l * l;
+							}
+							float mean = sum / n;
+							float variance = max (sumSquares - sum * mean, 0.f) / (n - 1);
+							if (variance <= n * ADAPTIVE_THRESHOLD * ADAPTIVE_THRESHOLD * (mean + ADAPTIVE_BLACK) * (mean + ADAPTIVE_BLACK))
+								break;
+						}
+						rays += n;
+					}
+				if (record && last == totalSamples) gbuffer.finish (tile.x, tile.y);
+				primaryRays.fetch_add (rays, memory_order_relaxed);
+				if (track) {
+					tileObjects[(tile.y / TileScheduler::TILE_SIZE) * tilesX + tile.x / TileScheduler::TILE_SIZE].insert (touched);
+					touched.clear ();
+				}
 
-		for(unsigned int k=0;k<scene->getLights().size();k++){
-			rand_lpoints[0][k]=lpos;
+				// Signals are only emitted by the thread that runs render
+				unsigned int done = tilesDone.fetch_add (1, memory_order_relaxed) + 1;
+				if (QThread::currentThread () == caller)
+					emit progress ((first + (unsigned long long) done * passSamples / scheduler.getNumTiles()) * width / totalSamples);
+			}
+		});
+		samplesDone = last;
+		numTiles += scheduler.getNumTiles();
+		numSteals += scheduler.getNumSteals();
+		if (isCancelled (token)) {
+			cout << " (R) Raytracing cancelled" << endl;
+			return QImage ();
 		}
 
-		for(unsigned int j=1;j<nb_iter;j++){
-	
-			double rand_rad =((double)rand() / ((double)RAND_MAX + 1) * lrad);
-			double rand_ang =((double)rand() / ((double)RAND_MAX + 1) * 2 * PI);
-				
-			Vec3Df v0 (0.0f, -lor[2], lor[1]);
-			Vec3Df v1 (lor[1]*lor[1]+lor[2]*lor[2], -lor[0]*lor[1], -lor[0]*lor[2]);
-			v0.normalize();
-			v1.normalize(); 
-
-			rand_lpoints[j][num_light]= lpos+ rand_rad* (cos(rand_ang)*v0+sin(rand_ang)*v1);
+		if (options.progressive && samplesDone < totalSamples) {
+			if (receivers (SIGNAL (updated (const QImage &))) > 0) emit updated (frameBuffer.toImage ());
+			if (stopRequested) {
+				cout << " (R) Raytracing stopped after " << samplesDone << " rays per pixel" << endl;
+				break;
+			}
 		}
-		num_light++;
-	} 
-	raytraceSingle (PointCloud(), i, j, true, bb, nb_iter, rand_lpoints);
-	return bb;
+	}
+	QImage image = frameBuffer.toImage ();
+
+	// What a stopped render leaves only has part of the samples: the next
+	// render may not reuse it
+	bool complete = (samplesDone == totalSamples);
+	if (record && complete && !gbuffer.isComplete ())
+		cerr << " (W) The primary hits take more than " << gbuffer.getBudget () / (1024 * 1024) << " MB: they will be traced again" << endl;
+	if (record && complete && gbuffer.isComplete ()) {
+		gbufferValid = true;
+		gbufferCamera = cam;
+		gbufferAdaptive = adaptive;
+		gbufferSamples = totalSamples;
+		gbufferVersion = version;
+	}
+	if (track && complete) {
+		tileObjectsValid = true;
+		tileObjectBounds.clear ();
+		for (vector<Object>::const_iterator o = objects.begin(); o != objects.end(); o++) tileObjectBounds.push_back (o->getBoundingBox());
+		tileLights = lights;
+		tilePoints = pc;
+		tileBackground = backgroundColor;
+		tileDepth = options.depth;
+		tileRoulette = options.russianRoulette;
+	}
+	if (aovs && complete) {
+		aovValid = true;
+		aovLights = lights;
+		aovIterations = nb_iter;
+		aovDepth = options.depth;
+		aovRoulette = options.russianRoulette;
+	}
+
+	// Return image
+	int elapsed = timer.elapsed();
+	cout << " (R) Raytracing done! (" << elapsed << " ms, " << primaryRays.load () / (1000. * max (elapsed, 1)) << " primary Mrays/s, "
+		<< (double) primaryRays.load () / max (numPixels, 1u) << " rays per pixel, " << numTiles << " tiles, " << numSteals << " steals)" << endl;
+	if (scene->getGeometryCache().getNumChunks() > 0)
+		scene->getGeometryCache().printStatistics();
+	if (TextureCache::getInstance()->getMisses() > 0)
+		TextureCache::getInstance()->printStatistics();
+	emit progress ((unsigned int)cam.screenWidth());
+	return image;
+}
+
+int RayTracer::pickObject (unsigned int i, unsigned int j) {
+	shared_ptr<const RenderSnapshot> snapshot = getSnapshot ();
+	Ray ray (cam.position(), primaryDirection (i, j));
+	Vertex intersectionPoint;
+	const Object * intersectionObject = NULL;
+	unsigned int triangle;
+	float ir, iu, iv;
+	if (!ray.intersect (*snapshot, intersectionPoint, &intersectionObject, ir, iu, iv, triangle)) return -1;
+	return intersectionObject - &snapshot->getObjects()[0];
 }
 
+BoundingBox RayTracer::debug (unsigned int i, unsigned int j) {
+	BoundingBox bb;
+	shared_ptr<const RenderSnapshot> snapshot = getSnapshot ();
+	unsigned int nb_iter;
+	vector <vector<Vec3Df> > rand_lpoints = lightPoints (snapshot->getLights(), nb_iter);
+	raytraceSingle (*snapshot, PointCloud(), i, j, true, bb, nb_iter, rand_lpoints);
+	return bb;
+}
 
@@ -10,8 +10,12 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <QImage>
+#include <QRect>
 #include <QThread>
+#include <QMutex>
 #include <QObject>
 #include <QTime>
 
@@ -20,6 +24,10 @@
 #include "Material.h"
 #include "Vec3D.h"
 #include "KDTreeNode.hpp"
+#include "FrameBuffer.hpp"
+#include "GBuffer.hpp"
+#include "ObjectSet.hpp"
+#include "RenderSnapshot.hpp"
 
 using namespace std;
 
@@ -30,51 +38,235 @@ class RayTracer : public QThread {
     static RayTracer * getInstance ();
     static void destroyInstance ();
 
-    inline const Vec3Df & getBackgroundColor () const { return backgroundColor;}
-    inline void setBackgroundColor (const Vec3Df & c) { backgroundColor = c; }
+    inline Vec3Df getBackgroundColor () { return getSnapshot()->getOptions().background; }
+    inline void setBackgroundColor (const Vec3Df & c) { setOption (&RenderSnapshot::Options::background, c); }
     
     
-		Vec3Df getColor (const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, unsigned int nb_iter, const vector<vector<Vec3Df> > & rand_lpoints);
-		Vec3Df lightModel (const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, unsigned int nb_iter, const vector<vector<Vec3Df> > & rand_lpoints);
-		Vec3Df lightBounce (const Vec3Df & eye, const Vec3Df & dir, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, int d, unsigned int nb_iter, const vector<vector<Vec3Df> > & rand_lpoints);
-    Vec3Df raytraceSingle (const PointCloud & pc, float i, float j, bool debug, BoundingBox & bb, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints);
+		/**
+		 * Parts of a colour: the response to each light, to be multiplied by
+		 * the colour of the light, and the weight of the background colour.
+		 * Only the active lights are shaded.
+		 */
+		struct LightTerms {
+			LightTerms (unsigned int numLights = 0) : response (numLights), active (numLights, true), background (0.f) { }
+			inline void clear () { fill (response.begin(), response.end(), Vec3Df ()); background = 0.f; }
+			vector<Vec3Df> response;
+			vector<bool> active;
+			float background;
+
+			// Scratch of the shading functions, kept along with the terms of a
+			// thread so that shading a point allocates nothing: the indirect
+			// response in lightModel, and the parts of each point in lightBounce
+			vector<Vec3Df> indirect;
+			unique_ptr<LightTerms> point;
+		};
+
+		Vec3Df getColor (const RenderSnapshot & snapshot, const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, unsigned int nb_iter, const vector<vector<Vec3Df> > & rand_lpoints, LightTerms * terms = NULL, ObjectSet * touched = NULL);
+		Vec3Df lightModel (const RenderSnapshot & snapshot, const Vec3Df & eye, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, unsigned int nb_iter, const vector<vector<Vec3Df> > & rand_lpoints, LightTerms * terms = NULL, ObjectSet * touched = NULL);
+		Vec3Df lightBounce (const RenderSnapshot & snapshot, const Vec3Df & eye, const Vec3Df & dir, const Vec3Df & point, const Vec3Df & normal, const Material & mat, const PointCloud & pc, bool debug, int d, unsigned int nb_iter, const vector<vector<Vec3Df> > & rand_lpoints, LightTerms * terms = NULL, ObjectSet * touched = NULL);
+		// Direction of the primary ray through screen point (i, j)
+		Vec3Df primaryDirection (float i, float j) const;
+		// Colour of the primary ray through (i, j), where it hit if hit is not NULL, and its parts if terms is not NULL.
+		// The objects entered by any of its rays are added to touched, if it is not NULL.
+    Vec3Df raytraceSingle (const RenderSnapshot & snapshot, const PointCloud & pc, float i, float j, bool debug, BoundingBox & bb, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, GBuffer::Hit * hit = NULL, LightTerms * terms = NULL, ObjectSet * touched = NULL);
+		// Colour of the primary ray through (i, j), shading hit again instead of tracing it
+		Vec3Df reshadeSingle (const RenderSnapshot & snapshot, const PointCloud & pc, float i, float j, const GBuffer::Hit & hit, unsigned int nb_iter, const vector <vector<Vec3Df> > & rand_lpoints, LightTerms * terms = NULL, ObjectSet * touched = NULL);
     QImage render ();
     BoundingBox debug (unsigned int i, unsigned int j);
+		// Index of the object seen through screen point (i, j), or -1
+		int pickObject (unsigned int i, unsigned int j);
 
 		void setCamera (const Camera _cam) { cam = _cam; }
+
+		/**
+		 * Pixels to render, from the top left corner of the image. The others
+		 * keep the samples of the previous render if it had the same size, and
+		 * are black otherwise. A null rectangle renders the whole image.
+		 */
+		void setRegion (const QRect & r) { region = r; }
+		const QRect & getRegion () const { return region; }
+
+		/**
+		 * Render region (the whole image if null) with camera c in the thread
+		 * of the ray tracer. A render in progress is cancelled first: only the
+		 * latest request is rendered.
+		 */
+		void requestRender (const Camera & c, const QRect & r = QRect ());
 		const Camera & getCamera () const { return cam; }
 
-		void setDepth (const int d) { depth = d; }
-		int getDepth () const { return depth; }
+		/**
+		 * Camera of the image in the frame buffer, if the last render of the
+		 * thread was not cancelled: regions can only be rendered over it
+		 */
+		bool getFinishedCamera (Camera & c);
+
+		/**
+		 * Width of the area seen by a pixel at point, from eye
+		 */
+		inline float pixelFootprint (const Vec3Df & eye, const Vec3Df & point) const {
+			return (point - eye).getLength() * cam.horizontalFieldOfView() / cam.screenWidth();
+		}
+
+		/**
+		 * Snapshot the next render starts with. The options below are only
+		 * set in the next snapshot, never in the one of a running render.
+		 */
+		shared_ptr<const RenderSnapshot> getSnapshot ();
+
+		void setDepth (const int d) { setOption (&RenderSnapshot::Options::depth, d); }
+		int getDepth () { return getSnapshot()->getOptions().depth; }
+
+		bool getAntiAliasing () { return getSnapshot()->getOptions().antiAliasing; }
+		bool getProgressive () { return getSnapshot()->getOptions().progressive; }
+		bool getRussianRoulette () { return getSnapshot()->getOptions().russianRoulette; }
+		bool getLightAOVs () { return getSnapshot()->getOptions().lightAOVs; }
+		bool getKeepHits () { return getSnapshot()->getOptions().keepHits; }
+
+		/**
+		 * Rays per pixel of a progressive render
+		 */
+		unsigned int getSamples () { return getSnapshot()->getOptions().samples; }
+		void setSamples (unsigned int s) { setOption (&RenderSnapshot::Options::samples, max (s, 1u)); }
+
+		/**
+		 * High dynamic range samples of the last render
+		 */
+		const FrameBuffer & getFrameBuffer () const { return frameBuffer; }
+
+		/**
+		 * Response of the pixels of the last render to light l, when light
+		 * AOVs are kept: the image lit by l alone, in white
+		 */
+		unsigned int getNumLightAOVs () const { return aovValid ? lightResponses.size() : 0; }
+		const FrameBuffer & getLightAOV (unsigned int l) const { return lightResponses[l]; }
+
+	public slots:
+		// Cast 4 to 16 rays per pixel instead of 1, more where the colour varies
+		void setAntiAliasing (bool b) { setOption (&RenderSnapshot::Options::antiAliasing, b); }
+		// Trace the reflected and refracted rays worth less than 1% of a pixel at random, instead of never
+		void setRussianRoulette (bool b) { setOption (&RenderSnapshot::Options::russianRoulette, b); }
+		// Refine the image in passes, up to getSamples() rays per pixel, and send it after each pass
+		void setProgressive (bool b) { setOption (&RenderSnapshot::Options::progressive, b); }
+		// Keep the response of the image to each light, so that changing the colour of lights only recombines them
+		void setLightAOVs (bool b) { setOption (&RenderSnapshot::Options::lightAOVs, b); }
+		// Keep the primary hits of whole images, so that the next render with the same view shades them again if only colours or lights changed
+		void setKeepHits (bool b) { setOption (&RenderSnapshot::Options::keepHits, b); }
+		// Take the lights and kD-trees of the scene into the next snapshot, after they changed
+		void updateScene ();
+		// End a progressive render after the current pass, any other at once:
+		// the options of the render in progress tell which it is
+		void stop ();
+		// Abandon the render in progress and the pending request, keeping the last image
+		void cancel ();
+		// Trace the primary rays of the next render again: the geometry changed
+		void invalidateGBuffer () { sceneVersion.fetch_add (1, memory_order_release); }
+		// Render again only the tiles whose rays entered object o: it changed within its bounds
+		void invalidateObject (int o);
 
 	signals:
 		void init (int min, int max);
 		void progress (int val);
 		void finished (const QImage & pixm);
+		void updated (const QImage & pixm);
 
     
 	protected:
-    inline RayTracer (QObject* parent = 0) : QThread(parent), depth(8), anti_aliasing(0) { }
+    inline RayTracer (QObject* parent = 0) : QThread(parent), stopRequested(false), snapshot(new RenderSnapshot ()),
+			gbufferValid(false), gbufferAdaptive(false), gbufferSamples(0), gbufferVersion(0), sceneVersion(0), aovValid(false), aovIterations(0), aovDepth(0), aovRoulette(false), tileObjectsValid(false), tileDepth(0), tileRoulette(false),
+			hasRequest(false), looping(false), hasFinished(false), generation(0) { }
     inline virtual ~RayTracer () {}
-		virtual void run() { 
-			cout << " (I) RayTracer: Starting thread" << endl;
-			// Initialize everything listening to the raytracer status
-			emit init (0, cam.screenWidth());
+		virtual void run();
+
+		/**
+		 * Points sampled on the lights, rand_lpoints[i][l] being the i-th point
+		 * of light l, and their number per light. Always the same for the same
+		 * lights and camera.
+		 */
+		vector<vector<Vec3Df> > lightPoints (const vector<Light> & lights, unsigned int & nb_iter) const;
 
-			// Render image
-			renderedimage = render (); 
+		/**
+		 * Add the parts of a sample of pixel (x, y) to the light AOVs, and to
+		 * the background weights if background is set, and clear them
+		 */
+		void addLightTerms (unsigned int x, unsigned int y, LightTerms & terms, bool background);
 
-			// Signel the listeners the image is ready!
-			emit finished (renderedimage);
-			cout << " (I) RayTracer: End of thread" << endl;
+		/**
+		 * Set an option in the next snapshot
+		 */
+		template <class T> void setOption (T RenderSnapshot::Options::* option, const T & value) {
+			QMutexLocker locker (&snapshotMutex);
+			RenderSnapshot::Options o = snapshot->getOptions();
+			o.*option = value;
+			snapshot = snapshot->withOptions (o);
 		}
+
+		/**
+		 * True once the render started when generation was token is cancelled
+		 */
+		inline bool isCancelled (unsigned int token) const { return generation.load (memory_order_acquire) != token; }
     
 	private:
-    Vec3Df backgroundColor;
 		Camera cam;
+		QRect region;
 		QImage renderedimage;
-		int depth;
-		int anti_aliasing;
+		FrameBuffer frameBuffer;
+		atomic<bool> stopRequested;
+
+		// Snapshot of the next render, replaced as a whole under snapshotMutex,
+		// and the one of the render in progress or of the last one
+		QMutex snapshotMutex;
+		shared_ptr<const RenderSnapshot> snapshot;
+		shared_ptr<const RenderSnapshot> running;
+
+		// Primary hits of the last whole image that was completed, valid for
+		// the camera, samples and version of the geometry it was rendered with
+		GBuffer gbuffer;
+		bool gbufferValid;
+		Camera gbufferCamera;
+		bool gbufferAdaptive;
+		unsigned int gbufferSamples;
+		unsigned int gbufferVersion;
+		atomic<unsigned int> sceneVersion;
+
+		// Response of the pixels to each light and to the background colour,
+		// summed over the primary hits of the G-buffer, and the lights, number
+		// of light points and shading they were computed with
+		vector<FrameBuffer> lightResponses;
+		FrameBuffer backgroundResponse;
+		bool aovValid;
+		vector<Light> aovLights;
+		unsigned int aovIterations;
+		unsigned int aovDepth;
+		bool aovRoulette;
+
+		// Objects entered by the rays of each tile of the last whole image, on
+		// the grid of TileScheduler, the bounds of the objects then, and the
+		// shading and indirect light the image was rendered with
+		vector<ObjectSet> tileObjects;
+		bool tileObjectsValid;
+		vector<BoundingBox> tileObjectBounds;
+		vector<Light> tileLights;
+		PointCloud tilePoints;
+		Vec3Df tileBackground;
+		int tileDepth;
+		bool tileRoulette;
+
+		// Objects changed since the last render, under requestMutex
+		ObjectSet editedObjects;
+
+		// Latest render request, and whether run is still looping over them
+		QMutex requestMutex;
+		Camera requestedCamera;
+		QRect requestedRegion;
+		bool hasRequest;
+		bool looping;
+
+		// Camera of the last render of the thread, if it was not cancelled
+		Camera finishedCamera;
+		bool hasFinished;
+
+		// Incremented to cancel the render in progress
+		atomic<unsigned int> generation;
 };
 
 
@@ -0,0 +1,84 @@
+/**
+ * RenderSnapshot C++ Header (RenderSnapshot.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+#include <memory>
+
+#include "Object.h"
+#include "Light.h"
+#include "Vec3D.h"
+
+using namespace std;
+
+/**
+ * RenderSnapshot Class
+ * Everything a render reads that the user interface may change while it
+ * runs: the options of the ray tracer, the lights, and the objects with
+ * their materials and shapes. A snapshot never changes once published:
+ * changing a part gives a new snapshot, one version later, sharing all
+ * the other parts with the previous one. A render keeps the snapshot it
+ * started with, so the threads tracing it need no lock, and the shapes
+ * the scene replaced live on until the last render using them ends.
+ */
+class RenderSnapshot {
+	public:
+		/**
+		 * Options of the ray tracer
+		 */
+		struct Options {
+			Options () : depth (8), antiAliasing (false), progressive (false), russianRoulette (false), lightAOVs (false), keepHits (false), samples (64) { }
+			int depth;
+			bool antiAliasing;
+			bool progressive;
+			bool russianRoulette;
+			bool lightAOVs;
+			bool keepHits;
+			unsigned int samples;
+			Vec3Df background;
+		};
+
+		/**
+		 * RenderSnapshot Class Constructor, with no objects and no lights
+		 */
+		RenderSnapshot () : version (0), objects (new vector<Object> ()), lights (new vector<Light> ()) { }
+
+		inline unsigned int getVersion () const { return version; }
+		inline const Options & getOptions () const { return options; }
+		inline const vector<Object> & getObjects () const { return *objects; }
+		inline const vector<Light> & getLights () const { return *lights; }
+
+		/**
+		 * Copies with other options, lights or objects, sharing the rest.
+		 * The objects are copied, but share their shapes with the ones given.
+		 */
+		inline shared_ptr<const RenderSnapshot> withOptions (const Options & o) const {
+			RenderSnapshot * s = new RenderSnapshot (*this);
+			s->version++;
+			s->options = o;
+			return shared_ptr<const RenderSnapshot> (s);
+		}
+
+		inline shared_ptr<const RenderSnapshot> withLights (const vector<Light> & l) const {
+			RenderSnapshot * s = new RenderSnapshot (*this);
+			s->version++;
+			s->lights.reset (new vector<Light> (l));
+			return shared_ptr<const RenderSnapshot> (s);
+		}
+
+		inline shared_ptr<const RenderSnapshot> withObjects (const vector<Object> & o) const {
+			RenderSnapshot * s = new RenderSnapshot (*this);
+			s->version++;
+			s->objects.reset (new vector<Object> (o));
+			return shared_ptr<const RenderSnapshot> (s);
+		}
+
+	protected:
+		unsigned int version;
+		Options options;
+		shared_ptr<const vector<Object> > objects;
+		shared_ptr<const vector<Light> > lights;
+};
@@ -6,10 +6,31 @@
 // *********************************************************
 
 #include "Scene.h"
+#include "TaskPool.hpp"
+#include <sstream>
+#include <map>
+#include <QDir>
+#include <QFile>
+#include <QTime>
 
 using namespace std;
 
 static Scene * instance = NULL;
+static string sceneFile = "scenes/default.scene";
+static bool defaultSceneFallback = true;
+
+// Meshes at least this large keep their vertex attributes compressed in memory
+static const unsigned int COMPRESS_MIN_TRIANGLES = 100000;
+
+// Size of the chunks of out-of-core objects, in triangles
+static const unsigned int CHUNK_TRIANGLES = 16384;
+
+// Vertices closer than this fraction of their object size are welded at load time
+static const float WELD_TOLERANCE = 1e-5f;
+
+// Delay between the last change of a mesh file and its reload, in milliseconds,
+// so that a file being written is only read once complete
+static const int RELOAD_DELAY = 300;
 
 Scene * Scene::getInstance () {
     if (instance == NULL)
@@ -24,9 +45,51 @@ void Scene::destroyInstance () {
     }
 }
 
-Scene::Scene () {
-    buildDefaultScene (true);
+void Scene::setSceneFile (const string & filename) {
+    sceneFile = filename;
+}
+
+void Scene::setDefaultSceneFallback (bool fallback) {
+    defaultSceneFallback = fallback;
+}
+
+Scene::Scene () : fuzziness (fuzzinessOf (DEFAULT_FUZZINESS)), numPrepared (0) {
+    geometryCache.setFuzziness (fuzziness);
+    QTime timer;
+    timer.start ();
+    try {
+        loadSceneFile (sceneFile);
+    } catch (const SceneFile::Exception & e) {
+        if (!defaultSceneFallback)
+            throw;
+        cerr << e.getMessage () << endl;
+        cerr << " (W) Falling back to the default scene" << endl;
+        objects.clear ();
+        shapes.clear ();
+        shapeSources.clear ();
+        sources.clear ();
+        lights.clear ();
+        cameraHint = SceneFile::CameraDecl ();
+        streaming = SceneFile::StreamingDecl ();
+        numPrepared = 0;
+        preparation = PreparationStatistics ();
+        buildDefaultScene ();
+    }
+    prepareObjects ();
+    cout << " (I) Welded " << preparation.welded << " vertices, geometry memory " << preparation.before / 1024 << " KB -> "
+        << preparation.after / 1024 << " KB (" << (preparation.before - preparation.after) / 1024 << " KB saved)" << endl;
     updateBoundingBox ();
+
+    unsigned long triangles = 0;
+    for (vector<Object>::const_iterator it = objects.begin (); it != objects.end (); it++)
+        triangles += it->isOutOfCore () ? it->getChunkedMesh ().getNumTriangles () : it->getMesh ().getNumTriangles ();
+    cout << " (I) Scene ready: " << objects.size () << " objects of " << shapes.size () << " shapes, " << triangles << " triangles, "
+        << lights.size () << " lights, built in " << timer.elapsed () << " ms" << endl;
+
+    reloadTimer.setSingleShot (true);
+    connect (&reloadTimer, SIGNAL (timeout ()), this, SLOT (reloadPendingMeshFiles ()));
+    connect (&watcher, SIGNAL (fileChanged (const QString &)), this, SLOT (meshFileChanged (const QString &)));
+    watchMeshFiles ();
 }
 
 Scene::~Scene () {
@@ -43,7 +106,7 @@ void Scene::updateBoundingBox () {
 }
 
 // Changer ce code pour créer des scènes originales
-void Scene::buildDefaultScene (bool HD) {
+void Scene::buildDefaultScene () {
 	cout << " (I) Building Default Scene..." << endl;
 
 	// Create basic box materials
@@ -58,38 +121,226 @@ void Scene::buildDefaultScene (bool HD) {
 	planeBottom.loadOFF ("models/Box/plane_bottom.off");
 	planeLeft  .loadOFF ("models/Box/plane_left.off");
 	planeRight .loadOFF ("models/Box/plane_right.off");
-	objects.push_back (Object (planeFloor, planeWhite));
-	objects.push_back (Object (planeTop, planeWhite));
-	objects.push_back (Object (planeBottom, planeWhite));
-	objects.push_back (Object (planeLeft, planeRed));
-	objects.push_back (Object (planeRight, planeGreen));
+	addObject (addShape (std::move (planeFloor), "models/Box/plane_floor.off"), planeWhite);
+	addObject (addShape (std::move (planeTop), "models/Box/plane_top.off"), planeWhite);
+	addObject (addShape (std::move (planeBottom), "models/Box/plane_bottom.off"), planeWhite);
+	addObject (addShape (std::move (planeLeft), "models/Box/plane_left.off"), planeRed);
+	addObject (addShape (std::move (planeRight), "models/Box/plane_right.off"), planeGreen);
 
 	// Create glass materials
 	Material glassMat1 (1.f, 1.f, 1.f, Vec3Df (1.f, .0f, .2f), 1.6f, 0.90f, 0.2f);
 	Material glassMat2 (1.f, 1.f, 1.f, Vec3Df (.2f, 1.f, 0.f), 1.2f, 0.90f, 0.2f);
 	Material glassMat3 (1.f, 1.f, 1.f, Vec3Df (0.f, .2f, 1.f), 1.3f, 0.80f, 0.2f);
 
-	// Load glass meshes
-	Mesh glassMesh1, glassMesh2, glassMesh3;
-	glassMesh1.loadOFF ("models/wine_crate_000.off");
-	glassMesh2.loadOFF ("models/wine_crate_000.off");
-	glassMesh3.loadOFF ("models/wine_crate_000.off");
-	glassMesh2.translate (Vec3Df (1.f, 0.f, 0.f));
-	glassMesh3.translate (Vec3Df (0.f, 1.f, 0.f));
+	// Load the glass mesh, shared by the three glass objects
+	Mesh glassMesh;
+	glassMesh.loadOFF ("models/wine_crate_000.off");
+	unsigned int glass = addShape (std::move (glassMesh), "models/wine_crate_000.off");
 
 	// Create glass objects
-	Object glass1 (glassMesh1, glassMat1);
-	Object glass2 (glassMesh2, glassMat2);
-	Object glass3 (glassMesh3, glassMat3);
-	objects.push_back (glass1);
-	objects.push_back (glass2);
-	objects.push_back (glass3);
+	addObject (glass, glassMat1);
+	addObject (glass, glassMat2, Vec3Df (1.f, 0.f, 0.f));
+	addObject (glass, glassMat3, Vec3Df (0.f, 1.f, 0.f));
 
 	// Create lights
 	Light l (Vec3Df (3.0f, 3.0f, 3.0f), Vec3Df (1.0f, 1.0f, 1.0f), 1.0f, 1.0f, Vec3Df(-1.0f, -1.0f, -1.0f));
 	lights.push_back (l);
 
-	// Recompute kD-trees for each object
-	for (vector<Object>::iterator it = objects.begin(); it != objects.end(); it++) it->computeKdTree();
 	cout << " (I) End scene build" << endl;
 }
+
+Object::Placement Scene::place (const BoundingBox & bounds, const Vec3Df & translation, float size) {
+	Object::Placement placement;
+	if (size > 0.f) {
+		placement.center = bounds.getCenter ();
+		if (bounds.getSize () > 0.f)
+			placement.scale = size / bounds.getSize ();
+	}
+	placement.translation = translation;
+	return placement;
+}
+
+unsigned int Scene::addShape (Mesh mesh, const string & path) {
+	shapes.push_back (shared_ptr<Shape> (new Shape (std::move (mesh))));
+	ShapeSource source;
+	source.path = path;
+	source.bounds = shapes.back ()->getBoundingBox ();
+	shapeSources.push_back (source);
+	return shapes.size () - 1;
+}
+
+void Scene::addObject (unsigned int shape, const Material & mat, const Vec3Df & translation, float size) {
+	objects.push_back (Object (shapes[shape], mat, place (shapeSources[shape].bounds, translation, size)));
+	ObjectSource source;
+	source.shape = shape;
+	source.translation = translation;
+	source.size = size;
+	sources.push_back (source);
+}
+
+void Scene::loadSceneFile (const string & filename) {
+	cout << " (I) Loading scene " << filename << "..." << endl;
+	SceneFile file;
+	file.parse (filename);
+	streaming = file.getStreaming ();
+	if (streaming.defined) {
+		geometryCache.setBudget ((unsigned long) streaming.cacheMegabytes << 20);
+		QDir ().mkpath (QString (streaming.directory.c_str ()));
+	} else
+		file.loadMeshes ();
+
+	// Each mesh is read once, on the first object that uses it, and its
+	// shape is shared by all the objects made from it. When streaming, each
+	// shape goes to disk before the next mesh is read, so the whole scene
+	// is never in memory.
+	const vector<SceneFile::ObjectDecl> & decls = file.getObjects ();
+	objects.reserve (decls.size ());
+	sources.reserve (decls.size ());
+	map<string, unsigned int> shapeOfMesh;
+	for (vector<SceneFile::ObjectDecl>::const_iterator it = decls.begin(); it != decls.end(); it++) {
+		string mesh = file.getMeshSource (it->mesh);
+		map<string, unsigned int>::const_iterator known = shapeOfMesh.find (mesh);
+		unsigned int shape;
+		if (known != shapeOfMesh.end ())
+			shape = known->second;
+		else {
+			shape = addShape (file.takeMesh (it->mesh), file.getMeshPath (it->mesh));
+			shapeOfMesh[mesh] = shape;
+			if (streaming.defined)
+				prepareObjects ();
+		}
+		addObject (shape, file.getMaterial (it->material), it->translation, it->size);
+	}
+	lights = file.getLights ();
+	cameraHint = file.getCamera ();
+	cout << " (I) Read " << file.getNumLoadedMeshes () << " mesh files for " << objects.size () << " objects" << endl;
+}
+
+void Scene::prepareObjects () {
+	// One task per shape added since the last call, which may split its
+	// own work further
+	unsigned int first = numPrepared;
+	PreparationStatistics total = TaskPool::getInstance ()->parallelReduce (numPrepared, shapes.size (), 1, preparation, [&] (unsigned int i) {
+		PreparationStatistics s;
+		s.before = shapes[i]->getMesh().getMemoryFootprint();
+		s.welded = prepareShape (*shapes[i], i);
+		s.after = shapes[i]->getMesh().getMemoryFootprint();
+		return s;
+	}, [] (const PreparationStatistics & a, const PreparationStatistics & b) {
+		PreparationStatistics s;
+		s.before = a.before + b.before;
+		s.after = a.after + b.after;
+		s.welded = a.welded + b.welded;
+		return s;
+	});
+	preparation = total;
+	numPrepared = shapes.size ();
+	// Preparation may change the bounds of the shapes, which the objects
+	// already made from them keep in scene coordinates
+	for (unsigned int i = 0; i < objects.size (); i++)
+		if (sources[i].shape >= first)
+			objects[i].setShape (shapes[sources[i].shape], objects[i].getPlacement ());
+}
+
+unsigned int Scene::prepareShape (Shape & shape, unsigned int i) {
+	// Weld duplicated vertices and compress large meshes, then recompute the kD-tree,
+	// memory layout and levels of detail of the shape, and pack indices
+	Mesh & mesh = shape.getMesh();
+	unsigned int welded = mesh.weld (WELD_TOLERANCE * shape.getBoundingBox().getSize());
+	mesh.recomputeSmoothVertexNormals (0);
+	if (mesh.getNumTriangles() >= COMPRESS_MIN_TRIANGLES) {
+		mesh.compress (true);
+		shape.updateBoundingBox ();
+	}
+	shape.optimizeLayout (fuzziness);
+	shape.buildLODChain();
+	if (streaming.defined && mesh.getNumTriangles() >= streaming.minTriangles) {
+		// No lock around this: the normals use the task pool, whose waits may
+		// run the preparation of another shape on this thread. The cache
+		// only locks its own registration of each chunk.
+		ostringstream prefix;
+		prefix << streaming.directory << "/shape" << i << "_";
+		shape.makeOutOfCore (prefix.str(), CHUNK_TRIANGLES, geometryCache);
+	} else {
+		// Renders only read the meshes: their normals are final from now on
+		mesh.updateSmoothVertexNormals (1);
+		mesh.packIndices();
+	}
+	return welded;
+}
+
+void Scene::watchMeshFiles () {
+	set<string> paths;
+	for (vector<ShapeSource>::const_iterator it = shapeSources.begin(); it != shapeSources.end(); it++)
+		if (!it->path.empty() && paths.insert (it->path).second)
+			watcher.addPath (QString (it->path.c_str()));
+}
+
+void Scene::meshFileChanged (const QString & path) {
+	// Editors often write a file in several steps: wait until it settles
+	pendingReloads.insert (path.toStdString());
+	reloadTimer.start (RELOAD_DELAY);
+}
+
+void Scene::reloadPendingMeshFiles () {
+	for (set<string>::const_iterator path = pendingReloads.begin(); path != pendingReloads.end(); path++) {
+		QString file (path->c_str());
+		if (!QFile::exists (file)) {
+			cerr << " (W) Mesh file " << *path << " was removed, keeping its objects" << endl;
+			continue;
+		}
+		// Saving by renaming a new file over the old one stops the watch
+		if (!watcher.files().contains (file))
+			watcher.addPath (file);
+		reloadMeshFile (*path);
+	}
+	pendingReloads.clear();
+	emit objectsChanged();
+}
+
+void Scene::setMaterial (unsigned int o, const Material & material) {
+	objects[o].setMaterial (material);
+	emit objectChanged (o);
+	emit objectsChanged ();
+}
+
+void Scene::reloadMeshFile (const string & path) {
+	Mesh mesh;
+	try {
+		mesh.loadOFF (path);
+	} catch (const Mesh::Exception & e) {
+		cerr << e.getMessage () << endl;
+		cerr << " (W) Keeping the previous version of " << path << endl;
+		return;
+	}
+
+	QTime timer;
+	timer.start();
+	vector<unsigned int> users;
+	for (unsigned int s = 0; s < shapes.size(); s++)
+		if (shapeSources[s].path == path) users.push_back (s);
+	unsigned int reloaded = 0;
+	for (unsigned int u = 0; u < users.size(); u++) {
+		unsigned int s = users[u];
+		// The last shape takes the geometry that was read, the others a copy
+		Mesh geometry;
+		if (u + 1 == users.size())
+			geometry = std::move (mesh);
+		else
+			geometry = mesh;
+		// A new shape, prepared before the objects take it: renders in
+		// progress keep the former one
+		shared_ptr<Shape> shape (new Shape (std::move (geometry)));
+		shapeSources[s].bounds = shape->getBoundingBox ();
+		prepareShape (*shape, s);
+		shapes[s] = shape;
+		for (unsigned int i = 0; i < objects.size(); i++)
+			if (sources[i].shape == s) {
+				objects[i].setShape (shape, place (shapeSources[s].bounds, sources[i].translation, sources[i].size));
+				emit objectChanged (i);
+				reloaded++;
+			}
+	}
+	updateBoundingBox ();
+	cout << " (I) Reloaded " << path << " for " << reloaded << " objects in " << timer.elapsed() << " ms" << endl;
+}
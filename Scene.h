@@ -10,12 +10,17 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <set>
 #include <QObject>
+#include <QFileSystemWatcher>
+#include <QTimer>
 #include <cmath>
 
 #include "Object.h"
 #include "Light.h"
 #include "BoundingBox.h"
+#include "SceneFile.hpp"
 
 class Scene : public QObject {
 	Q_OBJECT
@@ -23,6 +28,13 @@ class Scene : public QObject {
 	public:
     static Scene * getInstance ();
     static void destroyInstance ();
+
+    // Scene file loaded by the next getInstance (), before the first one is created
+    static void setSceneFile (const std::string & filename);
+
+    // Whether a scene file that cannot be read gives the default scene (the
+    // default), or its SceneFile::Exception out of getInstance ()
+    static void setDefaultSceneFallback (bool fallback);
     
     inline std::vector<Object> & getObjects () { return objects; }
     inline const std::vector<Object> & getObjects () const { return objects; }
@@ -35,29 +47,114 @@ class Scene : public QObject {
 
 		inline const BoundingBox & getSelectedBoundingBox() const { return selbb; }
 		inline void setSelectedBoundingBox(const BoundingBox & bb) { selbb = bb; };
+
+		// Chunks of out-of-core objects
+		inline GeometryCache & getGeometryCache () { return geometryCache; }
+		inline const GeometryCache & getGeometryCache () const { return geometryCache; }
+
+		// Camera given by the scene file, if any
+		inline const SceneFile::CameraDecl & getCameraHint () const { return cameraHint; }
+
+		// Read a mesh file again and rebuild the objects made from it, and only them
+		void reloadMeshFile (const std::string & path);
+
+		// Change the material of object o. Renders in progress keep the former one.
+		void setMaterial (unsigned int o, const Material & material);
+
+		// Fuzziness of the kD-trees, 10^(-3 + value/8) for a slider value
+		static const int DEFAULT_FUZZINESS = 6;
+		static inline float fuzzinessOf (int value) { return pow (10.f, -3.f + float(value)/8.f); }
+		inline float getFuzziness () const { return fuzziness; }
+
+	signals:
+		// Emitted for each object rebuilt from a changed mesh file or given a
+		// new material, then once they all were, or once their kD-trees were
+		// replaced
+		void objectChanged (int index);
+		void objectsChanged ();
+		// Emitted once the lights were changed
+		void lightsChanged ();
     
 	protected:
     Scene ();
     virtual ~Scene ();
     
 	private:
-    void buildDefaultScene (bool HD);
+    void buildDefaultScene ();
+    void loadSceneFile (const std::string & filename);
+    // Index of the new shape, read from path, empty if it was not read from a file
+    unsigned int addShape (Mesh mesh, const std::string & path);
+    void addObject (unsigned int shape, const Material & mat, const Vec3Df & translation = Vec3Df (0.f, 0.f, 0.f), float size = 0.f);
+    // Centred at translation and scaled to size if size is not 0, only
+    // moved by translation otherwise, as the mesh bounds were read
+    static Object::Placement place (const BoundingBox & bounds, const Vec3Df & translation, float size);
+    void prepareObjects ();
+    unsigned int prepareShape (Shape & shape, unsigned int i);
+    void watchMeshFiles ();
     std::vector<Object> objects;
+    // One shape per mesh, shared by all the objects made from it, which
+    // only the scene changes, and only while it prepares it: renders read
+    // the objects once their shapes are prepared
+    std::vector<std::shared_ptr<Shape> > shapes;
     std::vector<Light> lights;
     BoundingBox bbox;
 		BoundingBox selbb;
+		SceneFile::CameraDecl cameraHint;
+		SceneFile::StreamingDecl streaming;
+		GeometryCache geometryCache;
+		// Of the kD-trees of the objects built from now on, reloads included
+		float fuzziness;
+
+		// Mesh file of each shape, for hot reload, empty for shapes that were
+		// not read from a file, and the bounds of the mesh as it was read
+		struct ShapeSource {
+			std::string path;
+			BoundingBox bounds;
+		};
+		std::vector<ShapeSource> shapeSources;
+
+		// Shape and placement of each object, as declared
+		struct ObjectSource {
+			unsigned int shape;
+			Vec3Df translation;
+			float size;
+		};
+		std::vector<ObjectSource> sources;
+
+		// Shapes prepared so far, in order, and what their preparation saved
+		unsigned int numPrepared;
+		struct PreparationStatistics {
+			size_t before, after;
+			unsigned int welded;
+			PreparationStatistics () : before (0), after (0), welded (0) { }
+		};
+		PreparationStatistics preparation;
+		QFileSystemWatcher watcher;
+		QTimer reloadTimer;
+		std::set<std::string> pendingReloads;
+
+	private slots:
+		void meshFileChanged (const QString & path);
+		void reloadPendingMeshFiles ();
 
 	public slots:
+		// The shapes get new kD-trees rather than rebuilding theirs, since a
+		// render may still be using the former ones
 		void setFuzziness (int f) {
-			float ff = pow (10.f, -3.f + float(f)/8.f);
+			float ff = fuzzinessOf (f);
 			cout << " (I) Setting Fuzziness to " << ff << endl;
-			for (vector<Object>::iterator it = objects.begin(); it != objects.end(); it++) {
+			fuzziness = ff;
+			geometryCache.setFuzziness (ff);
+			for (unsigned int i = 0; i < shapes.size(); i++) {
 				cout << " (I) Rebuilding kD-Tree...";
-				it->getKdTree()->setFuzziness (ff);
-				it->getKdTree()->rebuild();
+				if (shapes[i]->getKdTree() == NULL) continue;
+				shapes[i] = shapes[i]->withFuzziness (ff);
 				cout << "done" << endl;
 			}
+			for (unsigned int i = 0; i < objects.size(); i++)
+				objects[i].setShape (shapes[sources[i].shape], objects[i].getPlacement());
 			cout << endl;
+			emit objectsChanged ();
 		}
 
 		void setRadius (int r) {
@@ -69,15 +166,7 @@ class Scene : public QObject {
 				cout<<"done"<<endl;
 			}
 			cout << endl;
-		}
-		void setAntiAliasing (bool b){
-			if (!b){
-				cout<<"Anti-Aliasing will be disabled..."<<endl;
-			}
-			else{
-				cout<<"Anti-Aliasing will be enabled..."<<endl;
-			}
-			bbox.setAliasing(b);
+			emit lightsChanged ();
 		}
 };
 
@@ -0,0 +1,254 @@
+/**
+ * SceneFile C++ Source code (SceneFile.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "SceneFile.hpp"
+#include <fstream>
+#include <sstream>
+#include <set>
+
+#include "TextureCache.hpp"
+#include "TaskPool.hpp"
+
+/**
+ * Deepest include nesting, which also stops include cycles
+ */
+static const unsigned int MAX_INCLUDE_DEPTH = 16;
+
+/**
+ * Material name that gives each generated object its own random material
+ */
+static const string RANDOM_MATERIAL = "random";
+
+/**
+ * Resolve a path relative to the directory of the file that contains it
+ */
+static string resolvePath (const string & from, const string & path) {
+	if (!path.empty() && path[0] == '/') return path;
+	size_t slash = from.rfind ('/');
+	return (slash == string::npos) ? path : from.substr (0, slash + 1) + path;
+}
+
+void SceneFile::parse (const string & filename) {
+	parseFile (filename, 0);
+	cout << " (I) Parsed " << filename << ": " << objects.size() << " objects, " << meshPaths.size() << " meshes, " << lights.size() << " lights" << endl;
+}
+
+void SceneFile::parseFile (const string & filename, unsigned int depth) {
+	if (depth > MAX_INCLUDE_DEPTH)
+		throw Exception ("Includes nested too deep in " + filename);
+	ifstream input (filename.c_str());
+	if (!input)
+		throw Exception ("Failed opening " + filename);
+
+	string line;
+	for (unsigned int lineNumber = 1; getline (input, line); lineNumber++) {
+		size_t comment = line.find ('#');
+		if (comment != string::npos) line.erase (comment);
+		istringstream in (line);
+		string keyword;
+		if (!(in >> keyword)) continue;
+
+		ostringstream where;
+		where << filename << ":" << lineNumber << ": ";
+
+		if (keyword == "include") {
+			string path;
+			if (!(in >> path)) throw Exception (where.str() + "Expected a file name");
+			parseFile (resolvePath (filename, path), depth + 1);
+		} else if (keyword == "mesh") {
+			string name, path;
+			if (!(in >> name >> path)) throw Exception (where.str() + "Expected a mesh name and file name");
+			meshPaths[name] = resolvePath (filename, path);
+		} else if (keyword == "material") {
+			string name;
+			float diffuse, specular, shine, ior, refract, reflect;
+			Vec3Df color;
+			if (!(in >> name >> diffuse >> specular >> shine >> color >> ior >> refract >> reflect))
+				throw Exception (where.str() + "Expected a material name and 9 values");
+			materials[name] = Material (diffuse, specular, shine, color, ior, refract, reflect);
+		} else if (keyword == "texture") {
+			string name, path;
+			float size;
+			if (!(in >> name >> path >> size) || size <= 0.f) throw Exception (where.str() + "Expected a material name, an image file and a positive size");
+			if (materials.find (name) == materials.end()) throw Exception (where.str() + "Unknown material " + name);
+			materials[name].setTexture (TextureCache::getInstance()->addTexture (resolvePath (filename, path)), size);
+		} else if (keyword == "object") {
+			ObjectDecl o;
+			if (!(in >> o.mesh >> o.material)) throw Exception (where.str() + "Expected a mesh and a material name");
+			if (meshPaths.find (o.mesh) == meshPaths.end()) throw Exception (where.str() + "Unknown mesh " + o.mesh);
+			if (materials.find (o.material) == materials.end()) throw Exception (where.str() + "Unknown material " + o.material);
+			if (!(in >> o.translation)) o.translation = Vec3Df (0.f, 0.f, 0.f);
+			objects.push_back (o);
+		} else if (keyword == "light") {
+			Vec3Df pos, color, orientation;
+			float intensity, radius;
+			if (!(in >> pos >> color >> intensity >> radius >> orientation))
+				throw Exception (where.str() + "Expected 11 light values");
+			lights.push_back (Light (pos, color, intensity, radius, orientation));
+		} else if (keyword == "camera") {
+			if (!(in >> camera.position >> camera.target)) throw Exception (where.str() + "Expected a camera position and target");
+			if (!(in >> camera.fieldOfView)) camera.fieldOfView = 0.f;
+			camera.defined = true;
+		} else if (keyword == "stream") {
+			string directory;
+			if (!(in >> streaming.minTriangles >> streaming.cacheMegabytes >> directory))
+				throw Exception (where.str() + "Expected a triangle count, a cache size and a directory");
+			streaming.directory = resolvePath (filename, directory);
+			streaming.defined = true;
+		} else if (keyword == "seed") {
+			uint64_t seed;
+			if (!(in >> seed)) throw Exception (where.str() + "Expected a seed");
+			generator.setSeed (seed);
+		} else if (keyword == "grid") {
+			string meshList, material;
+			unsigned int nx, ny, nz;
+			float spacing, size;
+			if (!(in >> meshList >> material >> nx >> ny >> nz >> spacing >> size))
+				throw Exception (where.str() + "Expected meshes, a material, 3 counts, a spacing and a size");
+			vector<string> meshes = parseMeshList (meshList, where.str());
+			checkMaterial (material, where.str());
+			for (unsigned int k = 0; k < nz; k++)
+				for (unsigned int j = 0; j < ny; j++)
+					for (unsigned int i = 0; i < nx; i++) {
+						ObjectDecl o;
+						o.mesh = meshes[(i + nx * (j + ny * k)) % meshes.size()];
+						o.material = (material == RANDOM_MATERIAL) ? addRandomMaterial() : material;
+						o.translation = Vec3Df (i - 0.5f * (nx - 1), j - 0.5f * (ny - 1), k - 0.5f * (nz - 1)) * spacing;
+						o.size = size;
+						objects.push_back (o);
+					}
+		} else if (keyword == "scatter") {
+			string meshList, material;
+			unsigned int count;
+			float radius, size;
+			if (!(in >> meshList >> material >> count >> radius >> size))
+				throw Exception (where.str() + "Expected meshes, a material, a count, a radius and a size");
+			vector<string> meshes = parseMeshList (meshList, where.str());
+			checkMaterial (material, where.str());
+			for (unsigned int i = 0; i < count; i++) {
+				ObjectDecl o;
+				o.mesh = meshes[generator.index (meshes.size())];
+				o.material = (material == RANDOM_MATERIAL) ? addRandomMaterial() : material;
+				o.translation = generator.inBall (radius);
+				o.size = size * generator.uniform (0.5f, 1.5f);
+				objects.push_back (o);
+			}
+		} else if (keyword == "lights") {
+			unsigned int count;
+			float radius, intensity;
+			if (!(in >> count >> radius)) throw Exception (where.str() + "Expected a count and a radius");
+			if (!(in >> intensity)) intensity = 1.f;
+			for (unsigned int i = 0; i < count; i++)
+				lights.push_back (generator.randomLight (radius, intensity / count));
+		} else {
+			throw Exception (where.str() + "Unknown statement " + keyword);
+		}
+	}
+}
+
+const Material & SceneFile::getMaterial (const string & name) const {
+	map<string, Material>::const_iterator it = materials.find (name);
+	if (it == materials.end()) throw Exception ("Unknown material " + name);
+	return it->second;
+}
+
+vector<string> SceneFile::parseMeshList (const string & list, const string & where) {
+	vector<string> meshes;
+	istringstream in (list);
+	string name;
+	while (getline (in, name, ',')) {
+		unsigned int segments;
+		if (SceneGenerator::isSphere (name, segments))
+			meshPaths[name] = name;
+		else if (meshPaths.find (name) == meshPaths.end())
+			throw Exception (where + "Unknown mesh " + name);
+		meshes.push_back (name);
+	}
+	if (meshes.empty()) throw Exception (where + "Expected at least one mesh");
+	return meshes;
+}
+
+void SceneFile::checkMaterial (const string & name, const string & where) const {
+	if (name != RANDOM_MATERIAL && materials.find (name) == materials.end())
+		throw Exception (where + "Unknown material " + name);
+}
+
+string SceneFile::addRandomMaterial () {
+	ostringstream name;
+	name << RANDOM_MATERIAL << "#" << materials.size();
+	materials[name.str()] = generator.randomMaterial();
+	return name.str();
+}
+
+string SceneFile::getMeshSource (const string & name) const {
+	map<string, string>::const_iterator it = meshPaths.find (name);
+	if (it == meshPaths.end()) throw Exception ("Unknown mesh " + name);
+	return it->second;
+}
+
+string SceneFile::getMeshPath (const string & name) const {
+	string source = getMeshSource (name);
+	unsigned int segments;
+	return SceneGenerator::isSphere (source, segments) ? string() : source;
+}
+
+/**
+ * Read a mesh file, or generate a procedural mesh
+ */
+static void readMesh (const string & path, Mesh & mesh) {
+	unsigned int segments;
+	if (SceneGenerator::isSphere (path, segments))
+		mesh = SceneGenerator::sphere (segments);
+	else
+		mesh.loadOFF (path);
+}
+
+const Mesh & SceneFile::getMesh (const string & name) {
+	map<string, string>::const_iterator path = meshPaths.find (name);
+	if (path == meshPaths.end()) throw Exception ("Unknown mesh " + name);
+	map<string, Mesh>::iterator it = meshCache.find (path->second);
+	if (it == meshCache.end()) {
+		it = meshCache.insert (make_pair (path->second, Mesh())).first;
+		try {
+			readMesh (path->second, it->second);
+		} catch (const Mesh::Exception & e) {
+			meshCache.erase (it);
+			throw Exception (e.getMessage() + " (" + path->second + ")");
+		}
+	}
+	return it->second;
+}
+
+void SceneFile::loadMeshes () {
+	// Files used by objects and not read yet, each once
+	vector<string> paths;
+	set<string> seen;
+	for (vector<ObjectDecl>::const_iterator o = objects.begin(); o != objects.end(); o++) {
+		map<string, string>::const_iterator path = meshPaths.find (o->mesh);
+		if (path == meshPaths.end()) throw Exception ("Unknown mesh " + o->mesh);
+		if (meshCache.find (path->second) == meshCache.end() && seen.insert (path->second).second)
+			paths.push_back (path->second);
+	}
+
+	vector<Mesh> meshes (paths.size());
+	vector<string> errors (paths.size());
+	TaskPool::getInstance()->parallelFor (0, paths.size(), 1, [&] (unsigned int p) {
+		try {
+			readMesh (paths[p], meshes[p]);
+		} catch (const Mesh::Exception & e) {
+			errors[p] = e.getMessage() + " (" + paths[p] + ")";
+		}
+	});
+	for (unsigned int p = 0; p < paths.size(); p++) {
+		if (!errors[p].empty()) throw Exception (errors[p]);
+		meshCache[paths[p]] = std::move (meshes[p]);
+	}
+}
+
+Mesh SceneFile::takeMesh (const string & name) {
+	getMesh (name);
+	return std::move (meshCache[meshPaths[name]]);
+}
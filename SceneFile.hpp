@@ -0,0 +1,172 @@
+/**
+ * SceneFile C++ Header (SceneFile.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "Light.h"
+#include "Vec3D.h"
+#include "SceneGenerator.hpp"
+
+using namespace std;
+
+/**
+ * SceneFile Class
+ * Text scene description. Each line is a statement, and everything after
+ * a '#' is a comment:
+ *
+ *   include  <file>
+ *   mesh     <name> <file.off>
+ *   material <name> <diffuse> <specular> <shininess> <r> <g> <b> <ior> <refract> <reflect>
+ *   object   <mesh> <material> [<tx> <ty> <tz>]
+ *   light    <x> <y> <z> <r> <g> <b> <intensity> <radius> <ox> <oy> <oz>
+ *   camera   <x> <y> <z> <target x> <target y> <target z> [<field of view, in degrees>]
+ *   texture  <material> <image file> <size of one repeat>
+ *   stream   <min triangles> <cache size, in MB> <chunk directory>
+ *
+ * Procedural statements generate many objects or lights at once, drawing
+ * from a random generator seeded by the last seed statement (1 by default):
+ *
+ *   seed     <n>
+ *   grid     <meshes> <material> <nx> <ny> <nz> <spacing> <size>
+ *   scatter  <meshes> <material> <count> <radius> <size>
+ *   lights   <count> <radius> [<total intensity>]
+ *
+ * <meshes> is a comma-separated list of mesh names, which may also be
+ * procedural spheres such as sphere:64 (64 segments). Grids cycle through
+ * them, scatters pick them at random within a ball of the given radius.
+ * Each object is centred and scaled to the given size, its largest extent
+ * (from half to one and a half times that size for scatters). The
+ * material random gives each object its own random material.
+ *
+ * File paths are relative to the file that contains them. Several objects
+ * may use the same mesh (instances), sharing its geometry in the scene,
+ * each with its own placement; mesh files are only read when an
+ * object asks for them, and at most once per path, so that library files
+ * declaring many meshes cost nothing until they are used.
+ */
+class SceneFile {
+	public:
+		class Exception {
+			public:
+				Exception (const string & msg) : msg ("[SceneFile]" + msg) {}
+				virtual ~Exception () {}
+				inline const string & getMessage () const { return msg; }
+			private:
+				string msg;
+		};
+
+		/**
+		 * Object statement. size is the largest extent the mesh is scaled to,
+		 * around its centre, or 0 to keep the mesh as it is.
+		 */
+		struct ObjectDecl {
+			string mesh;
+			string material;
+			Vec3Df translation;
+			float size;
+			ObjectDecl () : size (0.f) { }
+		};
+
+		/**
+		 * Camera statement. defined is false if the file has none.
+		 */
+		struct CameraDecl {
+			bool defined;
+			Vec3Df position;
+			Vec3Df target;
+			float fieldOfView;
+			CameraDecl () : defined (false), fieldOfView (0.f) { }
+		};
+
+		/**
+		 * Out-of-core statement: objects of at least minTriangles triangles are
+		 * written as chunks to directory, and paged in through a cache of
+		 * cacheMegabytes. defined is false if the file has none.
+		 */
+		struct StreamingDecl {
+			bool defined;
+			unsigned int minTriangles;
+			unsigned int cacheMegabytes;
+			string directory;
+			StreamingDecl () : defined (false), minTriangles (0), cacheMegabytes (0) { }
+		};
+
+		/**
+		 * SceneFile Class Constructor
+		 */
+		SceneFile() { }
+
+		/**
+		 * Parse a scene file and the files it includes. Throws a SceneFile::Exception on error.
+		 */
+		void parse (const string & filename);
+
+		inline const vector<ObjectDecl> & getObjects () const { return objects; }
+		inline const vector<Light> & getLights () const { return lights; }
+		inline const CameraDecl & getCamera () const { return camera; }
+		inline const StreamingDecl & getStreaming () const { return streaming; }
+
+		/**
+		 * Material declared with the given name
+		 */
+		const Material & getMaterial (const string & name) const;
+
+		/**
+		 * File of the mesh declared with the given name, empty for procedural meshes
+		 */
+		string getMeshPath (const string & name) const;
+
+		/**
+		 * Geometry of the mesh declared with the given name, read from disk on first use
+		 */
+		const Mesh & getMesh (const string & name);
+
+		/**
+		 * Read all the mesh files used by objects in parallel, instead of one by
+		 * one as getMesh and takeMesh ask for them
+		 */
+		void loadMeshes ();
+
+		/**
+		 * Same as getMesh, handing the geometry over instead of copying it:
+		 * getMesh returns an empty mesh for that file afterwards. Objects using
+		 * the same file share a single shape built from it, so each file is
+		 * taken once.
+		 */
+		Mesh takeMesh (const string & name);
+
+		/**
+		 * File of the mesh declared with the given name, or its description for
+		 * procedural meshes (e.g. sphere:64): the same for all the names of the
+		 * same geometry
+		 */
+		string getMeshSource (const string & name) const;
+
+		/**
+		 * Number of mesh files actually read so far
+		 */
+		inline unsigned int getNumLoadedMeshes () const { return meshCache.size(); }
+
+	protected:
+		void parseFile (const string & filename, unsigned int depth);
+		vector<string> parseMeshList (const string & list, const string & where);
+		void checkMaterial (const string & name, const string & where) const;
+		string addRandomMaterial ();
+
+		map<string, string> meshPaths;
+		map<string, Material> materials;
+		map<string, Mesh> meshCache;
+		vector<ObjectDecl> objects;
+		vector<Light> lights;
+		CameraDecl camera;
+		StreamingDecl streaming;
+		SceneGenerator generator;
+};
@@ -0,0 +1,100 @@
+/**
+ * SceneGenerator C++ Source code (SceneGenerator.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "SceneGenerator.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+const string SceneGenerator::SPHERE_PREFIX = "sphere:";
+
+void SceneGenerator::setSeed (uint64_t seed) {
+	// Any seed, 0 included, gives a non-zero state
+	state = seed * 0x9E3779B97F4A7C15ull + 0x2545F4914F6CDD1Dull;
+	if (state == 0) state = 1;
+}
+
+float SceneGenerator::uniform () {
+	// xorshift64*, keeping the 24 high bits for a float mantissa
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (float) ((state * 0x2545F4914F6CDD1Dull) >> 40) / (float) (1 << 24);
+}
+
+Vec3Df SceneGenerator::inBall (float radius) {
+	Vec3Df p;
+	do {
+		p = Vec3Df (uniform (-1.f, 1.f), uniform (-1.f, 1.f), uniform (-1.f, 1.f));
+	} while (p.getSquaredLength() > 1.f);
+	return p * radius;
+}
+
+Material SceneGenerator::randomMaterial () {
+	Vec3Df color (uniform (0.2f, 1.f), uniform (0.2f, 1.f), uniform (0.2f, 1.f));
+	float reflect = (uniform() < 0.2f) ? uniform (0.2f, 0.6f) : 0.f;
+	return Material (uniform (0.6f, 1.f), uniform (0.f, 0.5f), uniform (0.5f, 2.f), color, 1.f, 0.f, reflect);
+}
+
+Light SceneGenerator::randomLight (float radius, float intensity) {
+	Vec3Df position;
+	do {
+		position = inBall (1.f);
+	} while (position.getSquaredLength() < 1e-2f);
+	position.normalize();
+	position[1] = fabs (position[1]);
+	position[2] = fabs (position[2]);
+	position *= radius;
+	Vec3Df color (uniform (0.6f, 1.f), uniform (0.6f, 1.f), uniform (0.6f, 1.f));
+	Vec3Df orientation = -position;
+	orientation.normalize();
+	return Light (position, color, intensity, 0.f, orientation);
+}
+
+Mesh SceneGenerator::sphere (unsigned int segments) {
+	if (segments < 4) segments = 4;
+	unsigned int rings = segments / 2;
+	const float PI = 3.1415926535f;
+
+	// Both poles, then rings - 1 rows of segments vertices
+	vector<Vertex> vertices;
+	vertices.reserve (2 + (rings - 1) * segments);
+	vertices.push_back (Vertex (Vec3Df (0.f, 0.f, 1.f), Vec3Df (0.f, 0.f, 1.f)));
+	vertices.push_back (Vertex (Vec3Df (0.f, 0.f, -1.f), Vec3Df (0.f, 0.f, -1.f)));
+	for (unsigned int r = 1; r < rings; r++) {
+		float theta = PI * r / rings;
+		for (unsigned int s = 0; s < segments; s++) {
+			float phi = 2.f * PI * s / segments;
+			Vec3Df p (sin (theta) * cos (phi), sin (theta) * sin (phi), cos (theta));
+			vertices.push_back (Vertex (p, p));
+		}
+	}
+
+	// Counter-clockwise seen from outside
+	vector<Triangle> triangles;
+	triangles.reserve (2 * segments * (rings - 1));
+	for (unsigned int s = 0; s < segments; s++) {
+		unsigned int next = (s + 1) % segments;
+		triangles.push_back (Triangle (0, 2 + s, 2 + next));
+		unsigned int last = 2 + (rings - 2) * segments;
+		triangles.push_back (Triangle (1, last + next, last + s));
+		for (unsigned int r = 0; r + 2 < rings; r++) {
+			unsigned int a = 2 + r * segments, b = a + segments;
+			triangles.push_back (Triangle (a + s, b + s, b + next));
+			triangles.push_back (Triangle (a + s, b + next, a + next));
+		}
+	}
+	return Mesh (std::move (vertices), std::move (triangles));
+}
+
+bool SceneGenerator::isSphere (const string & name, unsigned int & segments) {
+	if (name.compare (0, SPHERE_PREFIX.size(), SPHERE_PREFIX) != 0) return false;
+	char * end;
+	long n = strtol (name.c_str() + SPHERE_PREFIX.size(), &end, 10);
+	if (*end != '\0' || n < 4 || n > 65536) return false;
+	segments = n;
+	return true;
+}
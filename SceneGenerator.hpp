@@ -0,0 +1,81 @@
+/**
+ * SceneGenerator C++ Header (SceneGenerator.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <stdint.h>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "Light.h"
+#include "Vec3D.h"
+
+using namespace std;
+
+/**
+ * SceneGenerator Class
+ * Building blocks of procedural scenes, used by the grid, scatter and
+ * lights statements of scene files: a seeded random number generator,
+ * random materials and lights, and tessellated spheres.
+ *
+ * The generator does not depend on rand() or on the platform, so that a
+ * scene file and its seed always describe the same scene, whatever reads
+ * it and in whatever order other code draws random numbers.
+ */
+class SceneGenerator {
+	public:
+		/**
+		 * Prefix of procedural sphere mesh names: "sphere:64" is a sphere of 64 segments
+		 */
+		static const string SPHERE_PREFIX;
+
+		/**
+		 * SceneGenerator Class Constructor
+		 */
+		SceneGenerator (uint64_t seed = 1) { setSeed (seed); }
+
+		void setSeed (uint64_t seed);
+
+		/**
+		 * Uniform random numbers, in [0, 1), [a, b) and [0, n)
+		 */
+		float uniform ();
+		inline float uniform (float a, float b) { return a + (b - a) * uniform(); }
+		inline unsigned int index (unsigned int n) { return (unsigned int) (uniform() * n) % n; }
+
+		/**
+		 * Uniform random point in the ball of the given radius
+		 */
+		Vec3Df inBall (float radius);
+
+		/**
+		 * Opaque material of random colour, sometimes reflective
+		 */
+		Material randomMaterial ();
+
+		/**
+		 * Light of random colour, above and behind the camera on the sphere of
+		 * the given radius, pointing to its centre. Like all lights, its position
+		 * is in camera coordinates.
+		 */
+		Light randomLight (float radius, float intensity);
+
+		/**
+		 * Unit sphere centred on the origin, with the given number of segments
+		 * around its axis and half as many rings: 2 segments (segments/2 - 1)
+		 * triangles.
+		 */
+		static Mesh sphere (unsigned int segments);
+
+		/**
+		 * True if name is a procedural sphere, whose number of segments is then
+		 * stored in segments
+		 */
+		static bool isSphere (const string & name, unsigned int & segments);
+
+	protected:
+		uint64_t state;
+};
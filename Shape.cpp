@@ -0,0 +1,91 @@
+/**
+ * Shape C++ Source code (Shape.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "Shape.hpp"
+#include "MeshSimplifier.hpp"
+#include <sstream>
+
+Shape::Shape (Mesh m) : mesh (new Mesh (std::move (m))), lods (new vector<Mesh> ()), lodVersion (0) {
+	updateBoundingBox ();
+}
+
+Shape::Shape (const Shape & s, float fuzziness)
+	: mesh (s.mesh), bbox (s.bbox), lods (s.lods), lodErrors (s.lodErrors), lodVersion (s.lodVersion), chunks (s.chunks) {
+	if (s.kdt)
+		kdt.reset (new KDTreeNode (*mesh, fuzziness));
+}
+
+shared_ptr<Shape> Shape::withFuzziness (float fuzziness) const {
+	return shared_ptr<Shape> (new Shape (*this, fuzziness));
+}
+
+void Shape::updateBoundingBox () {
+	if (mesh->getNumVertices () == 0)
+		bbox = BoundingBox ();
+	else {
+		bbox = BoundingBox (mesh->getVertexPos (0));
+		for (unsigned int i = 1; i < mesh->getNumVertices (); i++)
+			bbox.extendTo (mesh->getVertexPos (i));
+	}
+}
+
+void Shape::optimizeLayout (float fuzziness) {
+	// 32 KB of 64-byte lines, about the size of a L1 data cache
+	const unsigned int CACHE_LINES = 512;
+	computeKdTree (fuzziness);
+	unsigned int before = kdt->simulateCacheMisses (CACHE_LINES);
+	vector<unsigned int> triangleMap, vertexMap;
+	mesh->reorderMorton (triangleMap, vertexMap);
+	kdt->remap (triangleMap, vertexMap);
+	unsigned int after = kdt->simulateCacheMisses (CACHE_LINES);
+	// One write, since shapes are prepared in parallel
+	ostringstream message;
+	message << " (I) Morton reordering: " << before << " -> " << after << " simulated cache misses";
+	if (before > 0)
+		message << " (" << 100.f * (float (before) - float (after)) / float (before) << "% less)";
+	cout << message.str () << endl;
+}
+
+void Shape::buildLODChain (unsigned int minTriangles) {
+	lods->clear ();
+	lodErrors.clear ();
+	lodVersion = mesh->getGeometryVersion ();
+	const Mesh * previous = mesh.get ();
+	float error = 0.f;
+	while (previous->getNumTriangles () / 4 >= minTriangles) {
+		Mesh lod;
+		// Errors add up, since each level is simplified from the previous one
+		error += MeshSimplifier (*previous).simplify (previous->getNumTriangles () / 4, lod);
+		if (lod.getNumTriangles () >= previous->getNumTriangles ())
+			break;
+		lods->push_back (std::move (lod));
+		lodErrors.push_back (error);
+		previous = &lods->back ();
+	}
+	if (!lods->empty ())
+		cout << " (I) Built " << lods->size () << " levels of detail for " << mesh->getNumTriangles () << " triangles" << endl;
+}
+
+const Mesh & Shape::selectLOD (float maxError) const {
+	if (lodVersion != mesh->getGeometryVersion ())
+		return *mesh;
+	// Out-of-core shapes have no full-resolution mesh in memory
+	unsigned int level = (isOutOfCore () && !lods->empty ()) ? 1 : 0;
+	while (level < lods->size () && lodErrors[level] <= maxError)
+		level++;
+	return getLOD (level);
+}
+
+void Shape::makeOutOfCore (const string & prefix, unsigned int trianglesPerChunk, GeometryCache & cache) {
+	mesh->updateSmoothVertexNormals (1);
+	chunks.build (*mesh, prefix, trianglesPerChunk, cache);
+	bbox = chunks.getBoundingBox ();
+	kdt.reset ();
+	bool lodsValid = (lodVersion == mesh->getGeometryVersion ());
+	mesh->clear ();
+	if (lodsValid)
+		lodVersion = mesh->getGeometryVersion ();
+}
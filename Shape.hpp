@@ -0,0 +1,125 @@
+/**
+ * Shape C++ Header (Shape.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "Mesh.h"
+#include "KDTreeNode.hpp"
+#include "BoundingBox.h"
+#include "ChunkedMesh.hpp"
+
+using namespace std;
+
+/**
+ * Shape Class
+ * Geometry of objects, with everything built from it for rendering: the
+ * kD-tree, the levels of detail and the out-of-core chunks.
+ *
+ * A shape is prepared by the scene, then shared by objects and by the
+ * snapshots of renders, and never changes once they do: the scene makes
+ * a new shape instead, e.g. when its mesh file changes, and renders keep
+ * the former one until they end.
+ */
+class Shape {
+	public:
+		/**
+		 * Shape Class Constructor. Pass the mesh as an rvalue (std::move) to
+		 * hand it over without copying.
+		 */
+		explicit Shape (Mesh mesh);
+
+		// Shapes own their kD-tree: they are shared, not copied
+		Shape (const Shape & s) = delete;
+		Shape & operator= (const Shape & s) = delete;
+
+		inline const Mesh & getMesh () const { return *mesh; }
+
+		/**
+		 * Mesh to prepare: only while no object uses the shape yet
+		 */
+		inline Mesh & getMesh () { return *mesh; }
+
+		inline const BoundingBox & getBoundingBox () const { return bbox; }
+		void updateBoundingBox ();
+
+		inline void computeKdTree (float fuzziness) {
+			if (!kdt) {
+				cout << " (I) Building KD-Tree..." << endl;
+				kdt.reset (new KDTreeNode (*mesh, fuzziness));
+			}
+		}
+		inline const KDTreeNode * getKdTree () const { return kdt.get(); }
+
+		/**
+		 * The same shape with a kD-tree of another fuzziness, sharing the
+		 * mesh and levels of detail of this one
+		 */
+		shared_ptr<Shape> withFuzziness (float fuzziness) const;
+
+		/**
+		 * Reorder the mesh along a space-filling curve for memory locality,
+		 * keeping the kD-tree in sync, and report the simulated cache misses
+		 * of a traversal before and after. The kD-tree is built first with
+		 * the given fuzziness if there is none.
+		 */
+		void optimizeLayout (float fuzziness);
+
+		/**
+		 * Build a chain of levels of detail by quadric simplification, each level
+		 * having a quarter of the triangles of the previous one, down to about
+		 * minTriangles. Level 0 is the mesh itself.
+		 */
+		void buildLODChain (unsigned int minTriangles = LOD_MIN_TRIANGLES);
+
+		inline unsigned int getNumLODs () const { return 1 + lods->size(); }
+		inline const Mesh & getLOD (unsigned int level) const { return (level == 0) ? *mesh : (*lods)[level-1]; }
+		inline float getLODError (unsigned int level) const { return (level == 0) ? 0.f : lodErrors[level-1]; }
+
+		/**
+		 * Coarsest level of detail whose geometric error is at most maxError, in
+		 * the units of the mesh. Callers derive maxError from their own projection,
+		 * e.g. a number of pixels times the size of a pixel at the object distance.
+		 * Returns the full mesh if it changed since the chain was built.
+		 */
+		const Mesh & selectLOD (float maxError) const;
+
+		/**
+		 * Smallest level of detail built by default
+		 */
+		static const unsigned int LOD_MIN_TRIANGLES = 256;
+
+		/**
+		 * Move the geometry to disk, as chunks of trianglesPerChunk triangles
+		 * paged in through cache. The in-memory mesh and kD-tree are freed;
+		 * levels of detail are kept for the preview.
+		 */
+		void makeOutOfCore (const string & prefix, unsigned int trianglesPerChunk, GeometryCache & cache);
+		inline bool isOutOfCore () const { return !chunks.empty(); }
+		inline const ChunkedMesh & getChunkedMesh () const { return chunks; }
+
+		/**
+		 * Shading normal of a ray hit, in memory or out-of-core
+		 */
+		inline Vec3Df interpolateNormal (unsigned int t, float iu, float iv) const {
+			return chunks.empty() ? mesh->interpolateNormal (t, iu, iv) : chunks.interpolateNormal (t, iu, iv);
+		}
+
+	protected:
+		Shape (const Shape & s, float fuzziness);
+
+		// Shared with the shapes of other fuzziness made from this one, whose
+		// kD-trees point to the same mesh
+		shared_ptr<Mesh> mesh;
+		BoundingBox bbox;
+		unique_ptr<KDTreeNode> kdt;
+		shared_ptr<vector<Mesh> > lods;
+		vector<float> lodErrors;
+		unsigned int lodVersion;
+		ChunkedMesh chunks;
+};
@@ -0,0 +1,169 @@
+/**
+ * TaskPool C++ Source code (TaskPool.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "TaskPool.hpp"
+#include <iostream>
+#include <QMutexLocker>
+
+static TaskPool * instance = NULL;
+
+// Index of the worker running on this thread
+static thread_local int workerIndex = -1;
+
+// Longest sleep of an idle thread, in milliseconds, should a wake-up be missed
+static const unsigned long MAX_SLEEP = 100;
+
+TaskPool * TaskPool::getInstance () {
+	if (instance == NULL) {
+		// The thread that waits for a group runs tasks too
+		int threads = QThread::idealThreadCount ();
+		instance = new TaskPool (threads > 1 ? threads - 1 : 1);
+	}
+	return instance;
+}
+
+void TaskPool::destroyInstance () {
+	if (instance != NULL) {
+		delete instance;
+		instance = NULL;
+	}
+}
+
+int TaskPool::currentWorker () {
+	return workerIndex;
+}
+
+TaskPool::TaskPool (unsigned int numWorkers) : queued (0), sleepers (0), stopping (false) {
+	// One queue per worker, and a last one shared by all other threads
+	for (unsigned int w = 0; w <= numWorkers; w++) queues.push_back (new Queue);
+	for (unsigned int w = 0; w < numWorkers; w++) {
+		workers.push_back (new Worker (*this, w));
+		workers.back()->start ();
+	}
+	cout << " (I) Task pool: " << numWorkers << " worker threads" << endl;
+}
+
+TaskPool::~TaskPool () {
+	{
+		QMutexLocker locker (&sleepMutex);
+		stopping = true;
+		wakeUp.wakeAll ();
+	}
+	for (vector<Worker *>::iterator w = workers.begin(); w != workers.end(); w++) {
+		(*w)->wait ();
+		delete *w;
+	}
+	for (vector<Queue *>::iterator q = queues.begin(); q != queues.end(); q++) delete *q;
+}
+
+TaskPool::Group::~Group () {
+	try {
+		wait ();
+	} catch (...) {
+	}
+}
+
+void TaskPool::Group::run (const function<void ()> & task) {
+	pending++;
+	Task t;
+	t.run = task;
+	t.group = this;
+	pool.push (t);
+}
+
+void TaskPool::Group::wait () {
+	int worker = currentWorker ();
+	while (pending.load (memory_order_acquire) > 0)
+		if (!pool.runOne (worker)) pool.sleep (this);
+
+	QMutexLocker locker (&errorMutex);
+	if (error) {
+		exception_ptr e = error;
+		error = exception_ptr ();
+		rethrow_exception (e);
+	}
+}
+
+void TaskPool::push (const Task & task) {
+	int worker = currentWorker ();
+	Queue & queue = *queues[worker >= 0 ? worker : workers.size()];
+	{
+		QMutexLocker locker (&queue.mutex);
+		queue.tasks.push_back (task);
+	}
+	queued++;
+	if (sleepers > 0) {
+		QMutexLocker locker (&sleepMutex);
+		wakeUp.wakeOne ();
+	}
+}
+
+bool TaskPool::pop (int worker, Task & task) {
+	// Newest task of our own queue, or of the shared one for other threads
+	unsigned int own = (worker >= 0) ? worker : workers.size();
+	{
+		Queue & queue = *queues[own];
+		QMutexLocker locker (&queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			return true;
+		}
+	}
+
+	// Else steal the oldest task of the next queue that has some
+	for (unsigned int i = 1; i < queues.size(); i++) {
+		Queue & queue = *queues[(own + i) % queues.size()];
+		QMutexLocker locker (&queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TaskPool::runOne (int worker) {
+	if (queued == 0) return false;
+	Task task;
+	if (!pop (worker, task)) return false;
+	queued--;
+	execute (task);
+	return true;
+}
+
+void TaskPool::execute (Task & task) {
+	Group & group = *task.group;
+	try {
+		task.run ();
+	} catch (...) {
+		QMutexLocker locker (&group.errorMutex);
+		if (!group.error) group.error = current_exception ();
+	}
+	task.run = function<void ()> ();
+
+	// The group may be destroyed as soon as pending reaches 0
+	if (--group.pending == 0 && sleepers > 0) {
+		QMutexLocker locker (&sleepMutex);
+		wakeUp.wakeAll ();
+	}
+}
+
+void TaskPool::sleep (const Group * group) {
+	// Sleep until a task is pushed, the group (if any) is done, or the pool stops
+	QMutexLocker locker (&sleepMutex);
+	sleepers++;
+	if (queued == 0 && !stopping && (group == NULL || group->pending > 0))
+		wakeUp.wait (&sleepMutex, MAX_SLEEP);
+	sleepers--;
+}
+
+void TaskPool::work (unsigned int index) {
+	workerIndex = index;
+	while (!stopping)
+		if (!runOne (index)) sleep (NULL);
+}
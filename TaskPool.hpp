@@ -0,0 +1,202 @@
+/**
+ * TaskPool C++ Header (TaskPool.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+using namespace std;
+
+/**
+ * TaskPool Class
+ * Persistent pool of worker threads, shared by everything that runs in
+ * parallel: loading, normals, kD-tree builds, point clouds and rendering.
+ *
+ * Tasks are run in groups. A worker pushes its tasks on its own queue and
+ * takes the most recent one back first, while idle workers steal the
+ * oldest tasks of the others, which are the largest pieces of recursively
+ * split work. Tasks may start groups of their own: waiting for a group
+ * runs other tasks meanwhile instead of blocking, so nested parallel loops
+ * share the same threads instead of starting new ones. Threads that are
+ * not workers (the interface, the render thread) push on a shared queue,
+ * and help in the same way while they wait.
+ *
+ * An exception thrown by a task is rethrown by Group::wait.
+ */
+class TaskPool {
+	public:
+		/**
+		 * Fewest iterations per task of parallelFor and parallelReduce without
+		 * an explicit grain
+		 */
+		static const unsigned int MIN_GRAIN = 1024;
+
+		/**
+		 * Ranges sorted without splitting them further
+		 */
+		static const unsigned int SORT_GRAIN = 16384;
+
+		/**
+		 * Set of tasks waited for together
+		 */
+		class Group {
+			public:
+				Group (TaskPool & pool = *TaskPool::getInstance()) : pool (pool), pending (0) { }
+
+				/**
+				 * Waits for the tasks still running. Their exceptions are lost:
+				 * call wait to get them.
+				 */
+				~Group ();
+
+				void run (const function<void ()> & task);
+
+				/**
+				 * Run tasks until all the tasks of the group are done
+				 */
+				void wait ();
+
+			private:
+				Group (const Group &);
+				Group & operator= (const Group &);
+				friend class TaskPool;
+				TaskPool & pool;
+				atomic<unsigned int> pending;
+				exception_ptr error;
+				QMutex errorMutex;
+		};
+
+		static TaskPool * getInstance ();
+		static void destroyInstance ();
+
+		/**
+		 * Threads running tasks: the workers, and the thread waiting for them
+		 */
+		inline unsigned int getNumThreads () const { return workers.size() + 1; }
+
+		/**
+		 * Index of the calling worker, or -1 if it is not a worker of any pool
+		 */
+		static int currentWorker ();
+
+		/**
+		 * Call body (i) for each i in [begin, end), in tasks of at least grain
+		 * iterations
+		 */
+		template <class Body> void parallelFor (unsigned int begin, unsigned int end, unsigned int grain, const Body & body);
+		template <class Body> inline void parallelFor (unsigned int begin, unsigned int end, const Body & body) {
+			parallelFor (begin, end, defaultGrain (begin, end), body);
+		}
+
+		/**
+		 * combine (... combine (combine (identity, body (begin)), body (begin+1)) ..., body (end-1)),
+		 * with combine associative, and its calls grouped in tasks of at least
+		 * grain iterations. The grouping only depends on the range and grain, so
+		 * the result is the same on any number of threads.
+		 */
+		template <class T, class Body, class Combine> T parallelReduce (unsigned int begin, unsigned int end, unsigned int grain, const T & identity, const Body & body, const Combine & combine);
+		template <class T, class Body, class Combine> inline T parallelReduce (unsigned int begin, unsigned int end, const T & identity, const Body & body, const Combine & combine) {
+			return parallelReduce (begin, end, defaultGrain (begin, end), identity, body, combine);
+		}
+
+		/**
+		 * Sort [begin, end) with operator<, sorting halves in parallel and merging them
+		 */
+		template <class Iterator> void parallelSort (Iterator begin, Iterator end);
+
+	protected:
+		struct Task {
+			function<void ()> run;
+			Group * group;
+		};
+
+		struct Queue {
+			QMutex mutex;
+			deque<Task> tasks;
+		};
+
+		class Worker : public QThread {
+			public:
+				Worker (TaskPool & pool, unsigned int index) : pool (pool), index (index) { }
+			protected:
+				virtual void run () { pool.work (index); }
+			private:
+				TaskPool & pool;
+				unsigned int index;
+		};
+
+		TaskPool (unsigned int numWorkers);
+		~TaskPool ();
+
+		inline unsigned int defaultGrain (unsigned int begin, unsigned int end) const {
+			return max (MIN_GRAIN, (end - begin) / (8 * getNumThreads()));
+		}
+
+		void push (const Task & task);
+		bool pop (int worker, Task & task);
+		bool runOne (int worker);
+		void execute (Task & task);
+		void sleep (const Group * group);
+		void work (unsigned int index);
+
+		vector<Worker *> workers;
+		vector<Queue *> queues;
+		atomic<unsigned int> queued;
+		atomic<unsigned int> sleepers;
+		atomic<bool> stopping;
+		QMutex sleepMutex;
+		QWaitCondition wakeUp;
+};
+
+template <class Body> void TaskPool::parallelFor (unsigned int begin, unsigned int end, unsigned int grain, const Body & body) {
+	if (end <= begin) return;
+	if (grain == 0) grain = 1;
+	Group group (*this);
+	// Hand out the upper halves, and keep splitting the lower one
+	while (end - begin > grain) {
+		unsigned int middle = begin + (end - begin) / 2;
+		group.run ([this, middle, end, grain, &body] () { parallelFor (middle, end, grain, body); });
+		end = middle;
+	}
+	for (unsigned int i = begin; i < end; i++) body (i);
+	group.wait ();
+}
+
+template <class T, class Body, class Combine> T TaskPool::parallelReduce (unsigned int begin, unsigned int end, unsigned int grain, const T & identity, const Body & body, const Combine & combine) {
+	if (grain == 0) grain = 1;
+	if (end <= begin || end - begin <= grain) {
+		T result = identity;
+		for (unsigned int i = begin; i < end; i++) result = combine (result, body (i));
+		return result;
+	}
+	unsigned int middle = begin + (end - begin) / 2;
+	T upper = identity;
+	Group group (*this);
+	group.run ([&] () { upper = parallelReduce (middle, end, grain, identity, body, combine); });
+	T lower = parallelReduce (begin, middle, grain, identity, body, combine);
+	group.wait ();
+	return combine (lower, upper);
+}
+
+template <class Iterator> void TaskPool::parallelSort (Iterator begin, Iterator end) {
+	if (end - begin <= (long) SORT_GRAIN) {
+		sort (begin, end);
+		return;
+	}
+	Iterator middle = begin + (end - begin) / 2;
+	Group group (*this);
+	group.run ([this, middle, end] () { parallelSort (middle, end); });
+	parallelSort (begin, middle);
+	group.wait ();
+	inplace_merge (begin, middle, end);
+}
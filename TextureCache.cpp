@@ -0,0 +1,275 @@
+/**
+ * TextureCache C++ Source code (TextureCache.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "TextureCache.hpp"
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <unistd.h>
+#include <QImage>
+#include <QDir>
+#include <QMutexLocker>
+
+static TextureCache * instance = NULL;
+
+TextureCache * TextureCache::getInstance () {
+	if (instance == NULL)
+		instance = new TextureCache ();
+	return instance;
+}
+
+void TextureCache::destroyInstance () {
+	if (instance != NULL) {
+		delete instance;
+		instance = NULL;
+	}
+}
+
+TextureCache::TextureCache () : epoch (0), hand (0), budget (DEFAULT_BUDGET), bytesUsed (0), misses (0), evictions (0), failures (0) {
+	active[0] = 0;
+	active[1] = 0;
+}
+
+TextureCache::~TextureCache () {
+	collect();
+	for (vector<Texture *>::iterator t = textures.begin(); t != textures.end(); t++) {
+		for (vector<atomic<Tile *> >::iterator tile = (*t)->tiles.begin(); tile != (*t)->tiles.end(); tile++)
+			if (*tile != NULL) delete tile->load ();
+		(*t)->file.close();
+		if (!(*t)->tiledPath.empty()) remove ((*t)->tiledPath.c_str());
+		delete *t;
+	}
+}
+
+unsigned int TextureCache::addTexture (const string & path) {
+	QMutexLocker locker (&mutex);
+	for (unsigned int t = 0; t < textures.size(); t++)
+		if (textures[t]->path == path) return t;
+	Texture * texture = new Texture;
+	texture->id = textures.size();
+	texture->path = path;
+	textures.push_back (texture);
+	return textures.size() - 1;
+}
+
+static inline unsigned int average (unsigned int a, unsigned int b, unsigned int c, unsigned int d) {
+	return qRgb ((qRed (a) + qRed (b) + qRed (c) + qRed (d) + 2) / 4,
+		(qGreen (a) + qGreen (b) + qGreen (c) + qGreen (d) + 2) / 4,
+		(qBlue (a) + qBlue (b) + qBlue (c) + qBlue (d) + 2) / 4);
+}
+
+void TextureCache::prepare (Texture & texture) {
+	// Called with the preparing mutex of the texture held only. A missing
+	// image becomes a white texel, so that the material colour shows through.
+	QImage image (texture.path.c_str());
+	unsigned int width = 1, height = 1;
+	vector<unsigned int> texels (1, qRgb (255, 255, 255));
+	if (image.isNull())
+		cerr << " (W) Failed loading texture " << texture.path << endl;
+	else {
+		image = image.convertToFormat (QImage::Format_RGB32);
+		width = image.width();
+		height = image.height();
+		texels.resize (width*height);
+		for (unsigned int y = 0; y < height; y++)
+			for (unsigned int x = 0; x < width; x++) texels[y*width + x] = image.pixel (x, y);
+	}
+
+	// Write each MIP level, tile by tile, each level being a 2x2 box filter of the previous one
+	ostringstream tiledPath;
+	tiledPath << QDir::tempPath().toStdString() << "/renderboy-" << getpid() << "-" << texture.id << ".tiles";
+	texture.tiledPath = tiledPath.str();
+	ofstream output (texture.tiledPath.c_str(), ios::binary);
+	unsigned int numTiles = 0;
+	Tile tile;
+	while (true) {
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		level.firstTile = numTiles;
+		texture.levels.push_back (level);
+		unsigned int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		for (unsigned int ty = 0; ty < tilesY; ty++)
+			for (unsigned int tx = 0; tx < level.tilesX; tx++) {
+				// Texels past the border repeat the last row and column
+				for (unsigned int y = 0; y < TILE_SIZE; y++)
+					for (unsigned int x = 0; x < TILE_SIZE; x++)
+						tile.texels[y*TILE_SIZE + x] = texels[min (ty*TILE_SIZE + y, height-1)*width + min (tx*TILE_SIZE + x, width-1)];
+				output.write ((const char *) &tile, sizeof (tile));
+				numTiles++;
+			}
+		if (width == 1 && height == 1) break;
+
+		unsigned int w = max (width/2, 1u), h = max (height/2, 1u);
+		vector<unsigned int> next (w*h);
+		for (unsigned int y = 0; y < h; y++)
+			for (unsigned int x = 0; x < w; x++) {
+				unsigned int x0 = min (2*x, width-1), x1 = min (2*x+1, width-1);
+				unsigned int y0 = min (2*y, height-1), y1 = min (2*y+1, height-1);
+				next[y*w + x] = average (texels[y0*width + x0], texels[y0*width + x1], texels[y1*width + x0], texels[y1*width + x1]);
+			}
+		texels.swap (next);
+		width = w;
+		height = h;
+	}
+	output.close();
+	if (!output) {
+		fail (texture, "Failed writing " + texture.tiledPath);
+		return;
+	}
+
+	vector<atomic<Tile *> > (numTiles).swap (texture.tiles);
+	vector<atomic<bool> > (numTiles).swap (texture.referenced);
+	texture.file.open (texture.tiledPath.c_str(), ios::binary);
+	cout << " (I) Tiled texture " << texture.path << ": " << texture.levels.size() << " MIP levels, " << numTiles << " tiles" << endl;
+}
+
+void TextureCache::fail (Texture & texture, const string & message) {
+	QMutexLocker locker (&mutex);
+	if (texture.failed) return;
+	texture.failed.store (true, memory_order_relaxed);
+	failures++;
+	cerr << " (W) " << message << ", sampling it as white" << endl;
+}
+
+const TextureCache::Tile * TextureCache::loadTile (Texture & texture, unsigned int t) {
+	{
+		QMutexLocker locker (&mutex);
+		if (texture.tiles[t] != NULL) return texture.tiles[t];
+
+		Tile * tile = new Tile;
+		texture.file.clear();
+		texture.file.seekg ((streamoff) t * sizeof (Tile));
+		if (texture.file.read ((char *) tile, sizeof (Tile))) {
+			misses++;
+			texture.referenced[t].store (true, memory_order_relaxed);
+			texture.tiles[t].store (tile, memory_order_release);
+			resident.push_back (make_pair (texture.id, t));
+			bytesUsed += sizeof (Tile);
+			reclaim();
+			evict();
+			return tile;
+		}
+		delete tile;
+	}
+	fail (texture, "Failed reading a tile of " + texture.path);
+	return NULL;
+}
+
+void TextureCache::evict () {
+	// Called with the mutex held. Sweep the resident tiles, giving a second
+	// chance to the ones read since the last sweep. A slow sample may keep
+	// evicted tiles from being freed: stop evicting while they take up the
+	// whole budget, and exceed it instead until they are freed.
+	while (bytesUsed > budget && !resident.empty() && (retired[0].size() + retired[1].size()) * sizeof (Tile) < budget) {
+		if (hand >= resident.size()) hand = 0;
+		Texture & texture = *textures[resident[hand].first];
+		unsigned int t = resident[hand].second;
+		if (texture.referenced[t].exchange (false, memory_order_relaxed)) {
+			hand++;
+			continue;
+		}
+		retired[epoch & 1].push_back (texture.tiles[t]);
+		texture.tiles[t] = NULL;
+		resident[hand] = resident.back();
+		resident.pop_back();
+		bytesUsed -= sizeof (Tile);
+		evictions++;
+	}
+}
+
+void TextureCache::reclaim () {
+	// Called with the mutex held. Samples of the epoch before this one are
+	// the last that may hold the tiles evicted then: once they are all done,
+	// free those tiles and start the next epoch, which reuses their slot.
+	unsigned int previous = (epoch - 1) & 1;
+	if (active[previous] != 0) return;
+	for (vector<Tile *>::iterator tile = retired[previous].begin(); tile != retired[previous].end(); tile++) delete *tile;
+	retired[previous].clear();
+	epoch++;
+}
+
+inline unsigned int TextureCache::enter () {
+	// Count in the epoch read, unless it changed meanwhile
+	while (true) {
+		unsigned int e = epoch;
+		active[e & 1]++;
+		if (epoch == e) return e;
+		active[e & 1]--;
+	}
+}
+
+inline void TextureCache::leave (unsigned int e) {
+	active[e & 1]--;
+}
+
+inline unsigned int TextureCache::texel (Texture & texture, const Level & level, int x, int y) {
+	x %= (int) level.width;
+	y %= (int) level.height;
+	if (x < 0) x += level.width;
+	if (y < 0) y += level.height;
+	unsigned int t = level.firstTile + (y / TILE_SIZE) * level.tilesX + x / TILE_SIZE;
+	const Tile * tile = texture.tiles[t].load (memory_order_acquire);
+	if (tile == NULL) {
+		tile = loadTile (texture, t);
+		if (tile == NULL) return qRgb (255, 255, 255);
+	} else if (!texture.referenced[t].load (memory_order_relaxed))
+		texture.referenced[t].store (true, memory_order_relaxed);
+	return tile->texels[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+Vec3Df TextureCache::sample (unsigned int id, float u, float v, float footprint) {
+	Texture & texture = *textures[id];
+	if (!texture.ready.load (memory_order_acquire)) {
+		QMutexLocker locker (&texture.preparing);
+		if (!texture.ready) {
+			prepare (texture);
+			texture.ready.store (true, memory_order_release);
+		}
+	}
+	if (texture.failed.load (memory_order_relaxed)) return Vec3Df (1.f, 1.f, 1.f);
+
+	// Level whose texels are about as large as the footprint
+	float texels = footprint * max (texture.levels[0].width, texture.levels[0].height);
+	unsigned int l = (texels > 1.f) ? min ((unsigned int) (log (texels) / log (2.f)), (unsigned int) texture.levels.size() - 1) : 0;
+	const Level & level = texture.levels[l];
+
+	float x = (u - floor (u)) * level.width - 0.5f, y = (v - floor (v)) * level.height - 0.5f;
+	int x0 = (int) floor (x), y0 = (int) floor (y);
+	float fx = x - x0, fy = y - y0;
+	unsigned int e = enter();
+	unsigned int c00 = texel (texture, level, x0, y0), c10 = texel (texture, level, x0+1, y0);
+	unsigned int c01 = texel (texture, level, x0, y0+1), c11 = texel (texture, level, x0+1, y0+1);
+	leave (e);
+	Vec3Df c;
+	c[0] = (1-fy) * ((1-fx) * qRed (c00) + fx * qRed (c10)) + fy * ((1-fx) * qRed (c01) + fx * qRed (c11));
+	c[1] = (1-fy) * ((1-fx) * qGreen (c00) + fx * qGreen (c10)) + fy * ((1-fx) * qGreen (c01) + fx * qGreen (c11));
+	c[2] = (1-fy) * ((1-fx) * qBlue (c00) + fx * qBlue (c10)) + fy * ((1-fx) * qBlue (c01) + fx * qBlue (c11));
+	return c / 255.f;
+}
+
+void TextureCache::collect () {
+	QMutexLocker locker (&mutex);
+	for (unsigned int r = 0; r < 2; r++) {
+		for (vector<Tile *>::iterator tile = retired[r].begin(); tile != retired[r].end(); tile++) delete *tile;
+		retired[r].clear();
+	}
+}
+
+void TextureCache::setBudget (unsigned long bytes) {
+	QMutexLocker locker (&mutex);
+	budget = bytes;
+	evict();
+}
+
+void TextureCache::printStatistics () const {
+	QMutexLocker locker (&mutex);
+	cout << " (I) Texture cache: " << misses << " tiles read, " << evictions << " evictions, "
+		<< bytesUsed / 1024 << " KB used (budget " << budget / 1024 << " KB)" << endl;
+	if (failures > 0)
+		cerr << " (W) Texture cache: " << failures << " textures could not be tiled or read, sampled as white" << endl;
+}
@@ -0,0 +1,155 @@
+/**
+ * TextureCache C++ Header (TextureCache.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <atomic>
+#include <QMutex>
+
+#include "Vec3D.h"
+
+using namespace std;
+
+/**
+ * TextureCache Class
+ * Textures shared by all materials. The first time a texture is sampled,
+ * its image is decoded once, MIP-mapped and written to a tiled file; tiles
+ * of TILE_SIZE x TILE_SIZE texels are then paged in from that file on
+ * demand, and evicted under a fixed memory budget.
+ *
+ * Sampling takes no lock when the tiles it needs are in memory: tiles are
+ * published through atomic pointers, and reads only set a reference bit,
+ * which eviction uses to find the least recently used tiles (CLOCK
+ * algorithm). Misses are serialized by a mutex; decoding an image only
+ * locks its own texture. Evicted tiles are freed once every sample that
+ * started before their eviction is done: samples count themselves in the
+ * current epoch, and a miss moves to the next epoch once the samples of
+ * the previous one are all done, freeing the tiles evicted then. Evicted
+ * tiles waiting to be freed never take more than the budget: past that,
+ * the cache holds more than its budget until they are freed.
+ *
+ * Sampling never throws, as it runs on the threads of a render: a texture
+ * whose tiles cannot be written or read is reported once, and samples as
+ * white from then on, so that the material colour shows through. The
+ * tiled files are deleted with the cache.
+ */
+class TextureCache {
+	public:
+		class Exception {
+			public:
+				Exception (const string & msg) : msg ("[TextureCache]" + msg) {}
+				virtual ~Exception () {}
+				inline const string & getMessage () const { return msg; }
+			private:
+				string msg;
+		};
+
+		/**
+		 * Id of no texture
+		 */
+		static const unsigned int NO_TEXTURE = (unsigned int)-1;
+
+		/**
+		 * Tile width and height, in texels
+		 */
+		static const unsigned int TILE_SIZE = 32;
+
+		/**
+		 * Default budget, in bytes
+		 */
+		static const unsigned long DEFAULT_BUDGET = 64ul << 20;
+
+		static TextureCache * getInstance ();
+		static void destroyInstance ();
+
+		/**
+		 * Register the texture of the given image file, once per path, and return its id.
+		 * Nothing is read until the texture is first sampled.
+		 */
+		unsigned int addTexture (const string & path);
+
+		/**
+		 * Bilinear sample of a texture at (u, v), wrapped to [0, 1), from the MIP
+		 * level that matches footprint, the size of the sampled area in the same
+		 * units as u and v.
+		 */
+		Vec3Df sample (unsigned int texture, float u, float v, float footprint);
+
+		/**
+		 * Free evicted tiles. Only call it when no thread is sampling.
+		 */
+		void collect ();
+
+		void setBudget (unsigned long bytes);
+		inline unsigned long getBudget () const { return budget; }
+
+		/**
+		 * Statistics: a miss is a tile read from its file
+		 */
+		inline unsigned long getMisses () const { return misses; }
+		inline unsigned long getEvictions () const { return evictions; }
+		inline unsigned long getBytesUsed () const { return bytesUsed; }
+
+		/**
+		 * Number of textures that could not be tiled or read back
+		 */
+		inline unsigned int getNumFailures () const { return failures; }
+		void printStatistics () const;
+
+	protected:
+		struct Tile {
+			unsigned int texels[TILE_SIZE*TILE_SIZE];
+		};
+
+		struct Level {
+			unsigned int width;
+			unsigned int height;
+			unsigned int tilesX;
+			unsigned int firstTile;
+		};
+
+		struct Texture {
+			unsigned int id;
+			string path;
+			string tiledPath;
+			atomic<bool> ready;
+			atomic<bool> failed;
+			QMutex preparing;
+			vector<Level> levels;
+			vector<atomic<Tile *> > tiles;
+			vector<atomic<bool> > referenced;
+			ifstream file;
+			Texture () : ready (false), failed (false) { }
+		};
+
+		TextureCache ();
+		~TextureCache ();
+
+		void prepare (Texture & texture);
+		void fail (Texture & texture, const string & message);
+		const Tile * loadTile (Texture & texture, unsigned int tile);
+		void evict ();
+		void reclaim ();
+		unsigned int enter ();
+		void leave (unsigned int e);
+		unsigned int texel (Texture & texture, const Level & level, int x, int y);
+
+		vector<Texture *> textures;
+		vector<pair<unsigned int, unsigned int> > resident;
+		// Tiles evicted in an epoch, by parity, and the samples running in it
+		vector<Tile *> retired[2];
+		atomic<int> active[2];
+		atomic<unsigned int> epoch;
+		unsigned int hand;
+		unsigned long budget;
+		unsigned long bytesUsed;
+		unsigned long misses;
+		unsigned long evictions;
+		unsigned int failures;
+		mutable QMutex mutex;
+};
@@ -0,0 +1,81 @@
+/**
+ * TileScheduler C++ Source code (TileScheduler.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include "TileScheduler.hpp"
+#include <algorithm>
+
+TileScheduler::TileScheduler (unsigned int width, unsigned int height, unsigned int numWorkers) : tiles (split (Tile { 0, 0, width, height })), steals (0) {
+	distribute (numWorkers);
+}
+
+TileScheduler::TileScheduler (const Tile & region, unsigned int numWorkers) : tiles (split (region)), steals (0) {
+	distribute (numWorkers);
+}
+
+TileScheduler::TileScheduler (const vector<Tile> & tiles, unsigned int numWorkers) : tiles (tiles), steals (0) {
+	distribute (numWorkers);
+}
+
+vector<TileScheduler::Tile> TileScheduler::split (const Tile & region) {
+	vector<Tile> tiles;
+	unsigned int right = region.x + region.width, bottom = region.y + region.height;
+	if (region.width > 0 && region.height > 0)
+		for (unsigned int y = region.y - region.y % TILE_SIZE; y < bottom; y += TILE_SIZE)
+			for (unsigned int x = region.x - region.x % TILE_SIZE; x < right; x += TILE_SIZE) {
+				Tile tile;
+				tile.x = max (x, region.x);
+				tile.y = max (y, region.y);
+				tile.width = min (x + TILE_SIZE, right) - tile.x;
+				tile.height = min (y + TILE_SIZE, bottom) - tile.y;
+				tiles.push_back (tile);
+			}
+	return tiles;
+}
+
+void TileScheduler::distribute (unsigned int numWorkers) {
+	// Consecutive runs of about the same length
+	if (numWorkers == 0) numWorkers = 1;
+	vector<Run> (numWorkers).swap (runs);
+	for (unsigned int w = 0; w < numWorkers; w++)
+		runs[w].range = pack ((uint64_t) tiles.size() * w / numWorkers, (uint64_t) tiles.size() * (w+1) / numWorkers);
+}
+
+bool TileScheduler::next (unsigned int worker, unsigned int & t) {
+	Run & run = runs[worker % runs.size()];
+	uint64_t range = run.range.load (memory_order_acquire);
+	while (begin (range) < end (range)) {
+		if (run.range.compare_exchange_weak (range, pack (begin (range) + 1, end (range)), memory_order_acq_rel, memory_order_acquire)) {
+			t = begin (range);
+			return true;
+		}
+	}
+	return steal (worker % runs.size(), t);
+}
+
+bool TileScheduler::steal (unsigned int worker, unsigned int & t) {
+	// Visit the other workers once, from the next one on, until one has tiles
+	// left. Tiles only ever leave the runs while they are being stolen, so a
+	// worker that finds all runs empty may stop: the thief holding the last
+	// tiles renders them.
+	for (unsigned int i = 1; i < runs.size(); i++) {
+		Run & victim = runs[(worker + i) % runs.size()];
+		uint64_t range = victim.range.load (memory_order_acquire);
+		while (begin (range) < end (range)) {
+			uint32_t half = (end (range) - begin (range) + 1) / 2;
+			uint32_t first = end (range) - half;
+			if (!victim.range.compare_exchange_weak (range, pack (begin (range), first), memory_order_acq_rel, memory_order_acquire))
+				continue;
+
+			// Keep the first stolen tile, and make the others our own run. Ours
+			// is empty, and nobody changes an empty run, so a store is enough.
+			steals.fetch_add (1, memory_order_relaxed);
+			runs[worker].range.store (pack (first + 1, first + half), memory_order_release);
+			t = first;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,98 @@
+/**
+ * TileScheduler C++ Header (TileScheduler.hpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * TileScheduler Class
+ * Splits an image into square tiles and hands them out to worker threads.
+ *
+ * Each worker starts with its own run of consecutive tiles, in scanline
+ * order, and takes them from the front. A worker whose run is empty steals
+ * the back half of another worker's run, so that the threads stay busy
+ * until the last tile however uneven the cost of the tiles is. Runs are
+ * updated with a single compare-and-swap, without any lock.
+ */
+class TileScheduler {
+	public:
+		/**
+		 * Side of a tile, in pixels
+		 */
+		static const unsigned int TILE_SIZE = 16;
+
+		/**
+		 * Pixels of a tile. Tiles on the right and bottom edges may be smaller.
+		 */
+		struct Tile {
+			unsigned int x, y;
+			unsigned int width, height;
+		};
+
+		/**
+		 * TileScheduler Class Constructor
+		 */
+		TileScheduler (unsigned int width, unsigned int height, unsigned int numWorkers);
+
+		/**
+		 * Only the pixels of region, in tiles of the same grid as the whole
+		 * image, cut at the edges of the region
+		 */
+		TileScheduler (const Tile & region, unsigned int numWorkers);
+
+		/**
+		 * Only the given tiles, in this order
+		 */
+		TileScheduler (const vector<Tile> & tiles, unsigned int numWorkers);
+
+		// Workers share a scheduler: it is not copied
+		TileScheduler (const TileScheduler & s) = delete;
+		TileScheduler & operator= (const TileScheduler & s) = delete;
+
+		/**
+		 * Tiles of region, on the grid of the whole image, cut at its edges
+		 */
+		static vector<Tile> split (const Tile & region);
+
+		inline unsigned int getNumTiles () const { return tiles.size(); }
+		inline const Tile & getTile (unsigned int t) const { return tiles[t]; }
+
+		/**
+		 * Next tile for the given worker, in [0, number of workers). Returns
+		 * false once no worker has any tile left.
+		 */
+		bool next (unsigned int worker, unsigned int & t);
+
+		/**
+		 * Number of tiles stolen so far
+		 */
+		inline unsigned int getNumSteals () const { return steals.load (memory_order_relaxed); }
+
+	protected:
+		/**
+		 * Run of tiles [begin, end) of a worker, packed in one word, alone on
+		 * its cache line
+		 */
+		struct Run {
+			atomic<uint64_t> range;
+			char padding[64 - sizeof (atomic<uint64_t>)];
+		};
+
+		static inline uint64_t pack (uint32_t begin, uint32_t end) { return ((uint64_t) begin << 32) | end; }
+		static inline uint32_t begin (uint64_t range) { return range >> 32; }
+		static inline uint32_t end (uint64_t range) { return (uint32_t) range; }
+
+		void distribute (unsigned int numWorkers);
+		bool steal (unsigned int worker, unsigned int & t);
+
+		vector<Tile> tiles;
+		vector<Run> runs;
+		atomic<unsigned int> steals;
+};
@@ -5,6 +5,7 @@
 #include <string>
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 
 #include <QDockWidget>
 #include <QGroupBox>
@@ -38,7 +39,7 @@
 using namespace std;
 
 
-Window::Window () : QMainWindow (NULL) {
+Window::Window () : QMainWindow (NULL), selectedObject (-1) {
 	// Load splash
 	QPixmap pixmap("RenderBoy.png");
 	QSplashScreen *splash = new QSplashScreen(pixmap);
@@ -71,6 +72,17 @@ Window::Window () : QMainWindow (NULL) {
 	imageLabel->setScaledContents (true);
 	imageLabel->setPixmap (QPixmap::fromImage (rayImage));
 	connect (RayTracer::getInstance(), SIGNAL(finished(const QImage&)), this, SLOT(setRayImage (const QImage&)));
+	connect (RayTracer::getInstance(), SIGNAL(updated(const QImage&)), this, SLOT(setRayImage (const QImage&)));
+
+	// Changing colours and lights shades the hits of the last image again,
+	// as long as they fit in the budget of the G-buffer
+	RayTracer::getInstance()->setKeepHits (true);
+
+	connect (Scene::getInstance(), SIGNAL (objectsChanged ()), viewer, SLOT (updateGL ()));
+	connect (Scene::getInstance(), SIGNAL (objectChanged (int)), RayTracer::getInstance(), SLOT (invalidateObject (int)));
+	connect (Scene::getInstance(), SIGNAL (objectsChanged ()), RayTracer::getInstance(), SLOT (updateScene ()));
+	connect (Scene::getInstance(), SIGNAL (lightsChanged ()), RayTracer::getInstance(), SLOT (updateScene ()));
+	connect (viewer->camera()->frame(), SIGNAL (modified ()), this, SLOT (cameraChanged ()));
 
 	renderingLayout->addWidget (viewer);
 	renderingLayout->addWidget (imageLabel);
@@ -98,12 +110,41 @@ Window::~Window () {
 }
 
 void Window::setRayImage (const QImage & img) {
+	rayImage = img;
 	imageLabel->setPixmap (QPixmap::fromImage (img));
 }
 
 void Window::renderRayImage () {
-	RayTracer::getInstance ()->setCamera (viewer->getCamera());
-	RayTracer::getInstance ()->start ();
+	RayTracer::getInstance ()->requestRender (viewer->getCamera());
+}
+
+void Window::renderRegion (const QRect & rect) {
+	// The region is rendered over the image shown, with its camera. If the
+	// view changed since, or that render was cancelled, there is no image to
+	// render it over: the whole image is rendered from the current view.
+	Camera cam;
+	if (!RayTracer::getInstance ()->getFinishedCamera (cam) || !cam.sameView (viewer->getCamera ())) {
+		renderRayImage ();
+		return;
+	}
+
+	// The label scales the image to its own size
+	float sx = (float) cam.screenWidth () / imageLabel->width (), sy = (float) cam.screenHeight () / imageLabel->height ();
+	int left = (int) floor (rect.left () * sx), top = (int) floor (rect.top () * sy);
+	int right = (int) ceil ((rect.right () + 1) * sx), bottom = (int) ceil ((rect.bottom () + 1) * sy);
+	RayTracer::getInstance ()->requestRender (cam, QRect (left, top, right - left, bottom - top));
+}
+
+void Window::refreshRayImage () {
+	// Only the shading changed: the ray tracer reuses the primary hits of the last image
+	if (!rayImage.isNull ())
+		renderRayImage ();
+}
+
+void Window::cameraChanged () {
+	// The frame being rendered is stale: start again from the new viewpoint
+	if (RayTracer::getInstance ()->isRunning ())
+		renderRayImage ();
 }
 
 void Window::setBGColor () {
@@ -113,6 +154,40 @@ void Window::setBGColor () {
 		RayTracer::getInstance ()->setBackgroundColor (Vec3Df (c.red (), c.green (), c.blue ()));
 		viewer->setBackgroundColor (c);
 		viewer->updateGL ();
+		refreshRayImage ();
+	}
+}
+
+void Window::setLightColor () {
+	vector<Light> & lights = Scene::getInstance ()->getLights ();
+	if (lights.empty ()) return;
+	const Vec3Df & current = lights[0].getColor ();
+	QColor c = QColorDialog::getColor (QColor::fromRgbF (min (current[0], 1.f), min (current[1], 1.f), min (current[2], 1.f)), this);
+	if (c.isValid () == true) {
+		// With light AOVs, the ray tracer only recombines them
+		for (vector<Light>::iterator light = lights.begin(); light != lights.end(); light++)
+			light->setColor (Vec3Df (c.redF (), c.greenF (), c.blueF ()));
+		RayTracer::getInstance ()->updateScene ();
+		viewer->updateGL ();
+		refreshRayImage ();
+	}
+}
+
+void Window::setObjectColor () {
+	Scene * scene = Scene::getInstance ();
+	if (selectedObject < 0) {
+		statusBar ()->showMessage ("Click an object of the rendered image first");
+		return;
+	}
+	Material material = scene->getObjects ()[selectedObject].getMaterial ();
+	const Vec3Df & current = material.getColor ();
+	QColor c = QColorDialog::getColor (QColor::fromRgbF (min (current[0], 1.f), min (current[1], 1.f), min (current[2], 1.f)), this);
+	if (c.isValid () == true) {
+		// A render in progress keeps the former material. The next render
+		// only traces again the tiles that see the object.
+		material.setColor (Vec3Df (c.redF (), c.greenF (), c.blueF ()));
+		scene->setMaterial (selectedObject, material);
+		refreshRayImage ();
 	}
 }
 
@@ -144,6 +219,8 @@ void Window::displayPointInfo (QMouseEvent* me) {
 	cout << " (I) Raytracing: Click at (" << me->x() << ", " << me->y() << ")" << endl;
 
 	Scene::getInstance()->setSelectedBoundingBox(rayTracer->debug ((unsigned int)me->x(), cam.screenHeight() - (unsigned int)me->y() + 1));
+	selectedObject = rayTracer->pickObject ((unsigned int)me->x(), cam.screenHeight() - (unsigned int)me->y() + 1);
+	cout << " (I) Selected object " << selectedObject << endl;
 	viewer->updateGL ();
 }
 
@@ -184,8 +261,9 @@ void Window::initControlWidget () {
 	fuzzySlider->setTracking (false);
 	fuzzySlider->setMinimum (0); // Fuzziness = 10^(-3 + Value/8))
 	fuzzySlider->setMaximum (20);
-	fuzzySlider->setValue (6);
+	fuzzySlider->setValue (Scene::DEFAULT_FUZZINESS);
 	connect (fuzzySlider, SIGNAL (valueChanged(int)), Scene::getInstance(), SLOT (setFuzziness(int)));
+	connect (fuzzySlider, SIGNAL (valueChanged(int)), RayTracer::getInstance(), SLOT (invalidateGBuffer()));
 	rayLayout->addWidget (fuzzySlider);
 
 	QLabel * radiusLabel = new QLabel ("Light Source Radius", rayGroupBox);
@@ -197,16 +275,34 @@ void Window::initControlWidget () {
 	radiusSlider->setMaximum (5);
 	radiusSlider->setValue (1);
 	connect (radiusSlider, SIGNAL (valueChanged(int)), Scene::getInstance(), SLOT (setRadius(int)));
+	connect (radiusSlider, SIGNAL (valueChanged(int)), this, SLOT (refreshRayImage()));
 	rayLayout->addWidget (radiusSlider);
 
 	QCheckBox * aliasingBox = new QCheckBox ("Anti-Aliasing", rayGroupBox);
-	connect (aliasingBox, SIGNAL (toggled (bool)), Scene::getInstance(), SLOT (setAntiAliasing (bool)));
+	connect (aliasingBox, SIGNAL (toggled (bool)), RayTracer::getInstance(), SLOT (setAntiAliasing (bool)));
 	rayLayout->addWidget (aliasingBox);
 
+	QCheckBox * rouletteBox = new QCheckBox ("Russian Roulette", rayGroupBox);
+	connect (rouletteBox, SIGNAL (toggled (bool)), RayTracer::getInstance(), SLOT (setRussianRoulette (bool)));
+	rayLayout->addWidget (rouletteBox);
+
+	QCheckBox * aovBox = new QCheckBox ("Light AOVs", rayGroupBox);
+	connect (aovBox, SIGNAL (toggled (bool)), RayTracer::getInstance(), SLOT (setLightAOVs (bool)));
+	rayLayout->addWidget (aovBox);
+
+	QCheckBox * progressiveBox = new QCheckBox ("Progressive", rayGroupBox);
+	connect (progressiveBox, SIGNAL (toggled (bool)), RayTracer::getInstance(), SLOT (setProgressive (bool)));
+	rayLayout->addWidget (progressiveBox);
+
 	QPushButton * rayButton = new QPushButton ("Render", rayGroupBox);
 	rayLayout->addWidget (rayButton);
 	connect (rayButton, SIGNAL (clicked ()), this, SLOT (renderRayImage ()));
 	connect (imageLabel, SIGNAL (clicked(QMouseEvent*)), this, SLOT (displayPointInfo(QMouseEvent*)));
+	connect (imageLabel, SIGNAL (selected(const QRect&)), this, SLOT (renderRegion(const QRect&)));
+
+	QPushButton * stopButton = new QPushButton ("Stop", rayGroupBox);
+	rayLayout->addWidget (stopButton);
+	connect (stopButton, SIGNAL (clicked ()), RayTracer::getInstance(), SLOT (stop ()));
 
 	QPushButton * saveButton  = new QPushButton ("Save", rayGroupBox);
 	connect (saveButton, SIGNAL (clicked ()) , this, SLOT (exportRayImage ()));
@@ -227,6 +323,14 @@ void Window::initControlWidget () {
 	connect (bgColorButton, SIGNAL (clicked()) , this, SLOT (setBGColor()));
 	globalLayout->addWidget (bgColorButton);
 
+	QPushButton * lightColorButton  = new QPushButton ("Light Color", globalGroupBox);
+	connect (lightColorButton, SIGNAL (clicked()) , this, SLOT (setLightColor()));
+	globalLayout->addWidget (lightColorButton);
+
+	QPushButton * objectColorButton  = new QPushButton ("Object Color", globalGroupBox);
+	connect (objectColorButton, SIGNAL (clicked()) , this, SLOT (setObjectColor()));
+	globalLayout->addWidget (objectColorButton);
+
 	QPushButton * aboutButton  = new QPushButton ("About", globalGroupBox);
 	connect (aboutButton, SIGNAL (clicked()) , this, SLOT (about()));
 	globalLayout->addWidget (aboutButton);
@@ -35,11 +35,16 @@ public:
 public slots :
     void renderRayImage ();
     void setBGColor ();
+    void setLightColor ();
+    void setObjectColor ();
     void exportGLImage ();
     void exportRayImage ();
     void about ();
 		void displayPointInfo (QMouseEvent* me);
 		void setRayImage (const QImage & img);
+		void cameraChanged ();
+		void renderRegion (const QRect & rect);
+		void refreshRayImage ();
     
 private :
     void initControlWidget ();
@@ -52,6 +57,8 @@ private :
     QClickableLabel * imageLabel;
     QImage rayImage;
 		QProgressBar * progressbar ;
+		// Object last clicked on the rendered image, or -1
+		int selectedObject;
 };
 
 #endif // WINDOW_H
@@ -0,0 +1,90 @@
+# Headless renderer: the ray tracing core, without any window, OpenGL or
+# libQGLViewer. Only needs QtCore and QtGui (for QImage), no X server.
+#
+#   qmake renderboy-cli.pro && make
+#   ./renderboy-cli [options] <scene file> <output image>
+
+TEMPLATE = app
+TARGET   = renderboy-cli
+CONFIG  += qt console warn_on release thread
+CONFIG  -= app_bundle
+QT       = core gui
+
+DEFINES += RENDERBOY_HEADLESS
+
+HEADERS = Vertex.h \
+          Triangle.h \
+          Mesh.h \
+          BoundingBox.h \
+          Material.h \
+          Object.h \
+          Light.h \
+          Scene.h \
+          RayTracer.h \
+          Ray.h \
+          Camera.hpp \
+					KDTreeNode.hpp \
+					Surfel.hpp \
+					PointCloud.hpp \
+					PackedVertex.hpp \
+					MeshAdjacency.hpp \
+					MeshSimplifier.hpp \
+					SceneFile.hpp \
+					GeometryCache.hpp \
+					ChunkedMesh.hpp \
+					Shape.hpp \
+					TextureCache.hpp \
+					SceneGenerator.hpp \
+					TileScheduler.hpp \
+					TaskPool.hpp \
+					FrameBuffer.hpp \
+					GBuffer.hpp \
+					ObjectSet.hpp \
+					RenderSnapshot.hpp
+
+SOURCES = Vertex.cpp \
+          Triangle.cpp \
+          Mesh.cpp \
+          BoundingBox.cpp \
+          Material.cpp \
+          Object.cpp \
+          Light.cpp \
+          Scene.cpp \
+          RayTracer.cpp \
+          Ray.cpp \
+          Camera.cpp \
+          MainCli.cpp \
+					KDTreeNode.cpp \
+					PointCloud.cpp \
+					MeshAdjacency.cpp \
+					MeshSimplifier.cpp \
+					SceneFile.cpp \
+					GeometryCache.cpp \
+					ChunkedMesh.cpp \
+					Shape.cpp \
+					TextureCache.cpp \
+					SceneGenerator.cpp \
+					TileScheduler.cpp \
+					TaskPool.cpp \
+					FrameBuffer.cpp \
+					GBuffer.cpp
+
+DESTDIR = .
+
+QMAKE_CXXFLAGS += -ggdb -std=c++0x
+QMAKE_LFLAGS += -ggdb
+
+unix {
+  release:QMAKE_CFLAGS_RELEASE -= -g
+  release:QMAKE_CXXFLAGS_RELEASE -= -g
+  release:QMAKE_CXXFLAGS_RELEASE += -O3 -mfpmath=sse -msse2
+  release:QMAKE_CFLAGS_RELEASE += -O3 -mfpmath=sse -msse2
+
+  MOC_DIR = .moc-cli
+  OBJECTS_DIR = .obj-cli
+}
+
+win32 {
+  release:QMAKE_CXXFLAGS_RELEASE += -O3 -mfpmath=sse -msse2
+  release:QMAKE_CFLAGS_RELEASE += -O3 -mfpmath=sse -msse2
+}
@@ -19,7 +19,22 @@ HEADERS = Window.h \
 					QClickableLabel.hpp \
 					KDTreeNode.hpp \
 					Surfel.hpp \
-					PointCloud.hpp
+					PointCloud.hpp \
+					PackedVertex.hpp \
+					MeshAdjacency.hpp \
+					MeshSimplifier.hpp \
+					SceneFile.hpp \
+					GeometryCache.hpp \
+					ChunkedMesh.hpp \
+					Shape.hpp \
+					TextureCache.hpp \
+					SceneGenerator.hpp \
+					TileScheduler.hpp \
+					TaskPool.hpp \
+					FrameBuffer.hpp \
+					GBuffer.hpp \
+					ObjectSet.hpp \
+					RenderSnapshot.hpp
 
 SOURCES = Window.cpp \
           GLViewer.cpp \
@@ -37,12 +52,24 @@ SOURCES = Window.cpp \
 					QClickableLabel.cpp \
           Camera.cpp \
           Main.cpp \
-					KDTreeNode.cpp
+					KDTreeNode.cpp \
+					MeshAdjacency.cpp \
+					MeshSimplifier.cpp \
+					SceneFile.cpp \
+					GeometryCache.cpp \
+					ChunkedMesh.cpp \
+					Shape.cpp \
+					TextureCache.cpp \
+					SceneGenerator.cpp \
+					TileScheduler.cpp \
+					TaskPool.cpp \
+					FrameBuffer.cpp \
+					GBuffer.cpp
           
 DESTDIR = .
 
-QMAKE_CXXFLAGS += -fopenmp -ggdb
-QMAKE_LFLAGS += -fopenmp -ggdb
+QMAKE_CXXFLAGS += -ggdb -std=c++0x
+QMAKE_LFLAGS += -ggdb
 
 QT_VERSION=$$[QT_VERSION]
 
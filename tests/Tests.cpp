@@ -0,0 +1,346 @@
+/**
+ * Unit checks C++ Source code (tests/Tests.cpp)
+ *
+ * Part of Renderboy. You are free to copy, adapt or modify it.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include <QDir>
+
+#include "TileScheduler.hpp"
+#include "TaskPool.hpp"
+#include "ObjectSet.hpp"
+#include "FrameBuffer.hpp"
+#include "RenderSnapshot.hpp"
+#include "GeometryCache.hpp"
+#include "GBuffer.hpp"
+
+using namespace std;
+
+static unsigned int checks = 0, failures = 0;
+
+#define CHECK(condition) check ((condition), #condition, __FILE__, __LINE__)
+
+static void check (bool condition, const char * text, const char * file, int line) {
+	checks++;
+	if (!condition) {
+		failures++;
+		cerr << "[tests] " << file << ":" << line << ": failed " << text << endl;
+	}
+}
+
+static string temporaryFile (const string & name) {
+	return QDir::tempPath().toStdString() + "/renderboy-tests-" + name;
+}
+
+/**
+ * Each pixel of the image is in exactly one tile, and each tile is handed
+ * out once, with threads stealing from each other
+ */
+static void testTileScheduler () {
+	const unsigned int width = 100, height = 70, numWorkers = 3;
+	TileScheduler scheduler (width, height, numWorkers);
+	vector<atomic<unsigned int> > handed (scheduler.getNumTiles());
+	for (unsigned int t = 0; t < handed.size(); t++) handed[t] = 0;
+	vector<thread> workers;
+	for (unsigned int w = 0; w < numWorkers; w++)
+		workers.push_back (thread ([&scheduler, &handed, w] () {
+			unsigned int t;
+			while (scheduler.next (w, t)) handed[t]++;
+		}));
+	for (unsigned int w = 0; w < numWorkers; w++) workers[w].join();
+	bool once = true;
+	for (unsigned int t = 0; t < handed.size(); t++) once = once && handed[t] == 1;
+	CHECK (once);
+
+	vector<unsigned int> covered (width * height, 0);
+	for (unsigned int t = 0; t < scheduler.getNumTiles(); t++) {
+		const TileScheduler::Tile & tile = scheduler.getTile (t);
+		CHECK (tile.width <= TileScheduler::TILE_SIZE && tile.height <= TileScheduler::TILE_SIZE);
+		for (unsigned int y = tile.y; y < tile.y + tile.height && y < height; y++)
+			for (unsigned int x = tile.x; x < tile.x + tile.width && x < width; x++) covered[y * width + x]++;
+	}
+	bool exact = true;
+	for (unsigned int p = 0; p < covered.size(); p++) exact = exact && covered[p] == 1;
+	CHECK (exact);
+
+	// A region is cut on the grid of the whole image
+	TileScheduler::Tile region = { 10, 20, 30, 5 };
+	TileScheduler regional (region, 1);
+	unsigned int pixels = 0, t;
+	while (regional.next (0, t)) {
+		const TileScheduler::Tile & tile = regional.getTile (t);
+		CHECK (tile.x >= region.x && tile.y >= region.y && tile.x + tile.width <= region.x + region.width && tile.y + tile.height <= region.y + region.height);
+		CHECK (tile.x % TileScheduler::TILE_SIZE == 0 || tile.x == region.x);
+		pixels += tile.width * tile.height;
+	}
+	CHECK (pixels == region.width * region.height);
+}
+
+static void testTaskPool () {
+	TaskPool * pool = TaskPool::getInstance();
+	unsigned long sum = pool->parallelReduce (0, 100000, 0ul, [] (unsigned int i) { return (unsigned long) i; },
+		[] (unsigned long a, unsigned long b) { return a + b; });
+	CHECK (sum == 100000ul * 99999ul / 2);
+
+	vector<int> visited (5000, 0);
+	pool->parallelFor (0, visited.size(), 16, [&visited] (unsigned int i) { visited[i]++; });
+	bool once = true;
+	for (unsigned int i = 0; i < visited.size(); i++) once = once && visited[i] == 1;
+	CHECK (once);
+
+	// Exceptions of tasks come back through wait
+	bool caught = false;
+	TaskPool::Group group;
+	group.run ([] () { throw 42; });
+	try {
+		group.wait();
+	} catch (int e) {
+		caught = (e == 42);
+	}
+	CHECK (caught);
+}
+
+static void testObjectSet () {
+	ObjectSet a, b;
+	CHECK (a.empty());
+	a.insert (3);
+	a.insert (130);
+	CHECK (a.contains (3) && a.contains (130));
+	CHECK (!a.contains (4) && !a.contains (1000));
+	CHECK (!a.intersects (b));
+	b.insert (64);
+	CHECK (!a.intersects (b));
+	b.insert (130);
+	CHECK (a.intersects (b) && b.intersects (a));
+	ObjectSet c;
+	c.insert (a);
+	CHECK (c.contains (3) && c.contains (130));
+	c.clear();
+	CHECK (c.empty() && !c.contains (3));
+	c.swap (b);
+	CHECK (b.empty() && c.contains (64));
+}
+
+static float readFloat (istream & in) {
+	float f;
+	in.read ((char *) &f, sizeof (f));
+	return f;
+}
+
+static uint32_t readInt (istream & in) {
+	uint32_t i;
+	in.read ((char *) &i, sizeof (i));
+	return i;
+}
+
+/**
+ * Pixels written as floats come back exactly, in the order of each format
+ */
+static void testFrameBuffer () {
+	const unsigned int width = 21, height = 18;
+	FrameBuffer buffer (width, height);
+	for (unsigned int y = 0; y < height; y++)
+		for (unsigned int x = 0; x < width; x++) {
+			buffer.add (x, y, Vec3Df (x, y, 0.5f), 2.f);
+			buffer.add (x, y, Vec3Df (x, y, 1.5f), 2.f);
+		}
+	CHECK (buffer.getColor (20, 17) == Vec3Df (20.f, 17.f, 1.f));
+	FrameBuffer part = buffer.copy (16, 2, 5, 16);
+	CHECK (part.getWidth() == 5 && part.getColor (4, 15) == buffer.getColor (20, 17));
+	CHECK (FrameBuffer::isFloatFormat ("a.PFM") && FrameBuffer::isFloatFormat ("b.exr") && !FrameBuffer::isFloatFormat ("c.png"));
+
+	// PFM: rows go up
+	string pfm = temporaryFile ("buffer.pfm");
+	buffer.save (pfm);
+	ifstream in (pfm.c_str(), ios::binary);
+	string magic;
+	unsigned int w, h;
+	float scale;
+	in >> magic >> w >> h >> scale;
+	in.get();
+	CHECK (magic == "PF" && w == width && h == height && scale < 0.f);
+	bool same = true;
+	for (unsigned int y = height; y-- > 0;)
+		for (unsigned int x = 0; x < width; x++)
+			for (unsigned int c = 0; c < 3; c++) same = same && readFloat (in) == buffer.getColor (x, y)[c];
+	CHECK (same && in.good());
+	in.close();
+	remove (pfm.c_str());
+
+	// EXR: the offset table points at the scanlines, each one B, G then R
+	string exr = temporaryFile ("buffer.exr");
+	buffer.save (exr);
+	in.open (exr.c_str(), ios::binary | ios::ate);
+	streamoff size = in.tellg();
+	in.seekg (0);
+	CHECK (readInt (in) == 20000630 && readInt (in) == 2);
+	streamoff lineBytes = 8 + 12 * width, lines = size - height * lineBytes;
+	in.seekg (lines - 8 * height);
+	CHECK (readInt (in) == (uint32_t) lines && readInt (in) == 0);
+	in.seekg (lines);
+	same = true;
+	for (unsigned int y = 0; y < height; y++) {
+		same = same && readInt (in) == y && readInt (in) == 12 * width;
+		for (int c = 2; c >= 0; c--)
+			for (unsigned int x = 0; x < width; x++) same = same && readFloat (in) == buffer.getColor (x, y)[c];
+	}
+	CHECK (same && in.good());
+	in.close();
+	remove (exr.c_str());
+}
+
+static Mesh triangle () {
+	vector<Vertex> vertices;
+	vertices.push_back (Vertex (Vec3Df (0.f, 0.f, 0.f), Vec3Df (0.f, 0.f, 1.f)));
+	vertices.push_back (Vertex (Vec3Df (1.f, 0.f, 0.f), Vec3Df (0.f, 0.f, 1.f)));
+	vertices.push_back (Vertex (Vec3Df (0.f, 1.f, 0.f), Vec3Df (0.f, 0.f, 1.f)));
+	vector<Triangle> triangles (1, Triangle (0, 1, 2));
+	return Mesh (std::move (vertices), std::move (triangles));
+}
+
+/**
+ * Each change gives a new version, sharing what did not change
+ */
+static void testRenderSnapshot () {
+	shared_ptr<const RenderSnapshot> first (new RenderSnapshot ());
+	RenderSnapshot::Options options;
+	options.samples = 7;
+	shared_ptr<const RenderSnapshot> second = first->withOptions (options);
+	CHECK (second->getVersion() == first->getVersion() + 1);
+	CHECK (second->getOptions().samples == 7 && first->getOptions().samples != 7);
+	CHECK (&second->getLights() == &first->getLights());
+
+	vector<Light> lights (2);
+	shared_ptr<const RenderSnapshot> third = second->withLights (lights);
+	CHECK (third->getVersion() == second->getVersion() + 1);
+	CHECK (third->getLights().size() == 2 && second->getLights().empty());
+	CHECK (third->getOptions().samples == 7);
+
+	// The objects are copied, sharing their shapes: the scene changes its
+	// own objects, never those of a snapshot
+	vector<Object> objects (1, Object (shared_ptr<const Shape> (new Shape (triangle ())), Material ()));
+	shared_ptr<const RenderSnapshot> fourth = third->withObjects (objects);
+	CHECK (fourth->getVersion() == third->getVersion() + 1 && third->getObjects().empty());
+	CHECK (&fourth->getObjects()[0].getShape() == &objects[0].getShape());
+	Material red;
+	red.setColor (Vec3Df (1.f, 0.f, 0.f));
+	objects[0].setMaterial (red);
+	objects[0].setShape (shared_ptr<const Shape> (new Shape (Mesh ())), Object::Placement ());
+	CHECK (fourth->getObjects()[0].getMaterial().getColor() == Material().getColor());
+	CHECK (fourth->getObjects()[0].getMesh().getNumTriangles() == 1);
+}
+
+/**
+ * Objects sharing a shape each have their own place in the scene
+ */
+static void testObjectPlacement () {
+	shared_ptr<const Shape> shape (new Shape (triangle ()));
+	Object::Placement placement;
+	placement.center = Vec3Df (0.5f, 0.5f, 0.f);
+	placement.scale = 2.f;
+	placement.translation = Vec3Df (10.f, 0.f, 0.f);
+	Object here (shape, Material ()), there (shape, Material (), placement);
+	CHECK (!here.isPlaced() && there.isPlaced() && &here.getShape() == &there.getShape());
+	CHECK (here.getBoundingBox().getMin() == Vec3Df (0.f, 0.f, 0.f));
+	CHECK (there.getBoundingBox().getMin() == Vec3Df (9.f, -1.f, 0.f) && there.getBoundingBox().getMax() == Vec3Df (11.f, 1.f, 0.f));
+	CHECK (there.toShape (there.toWorld (Vec3Df (1.f, 0.f, 0.f))) == Vec3Df (1.f, 0.f, 0.f));
+}
+
+/**
+ * A chunk that cannot be read gives an invalid lock, and is reported once
+ */
+static void testGeometryCache () {
+	Mesh mesh = triangle ();
+	GeometryCache cache;
+	string good = temporaryFile ("good.chunk"), bad = temporaryFile ("bad.chunk");
+	unsigned int goodId = cache.addChunk (good, mesh), badId = cache.addChunk (bad, mesh);
+	ofstream (bad.c_str(), ios::binary) << "RBCHUNK1 and not much else";
+	{
+		GeometryCache::Lock chunk (cache, goodId);
+		CHECK (chunk.isValid() && chunk->mesh.getNumTriangles() == 1);
+	}
+	for (unsigned int i = 0; i < 2; i++) {
+		GeometryCache::Lock chunk (cache, badId);
+		CHECK (!chunk.isValid());
+	}
+	CHECK (cache.getNumFailures() == 1);
+
+	// Over budget, locked chunks stay in memory, and the others are evicted
+	// on the next miss
+	GeometryCache small (1);
+	unsigned int ids[3];
+	for (unsigned int i = 0; i < 3; i++) ids[i] = small.addChunk (good + char ('0' + i), mesh);
+	{
+		GeometryCache::Lock first (small, ids[0]), second (small, ids[1]);
+		CHECK (first.isValid() && second.isValid() && small.getEvictions() == 0);
+	}
+	{
+		GeometryCache::Lock first (small, ids[0]);
+		CHECK (small.getHits() == 1 && small.getMisses() == 2);
+	}
+	{
+		GeometryCache::Lock third (small, ids[2]);
+		CHECK (third.isValid() && small.getEvictions() == 2 && small.getBytesUsed() == third->bytes);
+	}
+	for (unsigned int i = 0; i < 3; i++) remove ((good + char ('0' + i)).c_str());
+	remove (good.c_str());
+	remove (bad.c_str());
+}
+
+/**
+ * Hits added one sample of each pixel at a time come back by pixel, in the
+ * order of their samples, and none are added past the budget
+ */
+static void testGBuffer () {
+	const unsigned int width = 20, height = 18;
+	GBuffer buffer;
+	buffer.resize (width, height);
+	for (int s = 0; s < 3; s++)
+		for (unsigned int y = 0; y < height; y++)
+			for (unsigned int x = 0; x < width; x++) {
+				GBuffer::Hit hit;
+				hit.object = s;
+				hit.position = Vec3Df (x, y, 0.f);
+				if (s < 2 || x == y) buffer.add (x, y, hit);
+			}
+	for (unsigned int y = 0; y < height; y += TileScheduler::TILE_SIZE)
+		for (unsigned int x = 0; x < width; x += TileScheduler::TILE_SIZE) buffer.finish (x, y);
+	bool sorted = true;
+	for (unsigned int y = 0; y < height; y++)
+		for (unsigned int x = 0; x < width; x++) {
+			const GBuffer::Hit * hits = buffer.getHits (x, y);
+			sorted = sorted && buffer.getNumHits (x, y) == (x == y ? 3u : 2u);
+			for (unsigned int s = 0; sorted && s < buffer.getNumHits (x, y); s++)
+				sorted = hits[s].object == (int) s && hits[s].position == Vec3Df (x, y, 0.f);
+		}
+	CHECK (sorted && buffer.isComplete());
+
+	buffer.clear (0, 0, TileScheduler::TILE_SIZE, TileScheduler::TILE_SIZE);
+	CHECK (buffer.getNumHits (1, 1) == 0 && buffer.getNumHits (width - 1, height - 1) == 2);
+	buffer.setBudget (buffer.getBytesUsed ());
+	buffer.add (1, 1, GBuffer::Hit ());
+	CHECK (!buffer.isComplete() && buffer.getNumHits (1, 1) == 0 && buffer.getBytesUsed () <= buffer.getBudget ());
+	buffer.resize (width, height);
+	CHECK (buffer.isComplete() && buffer.getBytesUsed () == 0);
+}
+
+int main () {
+	testTileScheduler ();
+	testTaskPool ();
+	testObjectSet ();
+	testFrameBuffer ();
+	testRenderSnapshot ();
+	testObjectPlacement ();
+	testGeometryCache ();
+	testGBuffer ();
+	TaskPool::destroyInstance ();
+
+	cout << " (I) " << checks - failures << " of " << checks << " checks passed" << endl;
+	return failures == 0 ? 0 : 1;
+}
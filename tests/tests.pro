@@ -0,0 +1,64 @@
+# Unit checks of the core classes. Only needs QtCore and QtGui, no X
+# server.
+#
+#   cd tests && qmake tests.pro && make check
+
+TEMPLATE = app
+TARGET   = renderboy-tests
+CONFIG  += qt console warn_on debug thread
+CONFIG  -= app_bundle
+QT       = core gui
+
+DEFINES += RENDERBOY_HEADLESS
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+HEADERS = ../Vertex.h \
+          ../Triangle.h \
+          ../Mesh.h \
+          ../BoundingBox.h \
+					../KDTreeNode.hpp \
+					../MeshAdjacency.hpp \
+					../GeometryCache.hpp \
+					../TileScheduler.hpp \
+					../TaskPool.hpp \
+					../FrameBuffer.hpp \
+					../ObjectSet.hpp \
+					../ChunkedMesh.hpp \
+					../MeshSimplifier.hpp \
+					../Shape.hpp \
+					../Object.h \
+					../RenderSnapshot.hpp \
+					../GBuffer.hpp
+
+SOURCES = ../Vertex.cpp \
+          ../Triangle.cpp \
+          ../Mesh.cpp \
+          ../BoundingBox.cpp \
+          Tests.cpp \
+					../KDTreeNode.cpp \
+					../MeshAdjacency.cpp \
+					../GeometryCache.cpp \
+					../TileScheduler.cpp \
+					../TaskPool.cpp \
+					../FrameBuffer.cpp \
+					../ChunkedMesh.cpp \
+					../MeshSimplifier.cpp \
+					../Shape.cpp \
+					../Object.cpp \
+					../GBuffer.cpp
+
+DESTDIR = .
+
+QMAKE_CXXFLAGS += -ggdb -std=c++0x
+QMAKE_LFLAGS += -ggdb
+
+# make check: build, then run the checks, failing if any does
+check.commands = ./renderboy-tests
+check.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += check
+
+unix {
+  MOC_DIR = .moc
+  OBJECTS_DIR = .obj
+}